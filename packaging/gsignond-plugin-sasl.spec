@@ -9,9 +9,15 @@ Source1: %{name}.manifest
 URL: https://01.org/gsso
 Requires(post): /sbin/ldconfig
 Requires(postun): /sbin/ldconfig
-BuildRequires: pkgconfig(glib-2.0) >= 2.30
+BuildRequires: pkgconfig(glib-2.0) >= 2.36
+BuildRequires: pkgconfig(gio-2.0) >= 2.36
 BuildRequires: pkgconfig(gsignond) >= 1.0.0
 BuildRequires: pkgconfig(libgsasl)
+BuildRequires: gperf
+BuildRequires: autoconf
+BuildRequires: automake
+BuildRequires: libtool
+BuildRequires: gtk-doc
 
 
 %description
@@ -33,7 +39,8 @@ cp %{SOURCE1} .
 
 
 %build
-%configure 
+autoreconf -fi
+%configure
 make %{?_smp_mflags}
 
 
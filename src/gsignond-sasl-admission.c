@@ -0,0 +1,212 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Admission control for CPU-heavy mechanism steps (key derivations).
+ *
+ * At most max_active of them run at once in the process; further ones wait
+ * in a FIFO queue of at most max_queued entries, and are rejected right away
+ * with a retryable error when the queue is full. The limits default to the
+ * number of processors and four times that, and can be overridden with
+ * SSO_SASL_KDF_MAX_ACTIVE and SSO_SASL_KDF_MAX_QUEUED environment variables.
+ * A step running in the thread of the default main context, which is where
+ * the plugin's signal interface runs, never waits: blocking there would
+ * stall cancel requests and the idle timer, so it is rejected like a step
+ * that finds the queue full.
+ */
+
+#include <stdlib.h>
+
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-admission.h"
+
+/* how often a queued waiter checks whether its session was canceled */
+#define CANCEL_POLL_INTERVAL (50 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct {
+    gboolean admitted;
+} GSignondSaslAdmissionWaiter;
+
+static GMutex admission_lock;
+static GCond admission_cond;
+static gboolean admission_initialized = FALSE;
+static guint max_active;
+static guint max_queued;
+static guint n_active = 0;
+static GQueue waiters = G_QUEUE_INIT;
+
+static guint64 n_admitted = 0;
+static guint64 n_rejected = 0;
+static guint64 total_wait_us = 0;
+static guint64 max_wait_us = 0;
+static guint max_queue_depth = 0;
+
+static guint
+_limit_from_env (const gchar *name, guint default_value)
+{
+    const gchar *value = g_getenv (name);
+    guint64 limit;
+
+    if (value == NULL)
+        return default_value;
+    limit = g_ascii_strtoull (value, NULL, 10);
+    return limit > G_MAXUINT ? G_MAXUINT : (guint) limit;
+}
+
+static void
+_init_limits (void)
+{
+    if (admission_initialized)
+        return;
+    max_active = _limit_from_env ("SSO_SASL_KDF_MAX_ACTIVE",
+                                  g_get_num_processors ());
+    max_queued = _limit_from_env ("SSO_SASL_KDF_MAX_QUEUED",
+                                  4 * g_get_num_processors ());
+    if (max_active == 0)
+        max_active = 1;
+    admission_initialized = TRUE;
+}
+
+void
+gsignond_sasl_admission_set_limits (guint active,
+                                    guint queued)
+{
+    g_mutex_lock (&admission_lock);
+    max_active = MAX (active, 1);
+    max_queued = queued;
+    admission_initialized = TRUE;
+    g_mutex_unlock (&admission_lock);
+}
+
+static void
+_record_wait (gint64 started)
+{
+    guint64 waited = g_get_monotonic_time () - started;
+
+    n_admitted++;
+    total_wait_us += waited;
+    if (waited > max_wait_us)
+        max_wait_us = waited;
+}
+
+/*
+ * Waits until the caller may start an expensive step. Gives up when
+ * @cancel_flag becomes non-zero, or immediately when the wait queue is
+ * full or the caller runs the default main context; in the latter cases
+ * @error is set to a %GSIGNOND_ERROR_SERVICE_NOT_AVAILABLE error, which
+ * means the request can be retried later.
+ *
+ * Every successful call must be paired with gsignond_sasl_admission_release().
+ */
+gboolean
+gsignond_sasl_admission_acquire (const volatile gint *cancel_flag,
+                                 GError **error)
+{
+    GSignondSaslAdmissionWaiter waiter = { FALSE };
+    gint64 started = g_get_monotonic_time ();
+
+    g_mutex_lock (&admission_lock);
+    _init_limits ();
+
+    if (n_active < max_active && g_queue_is_empty (&waiters)) {
+        n_active++;
+        _record_wait (started);
+        g_mutex_unlock (&admission_lock);
+        return TRUE;
+    }
+
+    if (g_queue_get_length (&waiters) >= max_queued ||
+        g_main_context_is_owner (g_main_context_default ())) {
+        n_rejected++;
+        g_mutex_unlock (&admission_lock);
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_SERVICE_NOT_AVAILABLE,
+                     "Too many concurrent authentications, retry later");
+        return FALSE;
+    }
+
+    g_queue_push_tail (&waiters, &waiter);
+    max_queue_depth = MAX (max_queue_depth, g_queue_get_length (&waiters));
+
+    while (!waiter.admitted) {
+        if (cancel_flag && g_atomic_int_get (cancel_flag)) {
+            g_queue_remove (&waiters, &waiter);
+            g_mutex_unlock (&admission_lock);
+            return FALSE;
+        }
+        g_cond_wait_until (&admission_cond, &admission_lock,
+                           g_get_monotonic_time () + CANCEL_POLL_INTERVAL);
+    }
+
+    /* n_active was already accounted for by the releasing thread */
+    _record_wait (started);
+    g_mutex_unlock (&admission_lock);
+    return TRUE;
+}
+
+void
+gsignond_sasl_admission_release (void)
+{
+    GSignondSaslAdmissionWaiter *next;
+
+    g_mutex_lock (&admission_lock);
+    next = g_queue_pop_head (&waiters);
+    if (next) {
+        /* hand the slot over to the oldest waiter */
+        next->admitted = TRUE;
+        g_cond_broadcast (&admission_cond);
+    } else {
+        n_active--;
+    }
+    g_mutex_unlock (&admission_lock);
+}
+
+void
+gsignond_sasl_admission_add_statistics (GVariantBuilder *builder)
+{
+    g_mutex_lock (&admission_lock);
+    _init_limits ();
+    g_variant_builder_add (builder, "{sv}", "KdfMaxActive",
+                           g_variant_new_uint32 (max_active));
+    g_variant_builder_add (builder, "{sv}", "KdfMaxQueued",
+                           g_variant_new_uint32 (max_queued));
+    g_variant_builder_add (builder, "{sv}", "KdfActive",
+                           g_variant_new_uint32 (n_active));
+    g_variant_builder_add (builder, "{sv}", "KdfQueueDepth",
+                           g_variant_new_uint32 (
+                               g_queue_get_length (&waiters)));
+    g_variant_builder_add (builder, "{sv}", "KdfMaxQueueDepth",
+                           g_variant_new_uint32 (max_queue_depth));
+    g_variant_builder_add (builder, "{sv}", "KdfAdmitted",
+                           g_variant_new_uint64 (n_admitted));
+    g_variant_builder_add (builder, "{sv}", "KdfRejected",
+                           g_variant_new_uint64 (n_rejected));
+    g_variant_builder_add (builder, "{sv}", "KdfWaitTimeUs",
+                           g_variant_new_uint64 (total_wait_us));
+    g_variant_builder_add (builder, "{sv}", "KdfMaxWaitTimeUs",
+                           g_variant_new_uint64 (max_wait_us));
+    g_mutex_unlock (&admission_lock);
+}
@@ -0,0 +1,616 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Client side of DIGEST-MD5 (RFC 2831).
+ *
+ * With the "auth" quality of protection, which is all sessions whose state
+ * lives outside the plugin object use, only the expected rspauth value is
+ * kept between the response and the server's rspauth, so
+ * gsignond_sasl_digest_md5_export() has nothing derived from the password
+ * to write out. With "auth-int" and "auth-conf" H(A1) is kept too, to key
+ * the security layer once the server is verified.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gsasl.h>
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-digest-md5.h"
+#include "gsignond-sasl-kdf.h"
+
+#ifdef WITH_DIGEST_MD5_ENGINE
+
+#define STATE_FORMAT "(yys)"
+#define CNONCE_SIZE 18
+#define DIGEST_SIZE 16
+#define DIGEST_HEX_SIZE (DIGEST_SIZE * 2)
+#define NONCE_COUNT "00000001"
+#define DEFAULT_MAXBUF 65536
+#define MAX_MAXBUF 16777215
+
+static const gchar *qop_tokens[] = { "auth", "auth-int", "auth-conf" };
+
+/* the ciphers of the security layer, by preference, with the number of
+ * bytes of H(A1) their keys are derived from */
+static const struct {
+    const gchar *name;
+    gsize key_len;
+} ciphers[] = {
+    { "rc4", 16 },
+    { "rc4-56", 7 },
+    { "rc4-40", 5 },
+};
+
+struct _GSignondSaslDigestMd5 {
+    GSignondSaslDigestMd5State state;
+    gchar rspauth[DIGEST_HEX_SIZE + 1];
+    GSignondSaslQop qop;
+    guint8 ha1[DIGEST_SIZE];
+    gsize cipher_key_len;
+    gsize maxbuf;
+};
+
+static gboolean
+_fail (GError **error, const gchar *message)
+{
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                 "DIGEST-MD5: %s", message);
+    return FALSE;
+}
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_new (void)
+{
+    return g_slice_new0 (GSignondSaslDigestMd5);
+}
+
+void
+gsignond_sasl_digest_md5_free (GSignondSaslDigestMd5 *digest)
+{
+    if (digest == NULL)
+        return;
+    memset (digest, 0, sizeof (*digest));
+    g_slice_free (GSignondSaslDigestMd5, digest);
+}
+
+GSignondSaslDigestMd5State
+gsignond_sasl_digest_md5_get_state (GSignondSaslDigestMd5 *digest)
+{
+    g_return_val_if_fail (digest != NULL,
+                          GSIGNOND_SASL_DIGEST_MD5_STATE_DONE);
+
+    return digest->state;
+}
+
+static gboolean
+_is_space (gchar c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Splits a challenge into its name=value directives; quoted values are
+ * unescaped and only the first occurrence of a name is kept */
+static GHashTable *
+_parse_directives (const gchar *text)
+{
+    GHashTable *directives = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, g_free);
+    const gchar *p = text;
+
+    while (*p) {
+        const gchar *name_start;
+        const gchar *name_end;
+        GString *value;
+        gchar *name;
+
+        while (_is_space (*p) || *p == ',')
+            p++;
+        if (*p == '\0')
+            break;
+        name_start = p;
+        while (*p && *p != '=' && *p != ',' && !_is_space (*p))
+            p++;
+        name_end = p;
+        while (_is_space (*p))
+            p++;
+        if (*p != '=' || name_end == name_start)
+            goto malformed;
+        p++;
+        while (_is_space (*p))
+            p++;
+
+        value = g_string_new (NULL);
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && p[1])
+                    p++;
+                g_string_append_c (value, *p);
+            }
+            if (*p != '"') {
+                g_string_free (value, TRUE);
+                goto malformed;
+            }
+            p++;
+        } else {
+            while (*p && *p != ',' && !_is_space (*p))
+                g_string_append_c (value, *p++);
+        }
+
+        name = g_ascii_strdown (name_start, name_end - name_start);
+        if (g_hash_table_lookup (directives, name) == NULL) {
+            g_hash_table_insert (directives, name,
+                                 g_string_free (value, FALSE));
+        } else {
+            g_free (name);
+            g_string_free (value, TRUE);
+        }
+        while (_is_space (*p))
+            p++;
+        if (*p && *p != ',')
+            goto malformed;
+    }
+    return directives;
+
+malformed:
+    g_hash_table_unref (directives);
+    return NULL;
+}
+
+static gboolean
+_list_contains (const gchar *list, const gchar *token)
+{
+    gchar **items = g_strsplit (list, ",", -1);
+    gboolean found = FALSE;
+    guint i;
+
+    for (i = 0; items[i] && !found; i++)
+        found = g_ascii_strcasecmp (g_strstrip (items[i]), token) == 0;
+    g_strfreev (items);
+    return found;
+}
+
+/* Names and passwords are hashed in ISO 8859-1 when every character has a
+ * code point there, as RFC 2831 requires */
+static gchar *
+_hash_charset (const gchar *text)
+{
+    const gchar *p;
+    GString *latin1;
+
+    if (!g_utf8_validate (text, -1, NULL))
+        return g_strdup (text);
+    for (p = text; *p; p = g_utf8_next_char (p)) {
+        if (g_utf8_get_char (p) > 0xff)
+            return g_strdup (text);
+    }
+    latin1 = g_string_sized_new (strlen (text));
+    for (p = text; *p; p = g_utf8_next_char (p))
+        g_string_append_c (latin1, (gchar) g_utf8_get_char (p));
+    return g_string_free (latin1, FALSE);
+}
+
+static void
+_append_quoted (GString *message,
+                const gchar *name,
+                const gchar *value)
+{
+    const gchar *p;
+
+    g_string_append_printf (message, "%s%s=\"", message->len ? "," : "",
+                            name);
+    for (p = value; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            g_string_append_c (message, '\\');
+        g_string_append_c (message, *p);
+    }
+    g_string_append_c (message, '"');
+}
+
+/* KD(HEX(H(A1)), nonce:nc:cnonce:qop:HEX(H(A2))) in hex, for the A2 that
+ * starts with @a2_prefix */
+static gchar *
+_response_value (const gchar *ha1_hex,
+                 const gchar *nonce,
+                 const gchar *cnonce,
+                 GSignondSaslQop qop,
+                 const gchar *a2_prefix,
+                 const gchar *digest_uri)
+{
+    gchar *a2 = g_strconcat (a2_prefix, ":", digest_uri,
+                             qop == GSIGNOND_SASL_QOP_AUTH ? NULL :
+                             ":00000000000000000000000000000000", NULL);
+    gchar *ha2_hex = g_compute_checksum_for_string (G_CHECKSUM_MD5, a2, -1);
+    gchar *kd = g_strjoin (":", ha1_hex, nonce, NONCE_COUNT, cnonce,
+                           qop_tokens[qop], ha2_hex, NULL);
+    gchar *value = g_compute_checksum_for_string (G_CHECKSUM_MD5, kd, -1);
+
+    g_free (a2);
+    g_free (ha2_hex);
+    g_free (kd);
+    return value;
+}
+
+static gboolean
+_secret_hash (const GSignondSaslDigestMd5Credentials *credentials,
+              const gchar *realm,
+              guint8 *secret_hash)
+{
+    GChecksum *checksum;
+    gchar *username;
+    gchar *password;
+    gchar *realm_charset;
+    gsize len = DIGEST_SIZE;
+
+    if (credentials->hashed_password)
+        return gsignond_sasl_kdf_hex_decode (credentials->hashed_password,
+                                             secret_hash, DIGEST_SIZE);
+    if (credentials->password == NULL)
+        return FALSE;
+
+    username = _hash_charset (credentials->username);
+    realm_charset = _hash_charset (realm);
+    password = _hash_charset (credentials->password);
+    checksum = g_checksum_new (G_CHECKSUM_MD5);
+    g_checksum_update (checksum, (const guchar *) username, -1);
+    g_checksum_update (checksum, (const guchar *) ":", 1);
+    g_checksum_update (checksum, (const guchar *) realm_charset, -1);
+    g_checksum_update (checksum, (const guchar *) ":", 1);
+    g_checksum_update (checksum, (const guchar *) password, -1);
+    g_checksum_get_digest (checksum, secret_hash, &len);
+    g_checksum_free (checksum);
+    memset (password, 0, strlen (password));
+    g_free (password);
+    g_free (username);
+    g_free (realm_charset);
+    return TRUE;
+}
+
+/* Returns the digest-response to the server's digest-challenge */
+gchar *
+gsignond_sasl_digest_md5_response (
+                        GSignondSaslDigestMd5 *digest,
+                        const gchar *challenge,
+                        const GSignondSaslDigestMd5Credentials *credentials,
+                        GError **error)
+{
+    GHashTable *directives;
+    const gchar *nonce;
+    const gchar *qop;
+    const gchar *realm;
+    const gchar *algorithm;
+    const gchar *maxbuf;
+    const gchar *cipher = NULL;
+    gchar cnonce_bytes[CNONCE_SIZE];
+    guint8 secret_hash[DIGEST_SIZE];
+    GChecksum *checksum;
+    gchar *cnonce;
+    gchar *digest_uri;
+    gchar *ha1_hex;
+    gchar *value;
+    GString *message;
+
+    g_return_val_if_fail (digest != NULL && credentials != NULL, NULL);
+    g_return_val_if_fail (
+        digest->state == GSIGNOND_SASL_DIGEST_MD5_STATE_INITIAL, NULL);
+
+    if (credentials->username == NULL || credentials->service == NULL ||
+        credentials->hostname == NULL) {
+        _fail (error, "user name, service and host name are needed");
+        return NULL;
+    }
+    directives = challenge ? _parse_directives (challenge) : NULL;
+    if (directives == NULL) {
+        _fail (error, "malformed challenge");
+        return NULL;
+    }
+    nonce = g_hash_table_lookup (directives, "nonce");
+    qop = g_hash_table_lookup (directives, "qop");
+    algorithm = g_hash_table_lookup (directives, "algorithm");
+    if (nonce == NULL || algorithm == NULL ||
+        g_ascii_strcasecmp (algorithm, "md5-sess") != 0) {
+        g_hash_table_unref (directives);
+        _fail (error, "challenge lacks a nonce or the md5-sess algorithm");
+        return NULL;
+    }
+    if (!_list_contains (qop ? qop : "auth",
+                         qop_tokens[credentials->qop])) {
+        g_hash_table_unref (directives);
+        _fail (error, "server doesn't offer the quality of protection");
+        return NULL;
+    }
+    if (credentials->qop == GSIGNOND_SASL_QOP_AUTH_CONF) {
+        const gchar *offered = g_hash_table_lookup (directives, "cipher");
+        guint i;
+
+        for (i = 0; offered && !cipher && i < G_N_ELEMENTS (ciphers); i++) {
+            if (_list_contains (offered, ciphers[i].name)) {
+                cipher = ciphers[i].name;
+                digest->cipher_key_len = ciphers[i].key_len;
+            }
+        }
+        if (cipher == NULL) {
+            g_hash_table_unref (directives);
+            _fail (error, "server offers no RC4 cipher");
+            return NULL;
+        }
+    }
+    maxbuf = g_hash_table_lookup (directives, "maxbuf");
+    digest->maxbuf = maxbuf ? g_ascii_strtoull (maxbuf, NULL, 10)
+                            : DEFAULT_MAXBUF;
+    if (digest->maxbuf <= GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD ||
+        digest->maxbuf > MAX_MAXBUF) {
+        g_hash_table_unref (directives);
+        _fail (error, "invalid maxbuf");
+        return NULL;
+    }
+    realm = credentials->realm;
+    if (realm == NULL)
+        realm = g_hash_table_lookup (directives, "realm");
+    if (!_secret_hash (credentials, realm ? realm : "", secret_hash)) {
+        g_hash_table_unref (directives);
+        _fail (error, "invalid password");
+        return NULL;
+    }
+    if (gsasl_nonce (cnonce_bytes, sizeof (cnonce_bytes)) != GSASL_OK) {
+        g_hash_table_unref (directives);
+        memset (secret_hash, 0, sizeof (secret_hash));
+        _fail (error, "couldn't generate a nonce");
+        return NULL;
+    }
+    cnonce = g_base64_encode ((const guchar *) cnonce_bytes,
+                              sizeof (cnonce_bytes));
+    digest_uri = g_strconcat (credentials->service, "/",
+                              credentials->hostname, NULL);
+
+    checksum = g_checksum_new (G_CHECKSUM_MD5);
+    g_checksum_update (checksum, secret_hash, sizeof (secret_hash));
+    g_checksum_update (checksum, (const guchar *) ":", 1);
+    g_checksum_update (checksum, (const guchar *) nonce, -1);
+    g_checksum_update (checksum, (const guchar *) ":", 1);
+    g_checksum_update (checksum, (const guchar *) cnonce, -1);
+    if (credentials->authzid) {
+        g_checksum_update (checksum, (const guchar *) ":", 1);
+        g_checksum_update (checksum, (const guchar *) credentials->authzid,
+                           -1);
+    }
+    ha1_hex = g_strdup (g_checksum_get_string (checksum));
+    if (credentials->qop != GSIGNOND_SASL_QOP_AUTH) {
+        gsize ha1_len = DIGEST_SIZE;
+
+        g_checksum_get_digest (checksum, digest->ha1, &ha1_len);
+    }
+    g_checksum_free (checksum);
+    memset (secret_hash, 0, sizeof (secret_hash));
+
+    message = g_string_new (NULL);
+    if (g_hash_table_lookup (directives, "charset"))
+        g_string_append (message, "charset=utf-8");
+    _append_quoted (message, "username", credentials->username);
+    if (realm)
+        _append_quoted (message, "realm", realm);
+    _append_quoted (message, "nonce", nonce);
+    _append_quoted (message, "cnonce", cnonce);
+    g_string_append_printf (message, ",nc=" NONCE_COUNT ",qop=%s",
+                            qop_tokens[credentials->qop]);
+    if (cipher)
+        g_string_append_printf (message, ",cipher=%s", cipher);
+    _append_quoted (message, "digest-uri", digest_uri);
+    value = _response_value (ha1_hex, nonce, cnonce, credentials->qop,
+                             "AUTHENTICATE", digest_uri);
+    g_string_append_printf (message, ",response=%s", value);
+    g_free (value);
+    if (credentials->authzid)
+        _append_quoted (message, "authzid", credentials->authzid);
+
+    value = _response_value (ha1_hex, nonce, cnonce, credentials->qop, "",
+                             digest_uri);
+    memcpy (digest->rspauth, value, DIGEST_HEX_SIZE + 1);
+    g_free (value);
+    digest->qop = credentials->qop;
+    digest->state = GSIGNOND_SASL_DIGEST_MD5_STATE_RESPONSE_SENT;
+
+    memset (ha1_hex, 0, strlen (ha1_hex));
+    g_free (ha1_hex);
+    g_free (digest_uri);
+    g_free (cnonce);
+    g_hash_table_unref (directives);
+    return g_string_free (message, FALSE);
+}
+
+/* Checks the response-auth sent by the server once it accepted the
+ * response */
+gboolean
+gsignond_sasl_digest_md5_verify (GSignondSaslDigestMd5 *digest,
+                                 const gchar *server_final,
+                                 GError **error)
+{
+    GHashTable *directives;
+    const gchar *rspauth;
+    guint8 diff = 0;
+    guint i;
+
+    g_return_val_if_fail (digest != NULL, FALSE);
+    g_return_val_if_fail (
+        digest->state == GSIGNOND_SASL_DIGEST_MD5_STATE_RESPONSE_SENT, FALSE);
+
+    directives = server_final ? _parse_directives (server_final) : NULL;
+    rspauth = directives ? g_hash_table_lookup (directives, "rspauth") : NULL;
+    if (rspauth == NULL || strlen (rspauth) != DIGEST_HEX_SIZE) {
+        if (directives)
+            g_hash_table_unref (directives);
+        return _fail (error, "server didn't send its response-auth");
+    }
+    for (i = 0; i < DIGEST_HEX_SIZE; i++)
+        diff |= g_ascii_tolower (rspauth[i]) ^ digest->rspauth[i];
+    g_hash_table_unref (directives);
+    if (diff != 0)
+        return _fail (error, "server response-auth doesn't match");
+    digest->state = GSIGNOND_SASL_DIGEST_MD5_STATE_DONE;
+    return TRUE;
+}
+
+/* The security layer of a verified "auth-int" or "auth-conf" session, NULL
+ * for other sessions; it can only be taken once */
+GSignondSaslSecurityLayer *
+gsignond_sasl_digest_md5_take_security_layer (GSignondSaslDigestMd5 *digest)
+{
+    GSignondSaslSecurityLayer *layer;
+
+    g_return_val_if_fail (digest != NULL, NULL);
+
+    if (digest->state != GSIGNOND_SASL_DIGEST_MD5_STATE_DONE ||
+        digest->qop == GSIGNOND_SASL_QOP_AUTH)
+        return NULL;
+    layer = gsignond_sasl_security_layer_new_digest_md5 (
+        digest->ha1, digest->qop, digest->cipher_key_len, digest->maxbuf,
+        FALSE);
+    memset (digest->ha1, 0, sizeof (digest->ha1));
+    digest->qop = GSIGNOND_SASL_QOP_AUTH;
+    return layer;
+}
+
+/* Only sessions with the "auth" quality of protection can be exported */
+GBytes *
+gsignond_sasl_digest_md5_export (GSignondSaslDigestMd5 *digest)
+{
+    GVariant *state;
+    GBytes *bytes;
+
+    g_return_val_if_fail (digest != NULL, NULL);
+    g_return_val_if_fail (digest->qop == GSIGNOND_SASL_QOP_AUTH, NULL);
+
+    state = g_variant_ref_sink (g_variant_new (
+        STATE_FORMAT, (guchar) GSIGNOND_SASL_DIGEST_MD5_STATE_VERSION,
+        (guchar) digest->state, digest->rspauth));
+    bytes = g_variant_get_data_as_bytes (state);
+    g_variant_unref (state);
+    return bytes;
+}
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_import (GBytes *bytes,
+                                 GError **error)
+{
+    GSignondSaslDigestMd5 *digest = NULL;
+    GVariant *state;
+    guchar version;
+    guchar digest_state;
+    const gchar *rspauth;
+
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    state = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (STATE_FORMAT), bytes, FALSE));
+    if (!g_variant_is_normal_form (state)) {
+        g_variant_unref (state);
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "DIGEST-MD5 session state is malformed");
+        return NULL;
+    }
+    g_variant_get (state, "(yy&s)", &version, &digest_state, &rspauth);
+    if (version != GSIGNOND_SASL_DIGEST_MD5_STATE_VERSION ||
+        digest_state > GSIGNOND_SASL_DIGEST_MD5_STATE_DONE ||
+        strlen (rspauth) != (digest_state ==
+                             GSIGNOND_SASL_DIGEST_MD5_STATE_INITIAL ?
+                             0 : DIGEST_HEX_SIZE)) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Unsupported DIGEST-MD5 session state (version %u)",
+                     version);
+    } else {
+        digest = gsignond_sasl_digest_md5_new ();
+        digest->state = digest_state;
+        memcpy (digest->rspauth, rspauth, strlen (rspauth) + 1);
+    }
+    g_variant_unref (state);
+    return digest;
+}
+
+#else /* WITH_DIGEST_MD5_ENGINE */
+
+/* --with-mechanisms left DIGEST-MD5 out, so the plugin never starts a
+ * session with it */
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_new (void)
+{
+    g_return_val_if_reached (NULL);
+}
+
+void
+gsignond_sasl_digest_md5_free (GSignondSaslDigestMd5 *digest)
+{
+}
+
+GSignondSaslDigestMd5State
+gsignond_sasl_digest_md5_get_state (GSignondSaslDigestMd5 *digest)
+{
+    g_return_val_if_reached (GSIGNOND_SASL_DIGEST_MD5_STATE_DONE);
+}
+
+gchar *
+gsignond_sasl_digest_md5_response (
+                        GSignondSaslDigestMd5 *digest,
+                        const gchar *challenge,
+                        const GSignondSaslDigestMd5Credentials *credentials,
+                        GError **error)
+{
+    g_return_val_if_reached (NULL);
+}
+
+gboolean
+gsignond_sasl_digest_md5_verify (GSignondSaslDigestMd5 *digest,
+                                 const gchar *server_final,
+                                 GError **error)
+{
+    g_return_val_if_reached (FALSE);
+}
+
+GSignondSaslSecurityLayer *
+gsignond_sasl_digest_md5_take_security_layer (GSignondSaslDigestMd5 *digest)
+{
+    g_return_val_if_reached (NULL);
+}
+
+GBytes *
+gsignond_sasl_digest_md5_export (GSignondSaslDigestMd5 *digest)
+{
+    g_return_val_if_reached (NULL);
+}
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_import (GBytes *state,
+                                 GError **error)
+{
+    g_set_error (error, GSIGNOND_ERROR,
+                 GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                 "DIGEST-MD5 was left out of this build");
+    return NULL;
+}
+
+#endif /* WITH_DIGEST_MD5_ENGINE */
@@ -0,0 +1,92 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_DIGEST_MD5_H__
+#define __GSIGNOND_SASL_DIGEST_MD5_H__
+
+#include <glib.h>
+
+#include "gsignond-sasl-security-layer.h"
+
+G_BEGIN_DECLS
+
+/* version of the format written by gsignond_sasl_digest_md5_export() */
+#define GSIGNOND_SASL_DIGEST_MD5_STATE_VERSION 1
+
+typedef enum {
+    GSIGNOND_SASL_DIGEST_MD5_STATE_INITIAL = 0,
+    GSIGNOND_SASL_DIGEST_MD5_STATE_RESPONSE_SENT,
+    GSIGNOND_SASL_DIGEST_MD5_STATE_DONE
+} GSignondSaslDigestMd5State;
+
+typedef struct {
+    const gchar *username;
+    const gchar *authzid;
+    const gchar *password;
+    /* hex encoded MD5 of "username:realm:password", used instead of
+     * @password if set */
+    const gchar *hashed_password;
+    const gchar *realm;
+    const gchar *service;
+    const gchar *hostname;
+    GSignondSaslQop qop;
+} GSignondSaslDigestMd5Credentials;
+
+typedef struct _GSignondSaslDigestMd5 GSignondSaslDigestMd5;
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_new (void);
+
+void
+gsignond_sasl_digest_md5_free (GSignondSaslDigestMd5 *digest);
+
+GSignondSaslDigestMd5State
+gsignond_sasl_digest_md5_get_state (GSignondSaslDigestMd5 *digest);
+
+gchar *
+gsignond_sasl_digest_md5_response (
+                        GSignondSaslDigestMd5 *digest,
+                        const gchar *challenge,
+                        const GSignondSaslDigestMd5Credentials *credentials,
+                        GError **error);
+
+gboolean
+gsignond_sasl_digest_md5_verify (GSignondSaslDigestMd5 *digest,
+                                 const gchar *server_final,
+                                 GError **error);
+
+GSignondSaslSecurityLayer *
+gsignond_sasl_digest_md5_take_security_layer (GSignondSaslDigestMd5 *digest);
+
+GBytes *
+gsignond_sasl_digest_md5_export (GSignondSaslDigestMd5 *digest);
+
+GSignondSaslDigestMd5 *
+gsignond_sasl_digest_md5_import (GBytes *state,
+                                 GError **error);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_DIGEST_MD5_H__ */
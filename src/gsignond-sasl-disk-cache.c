@@ -0,0 +1,627 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Derived keys kept on disk across restarts.
+ *
+ * When SSO_SASL_KEY_CACHE_FILE names a file and SSO_SASL_KEY_CACHE_FILE_KEY
+ * holds its key (64 hex digits), keys that are neither in the process nor
+ * in the shared cache are looked up in that file before being derived.
+ *
+ * The file is a 64 byte header followed by fixed size records, laid out as
+ * an open addressing table: a record lives in one of the MAX_PROBES slots
+ * following the one its id hashes to, so a lookup reads a handful of
+ * records straight from the mapping and opening the file costs the same
+ * whatever its size. The header carries a truncated SHA-256 checksum of
+ * itself and a check value of the key, and a file that fails either check
+ * is replaced. Each record holds the id of the entry in clear, and the
+ * password fingerprint and key encrypted with the keystream of
+ * gsignond_sasl_seal_apply_keystream() under a nonce of its own, followed
+ * by an HMAC-SHA256 tag over the rest of the record.
+ *
+ * The file is mapped privately, so new records only change this process'
+ * copy. A few seconds after a change, or on gsignond_sasl_disk_cache_flush(),
+ * the copy is written to a temporary file that is renamed over the cache
+ * file; records written by other processes in the meantime are merged in
+ * first, the newest record of each slot winning. The write works on a
+ * snapshot of the copy, so lookups and new records don't wait for the disk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gsasl.h>
+#include <glib/gstdio.h>
+
+#include "gsignond-sasl-disk-cache.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-log.h"
+#include "gsignond-sasl-seal.h"
+#include "gsignond-sasl-shared-cache.h"
+
+#define MAGIC 0x474b4346 /* "GKCF" */
+/* 2: keyed password fingerprints */
+#define FILE_VERSION 2
+#define DEFAULT_SLOTS 1024
+#define MAX_SLOTS (1 << 20)
+#define MAX_PROBES 8
+#define CHECK_SIZE 16
+#define TAG_SIZE 32
+#define SECRET_SIZE (GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE + \
+                     GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE)
+/* seconds between a change and writing the file */
+#define FLUSH_DELAY 5
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 n_slots;
+    guint32 record_size;
+    guint8 key_check[CHECK_SIZE];
+    guint8 checksum[CHECK_SIZE];
+    guint8 reserved[16];
+} GSignondSaslDiskHeader;
+
+typedef struct {
+    guint8 id[GSIGNOND_SASL_SHARED_CACHE_ID_SIZE];
+    guint8 nonce[GSIGNOND_SASL_SEAL_NONCE_SIZE];
+    /* when the record was written, in seconds; 0 for an empty slot */
+    guint32 stamp;
+    guint32 key_len;
+    /* fingerprint followed by the key, encrypted */
+    guint8 secret[SECRET_SIZE];
+    guint8 reserved[8];
+    guint8 tag[TAG_SIZE];
+} GSignondSaslDiskRecord;
+
+G_STATIC_ASSERT (sizeof (GSignondSaslDiskHeader) == 64);
+G_STATIC_ASSERT (sizeof (GSignondSaslDiskRecord) == 160);
+
+static GMutex disk_lock;
+static GMutex flush_lock;
+static gboolean disk_initialized = FALSE;
+static gchar *cache_path = NULL;
+static GSignondSaslDiskHeader *header = NULL;
+static GSignondSaslDiskRecord *records = NULL;
+static gsize mapping_size = 0;
+static guint8 enc_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+static guint8 mac_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+static gboolean dirty = FALSE;
+static guint flush_source = 0;
+static guint generation = 0;
+
+static guint64 n_hits = 0;
+static guint64 n_misses = 0;
+
+static gsize
+_file_size (guint n_slots)
+{
+    return sizeof (GSignondSaslDiskHeader) +
+        (gsize) n_slots * sizeof (GSignondSaslDiskRecord);
+}
+
+static void
+_header_checksum (const GSignondSaslDiskHeader *file_header,
+                  guint8 *checksum)
+{
+    GSignondSaslDiskHeader copy = *file_header;
+    guint8 digest[32];
+    gsize len = sizeof (digest);
+    GChecksum *sha256 = g_checksum_new (G_CHECKSUM_SHA256);
+
+    memset (copy.checksum, 0, sizeof (copy.checksum));
+    g_checksum_update (sha256, (const guchar *) &copy, sizeof (copy));
+    g_checksum_get_digest (sha256, digest, &len);
+    g_checksum_free (sha256);
+    memcpy (checksum, digest, CHECK_SIZE);
+}
+
+static void
+_key_check (guint8 *check)
+{
+    guint8 digest[32];
+
+    gsignond_sasl_seal_derive_key (mac_key, "gsignond-sasl key file check",
+                                   digest);
+    memcpy (check, digest, CHECK_SIZE);
+}
+
+/* TRUE if @file_header describes a file of @size bytes written with the
+ * current key */
+static gboolean
+_header_valid (const GSignondSaslDiskHeader *file_header,
+               gsize size)
+{
+    guint8 expected[CHECK_SIZE];
+
+    if (size < sizeof (GSignondSaslDiskHeader) ||
+        file_header->magic != MAGIC ||
+        file_header->version != FILE_VERSION ||
+        file_header->record_size != sizeof (GSignondSaslDiskRecord) ||
+        file_header->n_slots == 0 || file_header->n_slots > MAX_SLOTS ||
+        size != _file_size (file_header->n_slots))
+        return FALSE;
+    _header_checksum (file_header, expected);
+    if (memcmp (expected, file_header->checksum, CHECK_SIZE) != 0)
+        return FALSE;
+    _key_check (expected);
+    return memcmp (expected, file_header->key_check, CHECK_SIZE) == 0;
+}
+
+static void
+_unmap_locked (void)
+{
+    if (flush_source)
+        g_source_remove (flush_source);
+    flush_source = 0;
+    if (header)
+        munmap (header, mapping_size);
+    header = NULL;
+    records = NULL;
+    mapping_size = 0;
+    dirty = FALSE;
+    generation++;
+}
+
+/* Maps @path, or an empty table of @n_slots if it can't be used */
+static void
+_map_locked (const gchar *path,
+             guint n_slots)
+{
+    struct stat st;
+    gpointer mapping = MAP_FAILED;
+    int fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat (fd, &st) == 0 &&
+        st.st_size >= (off_t) sizeof (GSignondSaslDiskHeader)) {
+        mapping = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED && !_header_valid (mapping, st.st_size)) {
+            GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                               "Key cache file %s is damaged or was written "
+                               "with another key, replacing it", path);
+            munmap (mapping, st.st_size);
+            mapping = MAP_FAILED;
+        }
+        if (mapping != MAP_FAILED)
+            mapping_size = st.st_size;
+    }
+    if (fd >= 0)
+        close (fd);
+
+    if (mapping == MAP_FAILED) {
+        mapping_size = _file_size (n_slots);
+        mapping = mmap (NULL, mapping_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            mapping_size = 0;
+            return;
+        }
+        header = mapping;
+        header->magic = MAGIC;
+        header->version = FILE_VERSION;
+        header->n_slots = n_slots;
+        header->record_size = sizeof (GSignondSaslDiskRecord);
+        _key_check (header->key_check);
+        _header_checksum (header, header->checksum);
+    }
+    header = mapping;
+    records = (GSignondSaslDiskRecord *) (header + 1);
+}
+
+static void
+_open_locked (const gchar *path,
+              const guint8 *master_key,
+              guint n_slots)
+{
+    _unmap_locked ();
+    g_free (cache_path);
+    cache_path = g_strdup (path);
+    gsignond_sasl_seal_derive_key (master_key,
+                                   "gsignond-sasl key file encryption",
+                                   enc_key);
+    gsignond_sasl_seal_derive_key (master_key,
+                                   "gsignond-sasl key file authentication",
+                                   mac_key);
+    _map_locked (path, MIN (MAX (n_slots, 1), MAX_SLOTS));
+}
+
+static void
+_init_locked (void)
+{
+    const gchar *path;
+    const gchar *hex_key;
+    const gchar *slots;
+    guint8 master_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+
+    if (disk_initialized)
+        return;
+    disk_initialized = TRUE;
+    path = g_getenv ("SSO_SASL_KEY_CACHE_FILE");
+    if (path == NULL)
+        return;
+    hex_key = g_getenv ("SSO_SASL_KEY_CACHE_FILE_KEY");
+    if (hex_key == NULL ||
+        !gsignond_sasl_kdf_hex_decode (hex_key, master_key,
+                                       sizeof (master_key))) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                           "SSO_SASL_KEY_CACHE_FILE_KEY is not 64 hex "
+                           "digits, not using %s", path);
+        return;
+    }
+    slots = g_getenv ("SSO_SASL_KEY_CACHE_FILE_SLOTS");
+    _open_locked (path, master_key,
+                  slots ? (guint) MIN (g_ascii_strtoull (slots, NULL, 10),
+                                       MAX_SLOTS)
+                        : DEFAULT_SLOTS);
+    memset (master_key, 0, sizeof (master_key));
+}
+
+/* Uses the file at @path, with @n_slots records if it has to be created */
+gboolean
+gsignond_sasl_disk_cache_open (const gchar *path,
+                               const guint8 *master_key,
+                               guint n_slots)
+{
+    gboolean opened;
+
+    g_return_val_if_fail (path != NULL && master_key != NULL, FALSE);
+
+    g_mutex_lock (&disk_lock);
+    disk_initialized = TRUE;
+    _open_locked (path, master_key, n_slots);
+    opened = header != NULL;
+    g_mutex_unlock (&disk_lock);
+    return opened;
+}
+
+/* Stops using the file; changes that weren't flushed are lost */
+void
+gsignond_sasl_disk_cache_close (void)
+{
+    g_mutex_lock (&disk_lock);
+    _unmap_locked ();
+    g_free (cache_path);
+    cache_path = NULL;
+    memset (enc_key, 0, sizeof (enc_key));
+    memset (mac_key, 0, sizeof (mac_key));
+    g_mutex_unlock (&disk_lock);
+}
+
+static guint
+_home_slot (const guint8 *id)
+{
+    guint32 hash;
+
+    memcpy (&hash, id, sizeof (hash));
+    return hash % header->n_slots;
+}
+
+static void
+_record_tag (const GSignondSaslDiskRecord *record,
+             guint8 *tag)
+{
+    GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, mac_key, sizeof (mac_key));
+    gsize len = TAG_SIZE;
+
+    g_hmac_update (hmac, (const guchar *) record,
+                   G_STRUCT_OFFSET (GSignondSaslDiskRecord, tag));
+    g_hmac_get_digest (hmac, tag, &len);
+    g_hmac_unref (hmac);
+}
+
+gboolean
+gsignond_sasl_disk_cache_lookup (const guint8 *id,
+                                 const guint8 *fingerprint,
+                                 guint8 *key,
+                                 gsize key_len)
+{
+    const GSignondSaslDiskRecord *newest = NULL;
+    GSignondSaslDiskRecord record;
+    guint8 tag[TAG_SIZE];
+    gboolean found = FALSE;
+    guint home;
+    guint probe;
+
+    g_mutex_lock (&disk_lock);
+    _init_locked ();
+    if (header == NULL) {
+        g_mutex_unlock (&disk_lock);
+        return FALSE;
+    }
+    /* merging the records of other processes can leave an older record
+     * of the same entry earlier in the probe sequence */
+    home = _home_slot (id);
+    for (probe = 0; probe < MIN (MAX_PROBES, header->n_slots); probe++) {
+        const GSignondSaslDiskRecord *candidate =
+            &records[(home + probe) % header->n_slots];
+
+        if (candidate->stamp == 0)
+            break;
+        if (memcmp (candidate->id, id, sizeof (candidate->id)) != 0 ||
+            candidate->key_len != key_len ||
+            (newest && candidate->stamp <= newest->stamp))
+            continue;
+        _record_tag (candidate, tag);
+        if (memcmp (tag, candidate->tag, TAG_SIZE) == 0)
+            newest = candidate;
+    }
+    if (newest) {
+        record = *newest;
+        gsignond_sasl_seal_apply_keystream (enc_key, record.nonce,
+                                            record.secret, SECRET_SIZE);
+        if (memcmp (record.secret, fingerprint,
+                    GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE) == 0) {
+            memcpy (key, record.secret +
+                    GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE, key_len);
+            found = TRUE;
+        }
+    }
+    if (found)
+        n_hits++;
+    else
+        n_misses++;
+    g_mutex_unlock (&disk_lock);
+    memset (&record, 0, sizeof (record));
+    return found;
+}
+
+static gboolean
+_flush_on_timeout (gpointer user_data)
+{
+    GError *error = NULL;
+
+    g_mutex_lock (&disk_lock);
+    flush_source = 0;
+    g_mutex_unlock (&disk_lock);
+    if (!gsignond_sasl_disk_cache_flush (&error)) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                           "Couldn't write key cache file: %s",
+                           error->message);
+        g_error_free (error);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void
+gsignond_sasl_disk_cache_insert (const guint8 *id,
+                                 const guint8 *fingerprint,
+                                 const guint8 *key,
+                                 gsize key_len)
+{
+    GSignondSaslDiskRecord *victim = NULL;
+    guint32 oldest = G_MAXUINT32;
+    guint home;
+    guint probe;
+
+    g_return_if_fail (key_len <= GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE);
+
+    g_mutex_lock (&disk_lock);
+    _init_locked ();
+    if (header == NULL) {
+        g_mutex_unlock (&disk_lock);
+        return;
+    }
+    home = _home_slot (id);
+    for (probe = 0; probe < MIN (MAX_PROBES, header->n_slots); probe++) {
+        GSignondSaslDiskRecord *record = &records[(home + probe) %
+                                                  header->n_slots];
+
+        if (record->stamp == 0 ||
+            memcmp (record->id, id, sizeof (record->id)) == 0) {
+            victim = record;
+            break;
+        }
+        if (record->stamp < oldest) {
+            victim = record;
+            oldest = record->stamp;
+        }
+    }
+
+    memset (victim, 0, sizeof (*victim));
+    memcpy (victim->id, id, sizeof (victim->id));
+    gsasl_nonce ((char *) victim->nonce, sizeof (victim->nonce));
+    victim->stamp = MAX ((guint32) time (NULL), 1);
+    victim->key_len = key_len;
+    memcpy (victim->secret, fingerprint,
+            GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE);
+    memcpy (victim->secret + GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE,
+            key, key_len);
+    gsignond_sasl_seal_apply_keystream (enc_key, victim->nonce,
+                                        victim->secret, SECRET_SIZE);
+    _record_tag (victim, victim->tag);
+
+    dirty = TRUE;
+    if (flush_source == 0)
+        flush_source = g_timeout_add_seconds_full (G_PRIORITY_LOW,
+                                                   FLUSH_DELAY,
+                                                   _flush_on_timeout,
+                                                   NULL, NULL);
+    g_mutex_unlock (&disk_lock);
+}
+
+/* Takes the records of the file on disk that are newer than ours */
+static void
+_merge_locked (void)
+{
+    GSignondSaslDiskRecord *theirs;
+    GSignondSaslDiskHeader *mapping;
+    struct stat st;
+    guint i;
+    int fd;
+
+    fd = open (cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fstat (fd, &st) == 0 && (gsize) st.st_size == mapping_size) {
+        mapping = mmap (NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED) {
+            if (_header_valid (mapping, mapping_size) &&
+                mapping->n_slots == header->n_slots) {
+                theirs = (GSignondSaslDiskRecord *) (mapping + 1);
+                for (i = 0; i < header->n_slots; i++) {
+                    if (theirs[i].stamp > records[i].stamp)
+                        records[i] = theirs[i];
+                }
+            }
+            munmap (mapping, mapping_size);
+        }
+    }
+    close (fd);
+}
+
+/* Makes the rename of the cache file durable; returns an errno value */
+static int
+_sync_directory (const gchar *path)
+{
+    gchar *dir = g_path_get_dirname (path);
+    int saved_errno = 0;
+    int fd;
+
+    fd = open (dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync (fd) < 0)
+        saved_errno = errno;
+    if (fd >= 0)
+        close (fd);
+    g_free (dir);
+    return saved_errno;
+}
+
+/* Writes the records to the file, replacing it atomically */
+gboolean
+gsignond_sasl_disk_cache_flush (GError **error)
+{
+    guint8 *snapshot;
+    gchar *path;
+    gchar *temp_path;
+    gboolean created = FALSE;
+    gsize size;
+    gsize written = 0;
+    guint snapshot_generation;
+    int saved_errno = 0;
+    int fd;
+
+    /* keeps the renames in the order of the snapshots */
+    g_mutex_lock (&flush_lock);
+    g_mutex_lock (&disk_lock);
+    if (header == NULL || !dirty) {
+        g_mutex_unlock (&disk_lock);
+        g_mutex_unlock (&flush_lock);
+        return TRUE;
+    }
+    _merge_locked ();
+    size = mapping_size;
+    snapshot = g_malloc (size);
+    memcpy (snapshot, header, size);
+    path = g_strdup (cache_path);
+    snapshot_generation = generation;
+    /* records added from now on are in the next snapshot */
+    dirty = FALSE;
+    g_mutex_unlock (&disk_lock);
+
+    temp_path = g_strconcat (path, ".XXXXXX", NULL);
+    fd = g_mkstemp_full (temp_path, O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        saved_errno = errno;
+        goto failed;
+    }
+    created = TRUE;
+    while (written < size) {
+        gssize res = write (fd, snapshot + written, size - written);
+
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            saved_errno = res < 0 ? errno : EIO;
+            goto failed;
+        }
+        written += res;
+    }
+    if (fsync (fd) < 0) {
+        saved_errno = errno;
+        goto failed;
+    }
+    if (close (fd) < 0) {
+        saved_errno = errno;
+        fd = -1;
+        goto failed;
+    }
+    fd = -1;
+    if (g_rename (temp_path, path) < 0) {
+        saved_errno = errno;
+        goto failed;
+    }
+    created = FALSE;
+    /* the records are in place, but the new name may not be on disk yet:
+     * they are written again on the next flush if it isn't */
+    saved_errno = _sync_directory (path);
+    if (saved_errno != 0)
+        goto failed;
+    g_mutex_unlock (&flush_lock);
+    g_free (snapshot);
+    g_free (path);
+    g_free (temp_path);
+    return TRUE;
+
+failed:
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Couldn't write %s: %s", path, g_strerror (saved_errno));
+    if (fd >= 0)
+        close (fd);
+    if (created)
+        g_unlink (temp_path);
+    g_mutex_lock (&disk_lock);
+    /* unless the file was closed or replaced in the meantime */
+    if (generation == snapshot_generation)
+        dirty = TRUE;
+    g_mutex_unlock (&disk_lock);
+    g_mutex_unlock (&flush_lock);
+    g_free (snapshot);
+    g_free (path);
+    g_free (temp_path);
+    return FALSE;
+}
+
+void
+gsignond_sasl_disk_cache_add_statistics (GVariantBuilder *builder)
+{
+    g_mutex_lock (&disk_lock);
+    _init_locked ();
+    g_variant_builder_add (builder, "{sv}", "DiskKeyCacheSlots",
+                           g_variant_new_uint32 (header ? header->n_slots
+                                                        : 0));
+    g_variant_builder_add (builder, "{sv}", "DiskKeyCacheHits",
+                           g_variant_new_uint64 (n_hits));
+    g_variant_builder_add (builder, "{sv}", "DiskKeyCacheMisses",
+                           g_variant_new_uint64 (n_misses));
+    g_mutex_unlock (&disk_lock);
+}
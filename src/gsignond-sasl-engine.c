@@ -0,0 +1,1950 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * The SASL client behind #GSignondSaslPlugin, as a plain C object.
+ *
+ * An engine holds one authorization sequence at a time, whatever runs it:
+ * libgsasl or the plugin's own SCRAM and DIGEST-MD5 clients. Every entry
+ * point takes step_lock and writes its outcome into a
+ * #GSignondSaslEngineResult of the caller, so a daemon that links the
+ * library can drive a sequence with plain function calls. The plugin
+ * object turns those results into #GSignondPlugin signals, and provides the
+ * idle timer, which needs a GObject to point to.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gsignond/gsignond-error.h>
+#include <gsignond/gsignond-utils.h>
+
+#include "gsignond-sasl-engine.h"
+#include "gsignond-sasl-admission.h"
+#include "gsignond-sasl-digest-md5.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-log.h"
+#include "gsignond-sasl-outcomes.h"
+#include "gsignond-sasl-probes.h"
+#include "gsignond-sasl-scram.h"
+#include "gsignond-sasl-seal.h"
+#include "gsignond-sasl-speculation.h"
+#include "gsignond-sasl-stats.h"
+
+struct _GSignondSaslEngine
+{
+    Gsasl *gsasl_context;
+    Gsasl_session *gsasl_session;
+    GSignondSaslScram *scram;
+    GSignondSaslDigestMd5 *digest_md5;
+    GSignondDictionary* session_data;
+    GSignondSaslMechanism mechanism;
+    guint session_id;
+    guint step_index;
+    gboolean report_timing;
+    gboolean initial_response;
+    guint kdf_iterations;
+    gboolean refreshing;
+    gint64 session_steps_us;
+    /* SCRAM salted password of the session, and what it was derived for */
+    guint8 salted_password[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize salted_password_len;
+    gchar *salted_password_salt;
+    guint salted_password_iterations;
+    /* what is kept of the last successful authorization for refresh: never
+     * the secret, only the key derived from it */
+    gchar *refresh_mechanism;
+    gchar *refresh_username;
+    gchar *refresh_authzid;
+    guint8 refresh_key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize refresh_key_len;
+    gchar *refresh_salt;
+    guint refresh_iterations;
+    gint64 refresh_steps_us;
+    gboolean user_input_allowed;
+    Gsasl_property pending_property;
+    gchar *pending_challenge;
+    GSignondSaslSpeculation *speculation;
+    gchar *scram_salt;
+    guint scram_iterations;
+    GSignondDictionary *store_data;
+    gint64 session_started;
+    /* outcome of the last session, for mechanisms that don't verify the
+     * server and so can't tell if it accepted the client */
+    gboolean verdict_pending;
+    GSignondSaslMechanism verdict_mechanism;
+    gchar *verdict_hostname;
+    gchar *verdict_realm;
+    gchar *verdict_service;
+    gint64 verdict_duration_us;
+    GMutex step_lock;
+    volatile gint cancel_requested;
+    GError *step_error;
+    /* owned by whoever expires idle sessions, may be NULL */
+    GSignondSaslTimerWheelEntry *idle_timer;
+    guint idle_timeout;
+    guint session_idle_timeout;
+    gsize session_bytes;
+    GSignondSaslSecurityLayer *security_layer;
+};
+
+static volatile gint live_sessions = 0;
+static GMutex expiry_stats_lock;
+static guint64 expired_sessions = 0;
+static guint64 reclaimed_bytes = 0;
+static volatile gint next_session_id = 1;
+
+/* A session runs either in libgsasl or in one of the plugin's own clients:
+ * SCRAM, and DIGEST-MD5 when it sets up a security layer */
+static gboolean
+_session_active (GSignondSaslEngine *self)
+{
+    return self->gsasl_session != NULL || self->scram != NULL ||
+        self->digest_md5 != NULL;
+}
+
+static const gchar *
+_session_mechanism_name (GSignondSaslEngine *self)
+{
+    if (self->scram)
+        return gsignond_sasl_scram_get_mechanism (self->scram);
+    if (self->digest_md5)
+        return "DIGEST-MD5";
+    return gsasl_mechanism_name (self->gsasl_session);
+}
+
+static void _reset_session(GSignondSaslEngine *self)
+{
+    if (self->idle_timer)
+        gsignond_sasl_timer_wheel_disarm (self->idle_timer);
+    if (_session_active (self)) {
+        GSIGNOND_SASL_PROBE2 (session__reset, self->session_id,
+                              self->mechanism);
+        g_atomic_int_add (&live_sessions, -1);
+    }
+    self->session_bytes = 0;
+
+    if (self->session_data) {
+        gsignond_dictionary_unref(self->session_data);
+        self->session_data = NULL;
+    }
+    if (self->gsasl_session) {
+        gsasl_finish(self->gsasl_session);
+        self->gsasl_session = NULL;
+    }
+    gsignond_sasl_scram_free (self->scram);
+    self->scram = NULL;
+    gsignond_sasl_digest_md5_free (self->digest_md5);
+    self->digest_md5 = NULL;
+    g_clear_error (&self->step_error);
+    self->pending_property = 0;
+    g_free (self->pending_challenge);
+    self->pending_challenge = NULL;
+    gsignond_sasl_speculation_abandon (self->speculation);
+    self->speculation = NULL;
+    g_free (self->scram_salt);
+    self->scram_salt = NULL;
+    self->scram_iterations = 0;
+    memset (self->salted_password, 0, sizeof (self->salted_password));
+    self->salted_password_len = 0;
+    g_free (self->salted_password_salt);
+    self->salted_password_salt = NULL;
+    self->salted_password_iterations = 0;
+}
+
+/* Forgets the last successful authorization, so that it can't be
+ * refreshed anymore */
+static void
+_clear_refresh (GSignondSaslEngine *self)
+{
+    g_free (self->refresh_mechanism);
+    self->refresh_mechanism = NULL;
+    g_free (self->refresh_username);
+    self->refresh_username = NULL;
+    g_free (self->refresh_authzid);
+    self->refresh_authzid = NULL;
+    memset (self->refresh_key, 0, sizeof (self->refresh_key));
+    self->refresh_key_len = 0;
+    g_free (self->refresh_salt);
+    self->refresh_salt = NULL;
+    self->refresh_iterations = 0;
+}
+
+/* Keeps the salted password of a finished SCRAM session for refresh */
+static void
+_keep_refresh (GSignondSaslEngine *self)
+{
+    _clear_refresh (self);
+    if (self->salted_password_len == 0)
+        return;
+    self->refresh_mechanism = g_strdup (_session_mechanism_name (self));
+    self->refresh_username = g_strdup (
+        gsignond_session_data_get_username (self->session_data));
+    self->refresh_authzid = g_strdup (
+        gsignond_dictionary_get_string (self->session_data, "Authzid"));
+    memcpy (self->refresh_key, self->salted_password,
+            self->salted_password_len);
+    self->refresh_key_len = self->salted_password_len;
+    self->refresh_salt = g_strdup (self->salted_password_salt);
+    self->refresh_iterations = self->salted_password_iterations;
+    self->refresh_steps_us = self->session_steps_us;
+}
+
+/* Approximates the memory held by a session: the session data it references
+ * (which includes the secrets) and the libgsasl session state */
+static gsize
+_session_size (GSignondSessionData *session_data)
+{
+    GVariant *variant = gsignond_dictionary_to_variant (session_data);
+    gsize size;
+
+    g_variant_take_ref (variant);
+    size = g_variant_get_size (variant);
+    g_variant_unref (variant);
+    return size + 1024;
+}
+
+static gint64
+_thread_cpu_time (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void
+_record_outcome (GSignondSaslEngine *self, gboolean succeeded, gint64 now)
+{
+    GSignondSessionData *session_data = self->session_data;
+
+    gsignond_sasl_outcomes_record (
+        gsignond_dictionary_get_string (session_data, "Hostname"),
+        gsignond_dictionary_get_string (session_data, "Realm"),
+        gsignond_dictionary_get_string (session_data, "Service"),
+        self->mechanism, succeeded, now - self->session_started);
+}
+
+static void
+_clear_verdict (GSignondSaslEngine *self)
+{
+    self->verdict_pending = FALSE;
+    g_free (self->verdict_hostname);
+    self->verdict_hostname = NULL;
+    g_free (self->verdict_realm);
+    self->verdict_realm = NULL;
+    g_free (self->verdict_service);
+    self->verdict_service = NULL;
+}
+
+/* A finished exchange is a success only if the client verified the server;
+ * otherwise the server's answer decides, which the caller reports with
+ * gsignond_sasl_engine_report_verdict() */
+static void
+_record_final_outcome (GSignondSaslEngine *self, gint64 now)
+{
+    GSignondSessionData *session_data = self->session_data;
+
+    if (gsignond_sasl_mechanism_verifies_server (self->mechanism)) {
+        _record_outcome (self, TRUE, now);
+        return;
+    }
+    _clear_verdict (self);
+    self->verdict_pending = TRUE;
+    self->verdict_mechanism = self->mechanism;
+    self->verdict_hostname =
+        g_strdup (gsignond_dictionary_get_string (session_data, "Hostname"));
+    self->verdict_realm =
+        g_strdup (gsignond_dictionary_get_string (session_data, "Realm"));
+    self->verdict_service =
+        g_strdup (gsignond_dictionary_get_string (session_data, "Service"));
+    self->verdict_duration_us = now - self->session_started;
+}
+
+/* Produces the SCRAM salted password for the salt and iteration count sent
+ * by the server: from "ScramSaltedPassword" if given, from a derivation
+ * started earlier or from the key cache if possible, and otherwise by
+ * running PBKDF2, which is done here rather than in libgsasl so that a
+ * canceled session doesn't keep running it until the end */
+static gboolean
+_derive_salted_password (GSignondSaslEngine *self,
+                         GChecksumType checksum_type,
+                         const gchar *salt_base64,
+                         guint iterations,
+                         guint8 *derived,
+                         gsize derived_len)
+{
+    const gchar *salted_password;
+    const gchar *secret;
+    const gchar *username;
+    char *prepped_secret = NULL;
+    guchar *salt;
+    gsize salt_len;
+    gboolean completed;
+
+    if (self->refreshing) {
+        /* a refresh has no secret to derive another key from */
+        if (self->refresh_key_len != derived_len ||
+            g_strcmp0 (salt_base64, self->refresh_salt) != 0 ||
+            iterations != self->refresh_iterations) {
+            g_set_error (&self->step_error, GSIGNOND_ERROR,
+                         GSIGNOND_ERROR_NOT_AUTHORIZED,
+                         "The server changed the SCRAM salt or iteration "
+                         "count since the authorization being refreshed");
+            return FALSE;
+        }
+        memcpy (derived, self->refresh_key, derived_len);
+        return TRUE;
+    }
+    salted_password = gsignond_dictionary_get_string (self->session_data,
+                                                      "ScramSaltedPassword");
+    if (salted_password)
+        return gsignond_sasl_kdf_hex_decode (salted_password, derived,
+                                             derived_len);
+
+    secret = gsignond_session_data_get_secret (self->session_data);
+    if (secret == NULL) {
+        if (self->user_input_allowed)
+            self->pending_property = GSASL_PASSWORD;
+        return FALSE;
+    }
+    if (gsasl_saslprep (secret, GSASL_ALLOW_UNASSIGNED,
+                        &prepped_secret, NULL) != GSASL_OK)
+        return FALSE;
+
+    /* kept so that the next session can start deriving the key early */
+    g_free (self->scram_salt);
+    self->scram_salt = g_strdup (salt_base64);
+    self->scram_iterations = iterations;
+
+    username = gsignond_session_data_get_username (self->session_data);
+    if (username == NULL)
+        username = "";
+    salt = g_base64_decode (salt_base64, &salt_len);
+    completed = FALSE;
+    if (self->speculation &&
+        gsignond_sasl_speculation_matches (self->speculation, salt, salt_len,
+                                           iterations))
+        completed = gsignond_sasl_speculation_wait (self->speculation,
+                                                    &self->cancel_requested,
+                                                    derived, derived_len);
+    gsignond_sasl_speculation_abandon (self->speculation);
+    self->speculation = NULL;
+    if (!completed)
+        completed = gsignond_sasl_key_cache_lookup (checksum_type, username,
+                                                    prepped_secret, salt,
+                                                    salt_len, iterations,
+                                                    derived, derived_len);
+
+    /* the derivation is the CPU-heavy part of SCRAM, so the number of
+     * those running at once is limited */
+    if (!completed) {
+        if (!gsignond_sasl_admission_acquire (&self->cancel_requested,
+                                              &self->step_error)) {
+            memset (prepped_secret, 0, strlen (prepped_secret));
+            free (prepped_secret);
+            g_free (salt);
+            return FALSE;
+        }
+        completed = gsignond_sasl_pbkdf2 (checksum_type,
+                                          (const guchar *) prepped_secret,
+                                          strlen (prepped_secret),
+                                          salt, salt_len, iterations,
+                                          derived, &self->cancel_requested);
+        gsignond_sasl_admission_release ();
+        if (completed) {
+            gsignond_sasl_key_cache_insert (checksum_type, username,
+                                            prepped_secret, salt, salt_len,
+                                            iterations, derived, derived_len);
+            self->kdf_iterations = iterations;
+        }
+    }
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    free (prepped_secret);
+    g_free (salt);
+
+    if (!completed)
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG,
+                           "SCRAM key derivation canceled");
+    return completed;
+}
+
+/* One step of the plugin's own SCRAM client; returns libgsasl codes so
+ * that the result is handled like that of gsasl_step64() */
+static int
+_scram_step (GSignondSaslEngine *self,
+             const gchar *challenge,
+             char **output)
+{
+    GSignondSaslScram *scram = self->scram;
+    GChecksumType checksum_type = gsignond_sasl_scram_get_checksum_type (scram);
+    GError *error = NULL;
+    gchar *input = NULL;
+    gchar *message = NULL;
+    int res = GSASL_NEEDS_MORE;
+
+    if (challenge && *challenge) {
+        guchar *decoded;
+        gsize decoded_len;
+
+        decoded = g_base64_decode (challenge, &decoded_len);
+        input = g_strndup ((const gchar *) decoded, decoded_len);
+        g_free (decoded);
+    }
+
+    switch (gsignond_sasl_scram_get_state (scram)) {
+        case GSIGNOND_SASL_SCRAM_STATE_INITIAL:
+            message = gsignond_sasl_scram_client_first (scram);
+            break;
+        case GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT: {
+            guint8 derived[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+            gsize derived_len = g_checksum_type_get_length (checksum_type);
+            gchar *salt_base64 = NULL;
+            guint iterations = 0;
+
+            if (!gsignond_sasl_scram_parse_server_first (scram, input,
+                                                         &salt_base64,
+                                                         &iterations,
+                                                         &error)) {
+                res = GSASL_MECHANISM_PARSE_ERROR;
+                break;
+            }
+            if (!_derive_salted_password (self, checksum_type, salt_base64,
+                                          iterations, derived,
+                                          derived_len)) {
+                g_free (salt_base64);
+                res = GSASL_NO_PASSWORD;
+                break;
+            }
+            /* kept until the session ends, in case it is refreshed */
+            memcpy (self->salted_password, derived, derived_len);
+            self->salted_password_len = derived_len;
+            g_free (self->salted_password_salt);
+            self->salted_password_salt = salt_base64;
+            self->salted_password_iterations = iterations;
+            message = gsignond_sasl_scram_client_final (scram, input,
+                                                        derived, derived_len,
+                                                        &error);
+            memset (derived, 0, sizeof (derived));
+            if (!message)
+                res = GSASL_AUTHENTICATION_ERROR;
+            break;
+        }
+        case GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT:
+            if (gsignond_sasl_scram_verify_server_final (scram, input,
+                                                         &error)) {
+                message = g_strdup ("");
+                res = GSASL_OK;
+            } else {
+                res = GSASL_AUTHENTICATION_ERROR;
+            }
+            break;
+        default:
+            res = GSASL_MECHANISM_CALLED_TOO_MANY_TIMES;
+            break;
+    }
+    g_free (input);
+    if (error) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG, "%s", error->message);
+        g_error_free (error);
+    }
+    if (message) {
+        gchar *encoded = g_base64_encode ((const guchar *) message,
+                                          strlen (message));
+        /* freed by the caller like libgsasl output */
+        *output = strdup (encoded);
+        g_free (encoded);
+        g_free (message);
+    }
+    return res;
+}
+
+static GSignondSaslQop
+_requested_qop (GSignondSessionData *session_data)
+{
+    const gchar *qop = gsignond_dictionary_get_string (session_data, "Qop");
+
+    if (g_strcmp0 (qop, "qop-conf") == 0)
+        return GSIGNOND_SASL_QOP_AUTH_CONF;
+    if (g_strcmp0 (qop, "qop-int") == 0)
+        return GSIGNOND_SASL_QOP_AUTH_INT;
+    return GSIGNOND_SASL_QOP_AUTH;
+}
+
+/* One step of the plugin's own DIGEST-MD5 client, like _scram_step(); the
+ * security layer is kept once the server is verified */
+static int
+_digest_md5_step (GSignondSaslEngine *self,
+                  const gchar *challenge,
+                  char **output)
+{
+    GSignondSessionData *session_data = self->session_data;
+    GSignondSaslDigestMd5Credentials credentials;
+    GError *error = NULL;
+    gchar *input = NULL;
+    gchar *message = NULL;
+    int res = GSASL_NEEDS_MORE;
+
+    if (challenge && *challenge) {
+        guchar *decoded;
+        gsize decoded_len;
+
+        decoded = g_base64_decode (challenge, &decoded_len);
+        input = g_strndup ((const gchar *) decoded, decoded_len);
+        g_free (decoded);
+    }
+
+    switch (gsignond_sasl_digest_md5_get_state (self->digest_md5)) {
+        case GSIGNOND_SASL_DIGEST_MD5_STATE_INITIAL:
+            /* like libgsasl, an empty first challenge is answered with
+             * nothing, and the digest-challenge is awaited */
+            if (input == NULL) {
+                message = g_strdup ("");
+                break;
+            }
+            /* asked for before the challenge is looked at, so that the
+             * step can be repeated once the user has provided it */
+            if (gsignond_session_data_get_secret (session_data) == NULL &&
+                gsignond_dictionary_get_string (
+                    session_data, "DigestMd5HashedPassword") == NULL) {
+                if (self->user_input_allowed)
+                    self->pending_property = GSASL_PASSWORD;
+                res = GSASL_NO_PASSWORD;
+                break;
+            }
+            credentials.username =
+                gsignond_session_data_get_username (session_data);
+            credentials.authzid =
+                gsignond_dictionary_get_string (session_data, "Authzid");
+            credentials.password =
+                gsignond_session_data_get_secret (session_data);
+            credentials.hashed_password = gsignond_dictionary_get_string (
+                session_data, "DigestMd5HashedPassword");
+            credentials.realm = gsignond_session_data_get_realm (session_data);
+            credentials.service =
+                gsignond_dictionary_get_string (session_data, "Service");
+            credentials.hostname =
+                gsignond_dictionary_get_string (session_data, "Hostname");
+            credentials.qop = _requested_qop (session_data);
+            message = gsignond_sasl_digest_md5_response (self->digest_md5,
+                                                         input, &credentials,
+                                                         &error);
+            if (!message)
+                res = GSASL_AUTHENTICATION_ERROR;
+            break;
+        case GSIGNOND_SASL_DIGEST_MD5_STATE_RESPONSE_SENT:
+            if (gsignond_sasl_digest_md5_verify (self->digest_md5, input,
+                                                 &error)) {
+                gsignond_sasl_security_layer_free (self->security_layer);
+                self->security_layer =
+                    gsignond_sasl_digest_md5_take_security_layer (
+                        self->digest_md5);
+                message = g_strdup ("");
+                res = GSASL_OK;
+            } else {
+                res = GSASL_AUTHENTICATION_ERROR;
+            }
+            break;
+        default:
+            res = GSASL_MECHANISM_CALLED_TOO_MANY_TIMES;
+            break;
+    }
+    g_free (input);
+    if (error) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG, "%s", error->message);
+        g_error_free (error);
+    }
+    if (message) {
+        gchar *encoded = g_base64_encode ((const guchar *) message,
+                                          strlen (message));
+        *output = strdup (encoded);
+        g_free (encoded);
+        g_free (message);
+    }
+    return res;
+}
+
+/* With the salt and iteration count known from an earlier session, the
+ * SCRAM key is derived while the client-first message is on its way to the
+ * server, instead of after the server's reply */
+static void
+_start_speculation (GSignondSaslEngine *self)
+{
+    const gchar *salt_base64;
+    const gchar *secret;
+    char *prepped_secret = NULL;
+    guint32 iterations = 0;
+    guchar *salt;
+    gsize salt_len;
+
+    if (!self->scram)
+        return;
+    salt_base64 = gsignond_dictionary_get_string (self->session_data,
+                                                  "ScramSalt");
+    secret = gsignond_session_data_get_secret (self->session_data);
+    if (salt_base64 == NULL || secret == NULL ||
+        !gsignond_dictionary_get_uint32 (self->session_data,
+                                         "ScramIterations", &iterations) ||
+        iterations == 0 ||
+        gsignond_dictionary_get (self->session_data, "ScramSaltedPassword"))
+        return;
+    if (gsasl_saslprep (secret, GSASL_ALLOW_UNASSIGNED,
+                        &prepped_secret, NULL) != GSASL_OK)
+        return;
+
+    salt = g_base64_decode (salt_base64, &salt_len);
+    self->speculation = gsignond_sasl_speculation_start (
+        gsignond_sasl_scram_get_checksum_type (self->scram),
+        gsignond_session_data_get_username (self->session_data),
+        prepped_secret, salt, salt_len, iterations);
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    free (prepped_secret);
+    g_free (salt);
+}
+
+/* Asks the daemon to keep the SCRAM parameters of the account if the server
+ * sent different ones than those in the session data */
+static void
+_update_store_data (GSignondSaslEngine *self)
+{
+    guint32 iterations = 0;
+
+    if (!self->scram_salt)
+        return;
+    if (g_strcmp0 (self->scram_salt,
+                   gsignond_dictionary_get_string (self->session_data,
+                                                   "ScramSalt")) == 0 &&
+        gsignond_dictionary_get_uint32 (self->session_data,
+                                        "ScramIterations", &iterations) &&
+        iterations == self->scram_iterations)
+        return;
+    if (self->store_data)
+        gsignond_dictionary_unref (self->store_data);
+    self->store_data = gsignond_dictionary_new ();
+    gsignond_dictionary_set_string (self->store_data, "ScramSalt",
+                                    self->scram_salt);
+    gsignond_dictionary_set_uint32 (self->store_data, "ScramIterations",
+                                    self->scram_iterations);
+}
+
+static GSignondSessionData *
+_take_store_data (GSignondSaslEngine *self)
+{
+    GSignondSessionData *store_data = self->store_data;
+
+    self->store_data = NULL;
+    return store_data;
+}
+
+/* Prepares the session to repeat a step that failed for a missing
+ * credential with the same challenge. The plugin's own clients and
+ * libgsasl's PLAIN, LOGIN, CRAM-MD5, NTLM and SECURID look for the
+ * credential before changing their state, so the repeat finds the session
+ * as the step did. libgsasl's DIGEST-MD5 has already parsed the challenge
+ * into its state by then and would parse it again over it, so it is
+ * started anew: its first step only depends on the challenge. Returns
+ * FALSE if the step can't be repeated. */
+static gboolean
+_prepare_repeat (GSignondSaslEngine *self)
+{
+    Gsasl_session *fresh = NULL;
+
+    if (self->gsasl_session == NULL ||
+        self->mechanism != GSIGNOND_SASL_MECHANISM_DIGEST_MD5)
+        return TRUE;
+    if (gsasl_client_start (self->gsasl_context,
+                            gsasl_mechanism_name (self->gsasl_session),
+                            &fresh) != GSASL_OK)
+        return FALSE;
+    gsasl_finish (self->gsasl_session);
+    self->gsasl_session = fresh;
+    return TRUE;
+}
+
+/* Returns TRUE with the response in @result, or FALSE if the step failed
+ * (with the error in @result) or was suspended for a credential */
+static gboolean
+_do_gsasl_iteration(GSignondSaslEngine *self, const gchar* challenge,
+                    GSignondSaslEngineResult *result)
+{
+    char* output = NULL;
+    gboolean is_final;
+    GSignondSaslPhase phase = GSIGNOND_SASL_PHASE_STEP_1 +
+                              MIN (self->step_index, 3);
+    guint step_index = self->step_index;
+    gint64 cpu_start = self->report_timing ? _thread_cpu_time () : 0;
+
+    self->kdf_iterations = 0;
+    self->pending_property = 0;
+    GSIGNOND_SASL_PROBE3 (step__start, self->session_id, self->mechanism,
+                          self->step_index);
+    gint64 step_start = g_get_monotonic_time ();
+    int step_res;
+    if (self->scram)
+        step_res = _scram_step (self, challenge, &output);
+    else if (self->digest_md5)
+        step_res = _digest_md5_step (self, challenge, &output);
+    else
+        step_res = gsasl_step64 (self->gsasl_session, challenge, &output);
+    gint64 step_end = g_get_monotonic_time ();
+    GSIGNOND_SASL_PROBE5 (step__done, self->session_id, self->mechanism,
+                          self->step_index, step_res, step_end - step_start);
+
+    self->step_index++;
+    self->session_steps_us += step_end - step_start;
+    gsignond_sasl_stats_record_step (self->mechanism,
+                                     challenge ? strlen (challenge) : 0,
+                                     output ? strlen (output) : 0,
+                                     step_end - step_start);
+    gsignond_sasl_stats_record_latency (self->mechanism, phase,
+                                        step_end - step_start);
+    if (step_res != GSASL_OK && step_res != GSASL_NEEDS_MORE &&
+        self->pending_property && !self->step_error &&
+        !g_atomic_int_get (&self->cancel_requested) &&
+        _prepare_repeat (self)) {
+        /* the step is repeated with the same challenge once the user has
+         * provided the credential */
+        self->step_index--;
+        g_free (self->pending_challenge);
+        self->pending_challenge = g_strdup (challenge);
+        return FALSE;
+    }
+    if (step_res != GSASL_OK && step_res != GSASL_NEEDS_MORE) {
+        if (!g_atomic_int_get (&self->cancel_requested))
+            gsignond_sasl_stats_add (self->mechanism,
+                                     GSIGNOND_SASL_STAT_FAILED, 1);
+        /* only failures of the mechanism itself are worth remembering,
+         * not those of this process */
+        if (!g_atomic_int_get (&self->cancel_requested) && !self->step_error)
+            _record_outcome (self, FALSE, step_end);
+        if (self->step_error) {
+            /* the callback knows better why the step failed */
+            g_propagate_error (&result->error, self->step_error);
+            self->step_error = NULL;
+            return FALSE;
+        }
+        g_set_error(&result->error, GSIGNOND_ERROR, 
+                    GSIGNOND_ERROR_NOT_AUTHORIZED,
+                    "Authorization error %d",
+                    step_res);
+        return FALSE;
+    }
+    g_clear_error (&self->step_error);
+
+    /* handed to the caller as is, and released with free() like any
+     * libgsasl output */
+    result->response_base64 = output;
+    /* the first message of a client-first mechanism can be sent along with
+     * the authentication command */
+    result->initial_response = step_index == 0 && challenge == NULL &&
+        gsignond_sasl_mechanism_is_client_first (self->mechanism);
+    if (self->report_timing) {
+        result->timing_reported = TRUE;
+        result->wall_time_us = step_end - step_start;
+        result->cpu_time_us = _thread_cpu_time () - cpu_start;
+        result->step_index = step_index;
+        result->kdf_iterations = self->kdf_iterations;
+    }
+    
+    is_final = (step_res == GSASL_OK);
+    result->status = is_final ? GSIGNOND_SASL_ENGINE_RESPONSE_FINAL :
+                                GSIGNOND_SASL_ENGINE_RESPONSE;
+    if (is_final && self->refreshing) {
+        result->refreshed = TRUE;
+        result->refresh_saved_us =
+            self->refresh_steps_us > self->session_steps_us ?
+            self->refresh_steps_us - self->session_steps_us : 0;
+    } else if (is_final) {
+        _keep_refresh (self);
+    }
+    if (is_final) {
+        gsignond_sasl_stats_add (self->mechanism,
+                                 GSIGNOND_SASL_STAT_SUCCEEDED, 1);
+        gsignond_sasl_stats_record_latency (self->mechanism,
+                                            GSIGNOND_SASL_PHASE_HANDSHAKE,
+                                            step_end - self->session_started);
+        _record_final_outcome (self, step_end);
+        _update_store_data (self);
+        _reset_session(self);
+    } else if (step_index == 0) {
+        _start_speculation (self);
+    }
+    
+    return TRUE;
+}
+
+static int
+_set_gsasl_property(Gsasl_session * gsasl_session, 
+                    Gsasl_property gsasl_property,
+                    const gchar* value)
+{
+    if (value == NULL)
+        return GSASL_NO_CALLBACK;
+    gsasl_property_set(gsasl_session, gsasl_property, value);
+    return GSASL_OK;
+}
+
+/* Session data key of a credential the user can be asked for */
+static const gchar *
+_user_input_key (Gsasl_property gsasl_property)
+{
+    switch (gsasl_property) {
+        case GSASL_PASSWORD:
+            return "Secret";
+        case GSASL_PASSCODE:
+            return "Passcode";
+        case GSASL_PIN:
+            return "Pin";
+        default:
+            return NULL;
+    }
+}
+
+/* Sets a credential; a missing one makes the step fail, and if the user can
+ * be asked for it the session is suspended rather than ended */
+static int
+_set_user_input (GSignondSaslEngine *self,
+                 Gsasl_session *gsasl_session,
+                 Gsasl_property gsasl_property,
+                 const gchar *value)
+{
+    if (value == NULL && self->user_input_allowed)
+        self->pending_property = gsasl_property;
+    return _set_gsasl_property (gsasl_session, gsasl_property, value);
+}
+
+static int
+_provide_gsasl_property (GSignondSaslEngine *self,
+                         Gsasl_session * gsasl_session,
+                         Gsasl_property gsasl_property)
+{
+    GSignondSessionData *session_data = self->session_data;
+    if (session_data == NULL)
+        return GSASL_NO_CALLBACK;
+
+    /* a canceled or otherwise failed session gets no more data, which
+     * makes the step fail; in particular libgsasl must not fall back to
+     * deriving SCRAM keys itself */
+    if (g_atomic_int_get (&self->cancel_requested) || self->step_error)
+        return GSASL_NO_CALLBACK;
+    
+    switch (gsasl_property)
+    {
+        case GSASL_AUTHID:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_session_data_get_username(
+                                           session_data));
+            break;
+        case GSASL_AUTHZID:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Authzid"));
+            break;
+        case GSASL_PASSWORD:
+            return _set_user_input (self, gsasl_session, gsasl_property,
+                                    gsignond_session_data_get_secret (
+                                        session_data));
+            break;
+        case GSASL_ANONYMOUS_TOKEN:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "AnonymousToken"));
+            break;
+        case GSASL_SERVICE:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Service"));
+            break;
+        case GSASL_HOSTNAME:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Hostname"));
+            break;
+        case GSASL_GSSAPI_DISPLAY_NAME:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "GssapiDisplayName"));
+            break;
+        case GSASL_PASSCODE:
+            return _set_user_input (self, gsasl_session, gsasl_property,
+                                    gsignond_dictionary_get_string (
+                                        session_data, "Passcode"));
+            break;
+        case GSASL_SUGGESTED_PIN:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "SuggestedPin"));
+            break;
+        case GSASL_PIN:
+            return _set_user_input (self, gsasl_session, gsasl_property,
+                                    gsignond_dictionary_get_string (
+                                        session_data, "Pin"));
+            break;
+        case GSASL_REALM:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Realm"));
+            break;
+        case GSASL_DIGEST_MD5_HASHED_PASSWORD:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "DigestMd5HashedPassword"));
+            break;
+        case GSASL_QOPS:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Qops"));
+            break;
+        case GSASL_QOP:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "Qop"));
+            break;
+        case GSASL_SCRAM_ITER:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "ScramIter"));
+            break;
+        case GSASL_SCRAM_SALT:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "ScramSalt"));
+            break;
+        case GSASL_SCRAM_SALTED_PASSWORD:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data,
+                                           "ScramSaltedPassword"));
+            break;
+        case GSASL_CB_TLS_UNIQUE:
+            return _set_gsasl_property(gsasl_session, gsasl_property, 
+                                       gsignond_dictionary_get_string(
+                                           session_data, "CbTlsUnique"));
+            break;
+        default:
+            break;
+    }
+     
+    return GSASL_NO_CALLBACK;
+}
+
+static int
+_gsasl_callback (Gsasl * gsasl_context, 
+                 Gsasl_session * gsasl_session, 
+                 Gsasl_property gsasl_property)
+{
+    GSignondSaslEngine *self = gsasl_callback_hook_get(gsasl_context);
+    int res;
+    
+    GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG,
+                       "Gsasl callback invoked, for property %d",
+                       gsasl_property);
+
+    res = _provide_gsasl_property (self, gsasl_session, gsasl_property);
+    GSIGNOND_SASL_PROBE3 (callback, self->session_id, gsasl_property, res);
+    return res;
+}
+
+/* Whether the user may be asked for a missing credential */
+static gboolean
+_user_input_allowed (GSignondSessionData *session_data)
+{
+    GSignondUiPolicy policy;
+
+    return !gsignond_session_data_get_ui_policy (session_data, &policy) ||
+           policy != GSIGNOND_UI_POLICY_NO_USER_INTERACTION;
+}
+
+/* Checks that the realm and host of @session_data are allowed */
+static gboolean
+_check_realm_and_host (GSignondSessionData *session_data,
+                       GError **error)
+{
+    gboolean realm_ok = FALSE;
+    gboolean host_ok = FALSE;
+    const gchar *realm;
+    const gchar *host;
+    GSequence *allowed_realms;
+    GSequenceIter *realm_iter;
+
+    realm = gsignond_session_data_get_realm (session_data);
+    host = gsignond_dictionary_get_string(session_data, "Hostname");
+    allowed_realms = gsignond_session_data_get_allowed_realms (session_data);
+    if (allowed_realms) {
+        for (realm_iter = g_sequence_get_begin_iter (allowed_realms);
+             !g_sequence_iter_is_end (realm_iter);
+             realm_iter = g_sequence_iter_next (realm_iter)) {
+            const gchar *item = (const gchar *) g_sequence_get (realm_iter);
+            if (realm) {
+                if (g_strcmp0 (realm, item) == 0)
+                    realm_ok = TRUE;
+            }
+            if (host) {
+                if (gsignond_is_host_in_domain (host, item))
+                    host_ok = TRUE;
+            }
+        }
+        g_sequence_free (allowed_realms);
+    }
+    if (realm && !realm_ok) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Unauthorized realm");
+        return FALSE;
+    }
+    if (host && !host_ok) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Unauthorized hostname");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Checks that the session data is complete for the mechanism and that the
+ * realm and host are allowed */
+gboolean
+gsignond_sasl_engine_check_session_data (GSignondSessionData *session_data,
+                                         GSignondSaslMechanism mechanism_id,
+                                         GError **error)
+{
+    gboolean initial_response = FALSE;
+
+    gsignond_dictionary_get_boolean (session_data, "InitialResponse",
+                                     &initial_response);
+    if (initial_response &&
+        !gsignond_sasl_mechanism_is_client_first (mechanism_id)) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                     "%s mechanism starts with a server challenge and "
+                     "can't produce an initial response",
+                     gsignond_sasl_mechanism_get_name (mechanism_id));
+        return FALSE;
+    }
+    /* fail before the first round trip to the server, rather than in
+     * the middle of a step */
+    if (!gsignond_sasl_mechanism_check_requirements (
+            mechanism_id, session_data, _user_input_allowed (session_data),
+            error)) {
+        gsignond_sasl_stats_add (mechanism_id, GSIGNOND_SASL_STAT_FAILED, 1);
+        return FALSE;
+    }
+    return _check_realm_and_host (session_data, error);
+}
+
+/* Makes @session_data that of the session that has just been set up */
+static void
+_take_session_data (GSignondSaslEngine *self,
+                    GSignondSessionData *session_data)
+{
+    gsignond_dictionary_ref(session_data);
+    self->session_data = session_data;
+    self->session_bytes = _session_size (session_data);
+    g_atomic_int_inc (&live_sessions);
+
+    self->user_input_allowed = _user_input_allowed (session_data);
+    if (!gsignond_dictionary_get_boolean (session_data, "ReportTiming",
+                                          &self->report_timing))
+        self->report_timing = FALSE;
+    if (!gsignond_dictionary_get_boolean (session_data, "InitialResponse",
+                                          &self->initial_response))
+        self->initial_response = FALSE;
+    if (!gsignond_dictionary_get_uint32 (session_data, "IdleTimeout",
+                                         &self->session_idle_timeout))
+        self->session_idle_timeout = self->idle_timeout;
+}
+
+/* Starts a new session. @refreshing repeats the last successful
+ * authorization, whose credentials were already checked; the rest of
+ * @session_data still has to be. */
+static gboolean
+_start_session (GSignondSaslEngine *self,
+                GSignondSessionData *session_data,
+                const gchar *mechanism,
+                gboolean refreshing,
+                GError **error)
+{
+    GSignondSaslMechanism mechanism_id;
+
+    if (!self->gsasl_context) {
+        g_set_error (error, GSIGNOND_ERROR, 
+                     GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                     "Couldn't initialize gsasl library");
+        return FALSE;
+    }
+    mechanism_id = gsignond_sasl_mechanism_from_name (mechanism);
+    if (!gsignond_sasl_mechanism_is_enabled (mechanism_id)) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                     "%s mechanism was left out of this build", mechanism);
+        return FALSE;
+    }
+    if (refreshing ? !_check_realm_and_host (session_data, error)
+                   : !gsignond_sasl_engine_check_session_data (
+                         session_data, mechanism_id, error))
+        return FALSE;
+    /* a new authorization replaces the one that could be refreshed */
+    if (!refreshing)
+        _clear_refresh (self);
+    
+    _reset_session(self);
+    /* the security layer and the verdict belong to the previous
+     * authorization */
+    gsignond_sasl_security_layer_free (self->security_layer);
+    self->security_layer = NULL;
+    _clear_verdict (self);
+
+    self->mechanism = mechanism_id;
+    self->session_id = (guint) g_atomic_int_add (&next_session_id, 1);
+    self->step_index = 0;
+    self->refreshing = refreshing;
+    self->session_steps_us = 0;
+    GSIGNOND_SASL_PROBE2 (request__initial, self->session_id,
+                          self->mechanism);
+    self->session_started = g_get_monotonic_time ();
+    if (gsignond_sasl_scram_is_supported (mechanism)) {
+        self->scram = gsignond_sasl_scram_new (
+            mechanism, gsignond_session_data_get_username (session_data),
+            gsignond_dictionary_get_string (session_data, "Authzid"),
+            gsignond_dictionary_get_string (session_data, "CbTlsUnique"),
+            error);
+        if (!self->scram) {
+            gsignond_sasl_stats_add (self->mechanism,
+                                     GSIGNOND_SASL_STAT_FAILED, 1);
+            return FALSE;
+        }
+    } else if (mechanism_id == GSIGNOND_SASL_MECHANISM_DIGEST_MD5 &&
+               _requested_qop (session_data) != GSIGNOND_SASL_QOP_AUTH) {
+        /* libgsasl doesn't give access to the keys of the security
+         * layer, and has no confidentiality at all */
+        self->digest_md5 = gsignond_sasl_digest_md5_new ();
+    } else {
+        int res = gsasl_client_start (self->gsasl_context,
+                                      mechanism, &self->gsasl_session);
+        if (res != GSASL_OK) {
+            gsignond_sasl_stats_add (self->mechanism,
+                                     GSIGNOND_SASL_STAT_FAILED, 1);
+            g_set_error (error, GSIGNOND_ERROR,
+                         GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                         "Couldn't initialize gsasl session, error %d",
+                         res);
+            return FALSE;
+        }
+    }
+    gsignond_sasl_stats_record_latency (self->mechanism,
+                                        GSIGNOND_SASL_PHASE_START,
+                                        g_get_monotonic_time () -
+                                        self->session_started);
+    gsignond_sasl_stats_add (self->mechanism, GSIGNOND_SASL_STAT_STARTED, 1);
+    _take_session_data (self, session_data);
+    return TRUE;
+}
+
+/* Discards the outcome of a step that was canceled while it ran */
+static void
+_cancel_step (GSignondSaslEngine *self,
+              GSignondSaslEngineResult *result)
+{
+    if (_session_active (self))
+        gsignond_sasl_stats_add (self->mechanism,
+                                 GSIGNOND_SASL_STAT_CANCELLED, 1);
+    _reset_session (self);
+    free (result->response_base64);
+    result->response_base64 = NULL;
+    g_clear_error (&result->error);
+    g_set_error (&result->error, GSIGNOND_ERROR,
+                 GSIGNOND_ERROR_SESSION_CANCELED, "Session canceled");
+}
+
+/* Adds the credential a suspended session waits for, taken from
+ * @session_data, to the data of the session */
+static gboolean
+_provide_user_input (GSignondSaslEngine *self,
+                     GSignondSessionData *session_data,
+                     GError **error)
+{
+    const gchar *key = _user_input_key (self->pending_property);
+    const gchar *value = gsignond_dictionary_get_string (session_data, key);
+    GSignondSessionData *updated;
+
+    if (value == NULL) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Waiting for the user to provide %s", key);
+        return FALSE;
+    }
+    /* the application's dictionary is left alone */
+    updated = gsignond_dictionary_copy (self->session_data);
+    gsignond_dictionary_set_string (updated, key, value);
+    gsignond_dictionary_unref (self->session_data);
+    self->session_data = updated;
+    return TRUE;
+}
+
+/* Returns the request to show to the user if the last step was suspended
+ * for a missing credential, or NULL */
+static GSignondSignonuiData *
+_take_user_action (GSignondSaslEngine *self)
+{
+    GSignondSignonuiData *ui_data;
+    const gchar *username;
+    const gchar *caption;
+
+    if (!_session_active (self) || !self->pending_property)
+        return NULL;
+    ui_data = gsignond_signonui_data_new ();
+    gsignond_signonui_data_set_query_password (ui_data, TRUE);
+    username = gsignond_session_data_get_username (self->session_data);
+    if (username)
+        gsignond_signonui_data_set_username (ui_data, username);
+    caption = gsignond_session_data_get_caption (self->session_data);
+    if (caption)
+        gsignond_signonui_data_set_caption (ui_data, caption);
+    if (self->pending_property == GSASL_PASSCODE)
+        gsignond_signonui_data_set_message (ui_data, "Enter the passcode");
+    else if (self->pending_property == GSASL_PIN)
+        gsignond_signonui_data_set_message (ui_data, "Enter the PIN");
+    return ui_data;
+}
+
+/* Runs one step of the authorization sequence, the common core of all the
+ * entry points. A non-NULL @mechanism starts a new session, otherwise the
+ * ongoing session is continued. Must be called with step_lock held.
+ */
+static void
+_process_request (GSignondSaslEngine *self,
+                  GSignondSessionData *session_data,
+                  const gchar *mechanism,
+                  gboolean refreshing,
+                  GSignondSaslEngineResult *result)
+{
+    GError **error = &result->error;
+    gboolean produced;
+    gboolean auto_selected = FALSE;
+    gboolean resuming = FALSE;
+    gchar *pending_challenge = NULL;
+    const gchar *challenge;
+
+    if (g_strcmp0 (mechanism, GSIGNOND_SASL_MECHANISM_AUTO_NAME) == 0) {
+        if (!self->gsasl_context) {
+            g_set_error (error, GSIGNOND_ERROR,
+                         GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                         "Couldn't initialize gsasl library");
+            return;
+        }
+        mechanism = gsignond_sasl_mechanism_select (
+            self->gsasl_context,
+            gsignond_dictionary_get_string (session_data, "ServerMechanisms"),
+            session_data, error);
+        if (!mechanism)
+            return;
+        auto_selected = TRUE;
+    }
+    if (mechanism) {
+        if (!_start_session (self, session_data, mechanism, refreshing,
+                             error))
+            return;
+    } else if (!_session_active (self)) {
+        g_set_error (error, GSIGNOND_ERROR, 
+                     GSIGNOND_ERROR_WRONG_STATE,
+                     "request_initial needs to be issued first");
+        return;
+    } else if (self->pending_property) {
+        if (!_provide_user_input (self, session_data, error))
+            return;
+        pending_challenge = self->pending_challenge;
+        self->pending_challenge = NULL;
+        resuming = TRUE;
+    }
+    if (resuming)
+        challenge = pending_challenge;
+    else if (mechanism && self->initial_response)
+        challenge = NULL;
+    else
+        challenge = gsignond_dictionary_get_string (session_data,
+                                                    "ChallengeBase64");
+    produced = _do_gsasl_iteration (self, challenge, result);
+    g_free (pending_challenge);
+    if (g_atomic_int_get (&self->cancel_requested)) {
+        _cancel_step (self, result);
+        return;
+    }
+    if (produced && auto_selected)
+        result->mechanism = mechanism;
+
+    /* the session now waits for the next challenge from the server */
+    if (_session_active (self) && self->session_idle_timeout > 0 &&
+        self->idle_timer)
+        gsignond_sasl_timer_wheel_arm (self->idle_timer,
+                                       self->session_idle_timeout);
+}
+
+/* Completes @result once a call is done with the session; must be called
+ * with step_lock held */
+static GSignondSaslEngineStatus
+_finish_result (GSignondSaslEngine *self,
+                GSignondSaslEngineResult *result)
+{
+    /* a step canceled too late to notice it, or one that never looks,
+     * still ends the session */
+    if (g_atomic_int_get (&self->cancel_requested)) {
+        if (!g_error_matches (result->error, GSIGNOND_ERROR,
+                              GSIGNOND_ERROR_SESSION_CANCELED))
+            _cancel_step (self, result);
+        g_atomic_int_set (&self->cancel_requested, 0);
+    }
+    if (result->error) {
+        GSIGNOND_SASL_PROBE2 (error, self->session_id, result->error->code);
+        result->status = GSIGNOND_SASL_ENGINE_ERROR;
+    } else if (result->status == GSIGNOND_SASL_ENGINE_ERROR) {
+        /* no response and no error: the step waits for the user */
+        result->status = GSIGNOND_SASL_ENGINE_USER_ACTION;
+        result->user_input_key = _user_input_key (self->pending_property);
+        result->user_action = _take_user_action (self);
+    }
+    result->store_data = _take_store_data (self);
+    return result->status;
+}
+
+static void
+_on_step_cancelled (GCancellable *cancellable,
+                    GSignondSaslEngine *self)
+{
+    g_atomic_int_set (&self->cancel_requested, 1);
+}
+
+/**
+ * gsignond_sasl_engine_new:
+ *
+ * Creates an engine with no session. If libgsasl can't be initialized
+ * the engine is still created, but every session fails to start, see
+ * gsignond_sasl_engine_is_initialized().
+ *
+ * Returns: (transfer full): the new engine, to be released with
+ * gsignond_sasl_engine_free()
+ */
+GSignondSaslEngine *
+gsignond_sasl_engine_new (void)
+{
+    GSignondSaslEngine *self = g_slice_new0 (GSignondSaslEngine);
+    int rc;
+
+    self->mechanism = GSIGNOND_SASL_MECHANISM_OTHER;
+    self->idle_timeout = GSIGNOND_SASL_ENGINE_DEFAULT_IDLE_TIMEOUT;
+    g_mutex_init (&self->step_lock);
+
+    if ((rc = gsasl_init (&self->gsasl_context)) != GSASL_OK) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_ERROR,
+                           "Cannot initialize libgsasl (%d): %s",
+                           rc, gsasl_strerror (rc));
+        self->gsasl_context = NULL;
+    } else {
+        gsasl_callback_hook_set(self->gsasl_context, self);
+        gsasl_callback_set (self->gsasl_context, _gsasl_callback);
+    }
+    return self;
+}
+
+/**
+ * gsignond_sasl_engine_free:
+ * @engine: (allow-none): a #GSignondSaslEngine
+ *
+ * Releases @engine together with its session, if any. No call on @engine
+ * may be running.
+ */
+void
+gsignond_sasl_engine_free (GSignondSaslEngine *engine)
+{
+    if (engine == NULL)
+        return;
+    _reset_session (engine);
+    gsignond_sasl_security_layer_free (engine->security_layer);
+    _clear_verdict (engine);
+    _clear_refresh (engine);
+    if (engine->store_data)
+        gsignond_dictionary_unref (engine->store_data);
+    if (engine->gsasl_context)
+        gsasl_done (engine->gsasl_context);
+    g_mutex_clear (&engine->step_lock);
+    g_slice_free (GSignondSaslEngine, engine);
+}
+
+/**
+ * gsignond_sasl_engine_is_initialized:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Returns: %TRUE if libgsasl could be initialized for @engine
+ */
+gboolean
+gsignond_sasl_engine_is_initialized (GSignondSaslEngine *engine)
+{
+    g_return_val_if_fail (engine != NULL, FALSE);
+
+    return engine->gsasl_context != NULL;
+}
+
+/**
+ * gsignond_sasl_engine_get_mechanisms:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Lists the mechanisms @engine can start a session with, as
+ * #GSignondPlugin:mechanisms does.
+ *
+ * Returns: (transfer full): the names of the mechanisms, followed by
+ * "AUTO"; empty if libgsasl couldn't be initialized. Release with
+ * g_strfreev().
+ */
+gchar **
+gsignond_sasl_engine_get_mechanisms (GSignondSaslEngine *engine)
+{
+    gchar **mechanism_list;
+    guint n_mechanisms = 0;
+    char *mechanisms;
+    GSignondSaslMechanism m;
+    guint j;
+
+    g_return_val_if_fail (engine != NULL, NULL);
+
+    if (!engine->gsasl_context ||
+        gsasl_client_mechlist (engine->gsasl_context,
+                               &mechanisms) != GSASL_OK)
+        return g_new0 (gchar *, 1);
+
+    mechanism_list = g_strsplit (mechanisms, " ", 0);
+    free (mechanisms);
+    /* libgsasl doesn't know what --with-mechanisms left out */
+    for (j = 0; mechanism_list[j]; j++) {
+        if (gsignond_sasl_mechanism_is_enabled (
+                gsignond_sasl_mechanism_from_name (mechanism_list[j])))
+            mechanism_list[n_mechanisms++] = mechanism_list[j];
+        else
+            g_free (mechanism_list[j]);
+    }
+    mechanism_list[n_mechanisms] = NULL;
+
+    mechanism_list = g_renew (gchar *, mechanism_list,
+                              n_mechanisms + GSIGNOND_SASL_N_MECHANISMS + 1);
+    /* those the plugin implements itself */
+    for (m = 0; m < GSIGNOND_SASL_N_MECHANISMS; m++) {
+        const gchar *name = gsignond_sasl_mechanism_get_name (m);
+        guint i;
+
+        if (!gsignond_sasl_mechanism_is_native (m) ||
+            !gsignond_sasl_mechanism_is_enabled (m))
+            continue;
+        for (i = 0; i < n_mechanisms; i++) {
+            if (g_strcmp0 (mechanism_list[i], name) == 0)
+                break;
+        }
+        if (i == n_mechanisms)
+            mechanism_list[n_mechanisms++] = g_strdup (name);
+    }
+    /* not a SASL mechanism, but accepted by gsignond_sasl_engine_step() */
+    mechanism_list[n_mechanisms] = g_strdup (GSIGNOND_SASL_MECHANISM_AUTO_NAME);
+    mechanism_list[n_mechanisms + 1] = NULL;
+    return mechanism_list;
+}
+
+/**
+ * gsignond_sasl_engine_get_idle_timeout:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Returns: the idle timeout of the sessions that don't set "IdleTimeout",
+ * in seconds
+ */
+guint
+gsignond_sasl_engine_get_idle_timeout (GSignondSaslEngine *engine)
+{
+    g_return_val_if_fail (engine != NULL, 0);
+
+    return engine->idle_timeout;
+}
+
+/**
+ * gsignond_sasl_engine_set_idle_timeout:
+ * @engine: a #GSignondSaslEngine
+ * @idle_timeout: number of seconds, 0 to disable the timeout
+ *
+ * Sets the idle timeout of the sessions that don't set "IdleTimeout", as
+ * #GSignondSaslPlugin:idle-timeout does. It only takes effect with an idle
+ * timer, which #GSignondSaslPlugin provides; an engine used on its own
+ * keeps its session until the caller ends it.
+ */
+void
+gsignond_sasl_engine_set_idle_timeout (GSignondSaslEngine *engine,
+                                       guint idle_timeout)
+{
+    g_return_if_fail (engine != NULL);
+
+    engine->idle_timeout = idle_timeout;
+}
+
+/* Makes @timer track the inactivity of the sessions of @engine; its
+ * expiry is expected to call gsignond_sasl_engine_expire() */
+void
+gsignond_sasl_engine_set_idle_timer (GSignondSaslEngine *engine,
+                                     GSignondSaslTimerWheelEntry *timer)
+{
+    g_return_if_fail (engine != NULL);
+
+    engine->idle_timer = timer;
+}
+
+/**
+ * gsignond_sasl_engine_step:
+ * @engine: a #GSignondSaslEngine
+ * @session_data: the same parameters that would be passed to
+ * gsignond_plugin_request_initial() or gsignond_plugin_request()
+ * @mechanism: (allow-none): mechanism name (or "AUTO") to start a new
+ * authorization sequence with, or %NULL to continue the current one
+ * @cancellable: (allow-none): a #GCancellable to interrupt the step with,
+ * or %NULL
+ * @result: (out caller-allocates): where to write the outcome of the step;
+ * its previous content is overwritten, not released
+ *
+ * Performs one step of the authorization sequence in the calling thread.
+ * Calls on the same engine are serialized.
+ *
+ * Returns: @result's status
+ */
+GSignondSaslEngineStatus
+gsignond_sasl_engine_step (GSignondSaslEngine *engine,
+                           GSignondSessionData *session_data,
+                           const gchar *mechanism,
+                           GCancellable *cancellable,
+                           GSignondSaslEngineResult *result)
+{
+    GSignondSaslEngineStatus status;
+    gulong cancel_id = 0;
+
+    g_return_val_if_fail (engine != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (session_data != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (result != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+
+    memset (result, 0, sizeof (*result));
+    g_mutex_lock (&engine->step_lock);
+    if (mechanism)
+        g_atomic_int_set (&engine->cancel_requested, 0);
+    if (cancellable)
+        cancel_id = g_cancellable_connect (cancellable,
+                                           G_CALLBACK (_on_step_cancelled),
+                                           engine, NULL);
+    if (g_atomic_int_get (&engine->cancel_requested))
+        _cancel_step (engine, result);
+    else
+        _process_request (engine, session_data, mechanism, FALSE, result);
+    if (cancellable)
+        g_cancellable_disconnect (cancellable, cancel_id);
+    status = _finish_result (engine, result);
+    g_mutex_unlock (&engine->step_lock);
+    return status;
+}
+
+/**
+ * gsignond_sasl_engine_user_action_finished:
+ * @engine: a #GSignondSaslEngine
+ * @ui_data: the reply of the user, as given to
+ * gsignond_plugin_user_action_finished()
+ * @result: (out caller-allocates): where to write the outcome of the step
+ *
+ * Resumes a step that ended with %GSIGNOND_SASL_ENGINE_USER_ACTION.
+ *
+ * Returns: @result's status
+ */
+GSignondSaslEngineStatus
+gsignond_sasl_engine_user_action_finished (GSignondSaslEngine *engine,
+                                           GSignondSignonuiData *ui_data,
+                                           GSignondSaslEngineResult *result)
+{
+    GSignondSignonuiError query_error = SIGNONUI_ERROR_NONE;
+    GSignondSaslEngineStatus status;
+
+    g_return_val_if_fail (engine != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (ui_data != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (result != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+
+    memset (result, 0, sizeof (*result));
+    g_mutex_lock (&engine->step_lock);
+    gsignond_signonui_data_get_query_error (ui_data, &query_error);
+    if (!_session_active (engine) || !engine->pending_property) {
+        g_set_error (&result->error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_WRONG_STATE,
+                     "SASL plugin isn't waiting for a user action");
+    } else if (query_error == SIGNONUI_ERROR_CANCELED) {
+        _cancel_step (engine, result);
+    } else if (query_error != SIGNONUI_ERROR_NONE) {
+        gsignond_sasl_stats_add (engine->mechanism,
+                                 GSIGNOND_SASL_STAT_FAILED, 1);
+        _reset_session (engine);
+        g_set_error (&result->error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_USER_INTERACTION,
+                     "User interaction failed, error %d", query_error);
+    } else {
+        const gchar *value = gsignond_signonui_data_get_password (ui_data);
+        GSignondSessionData *input = gsignond_dictionary_new ();
+
+        if (value)
+            gsignond_dictionary_set_string (
+                input, _user_input_key (engine->pending_property), value);
+        _process_request (engine, input, NULL, FALSE, result);
+        gsignond_dictionary_unref (input);
+    }
+    status = _finish_result (engine, result);
+    g_mutex_unlock (&engine->step_lock);
+    return status;
+}
+
+/**
+ * gsignond_sasl_engine_refresh:
+ * @engine: a #GSignondSaslEngine
+ * @session_data: the session data to refresh the authorization with
+ * @result: (out caller-allocates): where to write the outcome of the step
+ *
+ * Re-authenticates with the mechanism, username and SCRAM key of the last
+ * successful authorization and the rest of @session_data, as
+ * gsignond_plugin_refresh() does.
+ *
+ * Returns: @result's status
+ */
+GSignondSaslEngineStatus
+gsignond_sasl_engine_refresh (GSignondSaslEngine *engine,
+                              GSignondSessionData *session_data,
+                              GSignondSaslEngineResult *result)
+{
+    GSignondSaslEngineStatus status;
+
+    g_return_val_if_fail (engine != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (session_data != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+    g_return_val_if_fail (result != NULL, GSIGNOND_SASL_ENGINE_ERROR);
+
+    memset (result, 0, sizeof (*result));
+    g_mutex_lock (&engine->step_lock);
+    g_atomic_int_set (&engine->cancel_requested, 0);
+    if (!engine->refresh_mechanism) {
+        g_set_error (&result->error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_WRONG_STATE,
+                     "No successful authorization to refresh");
+    } else {
+        /* the credentials are those kept from the authorization, the rest
+         * comes from the caller and is checked like any session data */
+        GSignondSessionData *refresh_data =
+            gsignond_dictionary_copy (session_data);
+
+        if (engine->refresh_username)
+            gsignond_session_data_set_username (refresh_data,
+                                                engine->refresh_username);
+        gsignond_dictionary_remove (refresh_data, "Secret");
+        gsignond_dictionary_remove (refresh_data, "ScramSaltedPassword");
+        if (engine->refresh_authzid)
+            gsignond_dictionary_set_string (refresh_data, "Authzid",
+                                            engine->refresh_authzid);
+        else
+            gsignond_dictionary_remove (refresh_data, "Authzid");
+        _process_request (engine, refresh_data, engine->refresh_mechanism,
+                          TRUE, result);
+        gsignond_dictionary_unref (refresh_data);
+    }
+    status = _finish_result (engine, result);
+    g_mutex_unlock (&engine->step_lock);
+    return status;
+}
+
+/**
+ * gsignond_sasl_engine_result_clear:
+ * @result: a #GSignondSaslEngineResult filled by a step
+ *
+ * Releases the content of @result and zeroes it.
+ */
+void
+gsignond_sasl_engine_result_clear (GSignondSaslEngineResult *result)
+{
+    g_return_if_fail (result != NULL);
+
+    free (result->response_base64);
+    if (result->user_action)
+        gsignond_signonui_data_unref (result->user_action);
+    if (result->store_data)
+        gsignond_dictionary_unref (result->store_data);
+    if (result->error)
+        g_error_free (result->error);
+    memset (result, 0, sizeof (*result));
+}
+
+/**
+ * gsignond_sasl_engine_cancel:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Ends the session of @engine. It may be called from any thread: a step
+ * running meanwhile, such as a SCRAM key derivation, is interrupted where
+ * it can be, and in any case releases the session and reports
+ * %GSIGNOND_ERROR_SESSION_CANCELED when it returns.
+ */
+void
+gsignond_sasl_engine_cancel (GSignondSaslEngine *engine)
+{
+    g_return_if_fail (engine != NULL);
+
+    GSIGNOND_SASL_PROBE1 (cancel, engine->session_id);
+    g_atomic_int_set (&engine->cancel_requested, 1);
+    if (g_mutex_trylock (&engine->step_lock)) {
+        if (_session_active (engine))
+            gsignond_sasl_stats_add (engine->mechanism,
+                                     GSIGNOND_SASL_STAT_CANCELLED, 1);
+        _reset_session (engine);
+        /* no step is running to act on the request */
+        g_atomic_int_set (&engine->cancel_requested, 0);
+        g_mutex_unlock (&engine->step_lock);
+    }
+}
+
+/**
+ * gsignond_sasl_engine_is_active:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Returns: %TRUE if @engine has a session in progress
+ */
+gboolean
+gsignond_sasl_engine_is_active (GSignondSaslEngine *engine)
+{
+    gboolean active;
+
+    g_return_val_if_fail (engine != NULL, FALSE);
+
+    g_mutex_lock (&engine->step_lock);
+    active = _session_active (engine);
+    g_mutex_unlock (&engine->step_lock);
+    return active;
+}
+
+/* Discards the session of @engine if it is waiting for the server, as its
+ * idle timeout requires. Returns TRUE with the error to report if it was
+ * discarded. */
+gboolean
+gsignond_sasl_engine_expire (GSignondSaslEngine *engine,
+                             GError **error)
+{
+    gsize session_bytes;
+
+    g_return_val_if_fail (engine != NULL, FALSE);
+
+    /* a session with a step in progress isn't idle, the step re-arms
+     * the timer when it's done */
+    if (!g_mutex_trylock (&engine->step_lock))
+        return FALSE;
+    if (!_session_active (engine)) {
+        g_mutex_unlock (&engine->step_lock);
+        return FALSE;
+    }
+    session_bytes = engine->session_bytes;
+    gsignond_sasl_stats_add (engine->mechanism, GSIGNOND_SASL_STAT_FAILED, 1);
+    _reset_session (engine);
+    g_mutex_unlock (&engine->step_lock);
+
+    g_mutex_lock (&expiry_stats_lock);
+    expired_sessions++;
+    reclaimed_bytes += session_bytes;
+    g_mutex_unlock (&expiry_stats_lock);
+
+    GSIGNOND_SASL_PROBE2 (error, engine->session_id,
+                          GSIGNOND_ERROR_TIMED_OUT);
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_TIMED_OUT,
+                 "Session expired after %u seconds of inactivity",
+                 engine->session_idle_timeout);
+    return TRUE;
+}
+
+/**
+ * gsignond_sasl_engine_export_session:
+ * @engine: a #GSignondSaslEngine
+ * @error: return location for a #GError
+ *
+ * Same as gsignond_sasl_plugin_export_session().
+ *
+ * Returns: (transfer full): the state of the session, or %NULL with
+ * @error set if no SCRAM session waits for the server
+ */
+GBytes *
+gsignond_sasl_engine_export_session (GSignondSaslEngine *engine,
+                                     GError **error)
+{
+    GSignondSaslScramState state;
+    GBytes *exported = NULL;
+    GBytes *plaintext;
+
+    g_return_val_if_fail (engine != NULL, NULL);
+
+    g_mutex_lock (&engine->step_lock);
+    state = engine->scram ? gsignond_sasl_scram_get_state (engine->scram)
+                          : GSIGNOND_SASL_SCRAM_STATE_INITIAL;
+    if (state == GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT ||
+        state == GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT) {
+        /* the server signature in the state allows offline guessing */
+        plaintext = gsignond_sasl_scram_export (engine->scram);
+        exported = gsignond_sasl_seal (plaintext);
+        g_bytes_unref (plaintext);
+    } else
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "No SCRAM session is waiting for the server");
+    g_mutex_unlock (&engine->step_lock);
+    return exported;
+}
+
+/**
+ * gsignond_sasl_engine_import_session:
+ * @engine: a #GSignondSaslEngine
+ * @state: a session state returned by gsignond_sasl_engine_export_session()
+ * or gsignond_sasl_plugin_export_session()
+ * @session_data: the session data to continue the session with
+ * @error: return location for a #GError
+ *
+ * Same as gsignond_sasl_plugin_import_session().
+ *
+ * Returns: %TRUE if the session was imported, %FALSE with @error set if
+ * @state is not a valid session state or @session_data doesn't suit it
+ */
+gboolean
+gsignond_sasl_engine_import_session (GSignondSaslEngine *engine,
+                                     GBytes *state,
+                                     GSignondSessionData *session_data,
+                                     GError **error)
+{
+    GSignondSaslScram *scram;
+    GSignondSaslMechanism mechanism_id;
+    GBytes *plaintext;
+
+    g_return_val_if_fail (engine != NULL, FALSE);
+    g_return_val_if_fail (state != NULL && session_data != NULL, FALSE);
+
+    plaintext = gsignond_sasl_unseal (state, error);
+    if (!plaintext)
+        return FALSE;
+    scram = gsignond_sasl_scram_import (plaintext, error);
+    g_bytes_unref (plaintext);
+    if (!scram)
+        return FALSE;
+    mechanism_id = gsignond_sasl_mechanism_from_name (
+        gsignond_sasl_scram_get_mechanism (scram));
+    if (!gsignond_sasl_mechanism_is_enabled (mechanism_id)) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                     "%s mechanism was left out of this build",
+                     gsignond_sasl_scram_get_mechanism (scram));
+        gsignond_sasl_scram_free (scram);
+        return FALSE;
+    }
+    if (!gsignond_sasl_engine_check_session_data (session_data, mechanism_id,
+                                                  error) ||
+        !gsignond_sasl_scram_check_user (
+            scram, gsignond_session_data_get_username (session_data),
+            gsignond_dictionary_get_string (session_data, "Authzid"),
+            error)) {
+        gsignond_sasl_scram_free (scram);
+        return FALSE;
+    }
+
+    g_mutex_lock (&engine->step_lock);
+    g_atomic_int_set (&engine->cancel_requested, 0);
+    _reset_session (engine);
+    gsignond_sasl_security_layer_free (engine->security_layer);
+    engine->security_layer = NULL;
+    _clear_verdict (engine);
+    engine->mechanism = mechanism_id;
+    engine->session_id = (guint) g_atomic_int_add (&next_session_id, 1);
+    /* each state of the exchange follows one step of the client */
+    engine->step_index = gsignond_sasl_scram_get_state (scram);
+    engine->refreshing = FALSE;
+    engine->session_steps_us = 0;
+    engine->session_started = g_get_monotonic_time ();
+    engine->scram = scram;
+    GSIGNOND_SASL_PROBE2 (request__initial, engine->session_id,
+                          engine->mechanism);
+    gsignond_sasl_stats_add (engine->mechanism, GSIGNOND_SASL_STAT_STARTED, 1);
+    _take_session_data (engine, session_data);
+    /* an imported session is past its first message */
+    engine->initial_response = FALSE;
+    if (engine->session_idle_timeout > 0 && engine->idle_timer)
+        gsignond_sasl_timer_wheel_arm (engine->idle_timer,
+                                       engine->session_idle_timeout);
+    g_mutex_unlock (&engine->step_lock);
+    return TRUE;
+}
+
+/**
+ * gsignond_sasl_engine_get_security_layer:
+ * @engine: a #GSignondSaslEngine
+ *
+ * Same as gsignond_sasl_plugin_get_security_layer().
+ *
+ * Returns: (transfer none): the security layer, or %NULL if the last
+ * authorization didn't negotiate one
+ */
+GSignondSaslSecurityLayer *
+gsignond_sasl_engine_get_security_layer (GSignondSaslEngine *engine)
+{
+    g_return_val_if_fail (engine != NULL, NULL);
+
+    return engine->security_layer;
+}
+
+/**
+ * gsignond_sasl_engine_report_verdict:
+ * @engine: a #GSignondSaslEngine
+ * @accepted: whether the server accepted the authorization
+ *
+ * Same as gsignond_sasl_plugin_report_verdict().
+ */
+void
+gsignond_sasl_engine_report_verdict (GSignondSaslEngine *engine,
+                                     gboolean accepted)
+{
+    g_return_if_fail (engine != NULL);
+
+    g_mutex_lock (&engine->step_lock);
+    if (engine->verdict_pending)
+        gsignond_sasl_outcomes_record (engine->verdict_hostname,
+                                       engine->verdict_realm,
+                                       engine->verdict_service,
+                                       engine->verdict_mechanism, accepted,
+                                       engine->verdict_duration_us);
+    _clear_verdict (engine);
+    g_mutex_unlock (&engine->step_lock);
+}
+
+/* Adds the counters of all the engines of the process to the statistics */
+void
+gsignond_sasl_engine_add_statistics (GVariantBuilder *builder)
+{
+    g_variant_builder_add (builder, "{sv}", "LiveSessions",
+                           g_variant_new_uint32 (
+                               g_atomic_int_get (&live_sessions)));
+    g_mutex_lock (&expiry_stats_lock);
+    g_variant_builder_add (builder, "{sv}", "ExpiredSessions",
+                           g_variant_new_uint64 (expired_sessions));
+    g_variant_builder_add (builder, "{sv}", "ReclaimedBytes",
+                           g_variant_new_uint64 (reclaimed_bytes));
+    g_mutex_unlock (&expiry_stats_lock);
+}
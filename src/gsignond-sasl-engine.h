@@ -0,0 +1,200 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_ENGINE_H__
+#define __GSIGNOND_SASL_ENGINE_H__
+
+#include <gio/gio.h>
+#include <gsignond/gsignond-session-data.h>
+#include <gsignond/gsignond-signonui-data.h>
+
+#include "gsignond-sasl-mechanisms.h"
+#include "gsignond-sasl-security-layer.h"
+#include "gsignond-sasl-timer-wheel.h"
+
+G_BEGIN_DECLS
+
+/* idle timeout of the sessions that don't set "IdleTimeout", in seconds */
+#define GSIGNOND_SASL_ENGINE_DEFAULT_IDLE_TIMEOUT 300
+
+/**
+ * GSignondSaslEngine:
+ *
+ * Opaque structure holding one authorization sequence at a time, with
+ * nothing of GObject in it. #GSignondSaslPlugin is a wrapper around it.
+ */
+typedef struct _GSignondSaslEngine GSignondSaslEngine;
+
+/**
+ * GSignondSaslEngineStatus:
+ * @GSIGNOND_SASL_ENGINE_ERROR: the step failed, see @error of the result
+ * @GSIGNOND_SASL_ENGINE_RESPONSE: there is a response for the server, which
+ * is expected to issue another challenge
+ * @GSIGNOND_SASL_ENGINE_RESPONSE_FINAL: there is a response for the server
+ * and the sequence is over
+ * @GSIGNOND_SASL_ENGINE_USER_ACTION: the step is suspended until the user
+ * provides a credential, see gsignond_sasl_engine_user_action_finished()
+ *
+ * What a step of a #GSignondSaslEngine ended with.
+ */
+typedef enum {
+    GSIGNOND_SASL_ENGINE_ERROR = 0,
+    GSIGNOND_SASL_ENGINE_RESPONSE,
+    GSIGNOND_SASL_ENGINE_RESPONSE_FINAL,
+    GSIGNOND_SASL_ENGINE_USER_ACTION
+} GSignondSaslEngineStatus;
+
+/**
+ * GSignondSaslEngineResult:
+ * @status: what the step ended with
+ * @response_base64: the response for the server, base64 encoded
+ * ("ResponseBase64"), set with %GSIGNOND_SASL_ENGINE_RESPONSE and
+ * %GSIGNOND_SASL_ENGINE_RESPONSE_FINAL
+ * @mechanism: the mechanism chosen when the step started a session with
+ * "AUTO" ("Mechanism"), %NULL otherwise
+ * @initial_response: whether the response can go out with the
+ * authentication command ("InitialResponse")
+ * @timing_reported: whether the session data asked for "ReportTiming", in
+ * which case the next four fields are set
+ * @wall_time_us: "StepWallTimeUs"
+ * @cpu_time_us: "StepCpuTimeUs"
+ * @step_index: "StepIndex"
+ * @kdf_iterations: "KdfIterations"
+ * @refreshed: whether this is the final response of a refresh, in which
+ * case @refresh_saved_us is set
+ * @refresh_saved_us: "RefreshSavedUs"
+ * @user_input_key: with %GSIGNOND_SASL_ENGINE_USER_ACTION, the session data
+ * key of the credential the step waits for
+ * @user_action: with %GSIGNOND_SASL_ENGINE_USER_ACTION, the request to show
+ * to the user, as #GSignondPlugin::user-action-required would carry it
+ * @store_data: (allow-none): data to keep for the identity, as
+ * #GSignondPlugin::store would carry it
+ * @error: with %GSIGNOND_SASL_ENGINE_ERROR, the error, one of those issued
+ * via #GSignondPlugin::error
+ *
+ * The outcome of a step of a #GSignondSaslEngine, written into a structure
+ * of the caller. The names in quotes are the keys of the same values in
+ * the responses of #GSignondSaslPlugin. Release the content with
+ * gsignond_sasl_engine_result_clear().
+ */
+typedef struct {
+    GSignondSaslEngineStatus status;
+    gchar *response_base64;
+    const gchar *mechanism;
+    gboolean initial_response;
+    gboolean timing_reported;
+    guint64 wall_time_us;
+    guint64 cpu_time_us;
+    guint step_index;
+    guint kdf_iterations;
+    gboolean refreshed;
+    guint64 refresh_saved_us;
+    const gchar *user_input_key;
+    GSignondSignonuiData *user_action;
+    GSignondSessionData *store_data;
+    GError *error;
+} GSignondSaslEngineResult;
+
+GSignondSaslEngine *
+gsignond_sasl_engine_new (void);
+
+void
+gsignond_sasl_engine_free (GSignondSaslEngine *engine);
+
+gboolean
+gsignond_sasl_engine_is_initialized (GSignondSaslEngine *engine);
+
+gchar **
+gsignond_sasl_engine_get_mechanisms (GSignondSaslEngine *engine);
+
+guint
+gsignond_sasl_engine_get_idle_timeout (GSignondSaslEngine *engine);
+
+void
+gsignond_sasl_engine_set_idle_timeout (GSignondSaslEngine *engine,
+                                       guint idle_timeout);
+
+void
+gsignond_sasl_engine_set_idle_timer (GSignondSaslEngine *engine,
+                                     GSignondSaslTimerWheelEntry *timer);
+
+GSignondSaslEngineStatus
+gsignond_sasl_engine_step (GSignondSaslEngine *engine,
+                           GSignondSessionData *session_data,
+                           const gchar *mechanism,
+                           GCancellable *cancellable,
+                           GSignondSaslEngineResult *result);
+
+GSignondSaslEngineStatus
+gsignond_sasl_engine_user_action_finished (GSignondSaslEngine *engine,
+                                           GSignondSignonuiData *ui_data,
+                                           GSignondSaslEngineResult *result);
+
+GSignondSaslEngineStatus
+gsignond_sasl_engine_refresh (GSignondSaslEngine *engine,
+                              GSignondSessionData *session_data,
+                              GSignondSaslEngineResult *result);
+
+void
+gsignond_sasl_engine_result_clear (GSignondSaslEngineResult *result);
+
+void
+gsignond_sasl_engine_cancel (GSignondSaslEngine *engine);
+
+gboolean
+gsignond_sasl_engine_is_active (GSignondSaslEngine *engine);
+
+gboolean
+gsignond_sasl_engine_expire (GSignondSaslEngine *engine,
+                             GError **error);
+
+GBytes *
+gsignond_sasl_engine_export_session (GSignondSaslEngine *engine,
+                                     GError **error);
+
+gboolean
+gsignond_sasl_engine_import_session (GSignondSaslEngine *engine,
+                                     GBytes *state,
+                                     GSignondSessionData *session_data,
+                                     GError **error);
+
+GSignondSaslSecurityLayer *
+gsignond_sasl_engine_get_security_layer (GSignondSaslEngine *engine);
+
+void
+gsignond_sasl_engine_report_verdict (GSignondSaslEngine *engine,
+                                     gboolean accepted);
+
+gboolean
+gsignond_sasl_engine_check_session_data (GSignondSessionData *session_data,
+                                         GSignondSaslMechanism mechanism,
+                                         GError **error);
+
+void
+gsignond_sasl_engine_add_statistics (GVariantBuilder *builder);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_ENGINE_H__ */
@@ -0,0 +1,237 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "gsignond-sasl-kdf.h"
+
+/* HMAC (RFC 2104) split so that the padded key is hashed only once: @inner
+ * and @outer hold the states after the ipad and opad blocks */
+static void
+_hmac_init (GChecksumType digest_type,
+            const guchar *key,
+            gsize key_len,
+            GChecksum **inner,
+            GChecksum **outer)
+{
+    gsize digest_len = g_checksum_type_get_length (digest_type);
+    gsize block_len = digest_len > 32 ? 128 : 64;
+    guint8 pad[128];
+    guint8 hashed_key[64];
+    gsize len = sizeof (hashed_key);
+    gsize i;
+
+    if (key_len > block_len) {
+        GChecksum *checksum = g_checksum_new (digest_type);
+
+        g_checksum_update (checksum, key, key_len);
+        g_checksum_get_digest (checksum, hashed_key, &len);
+        g_checksum_free (checksum);
+        key = hashed_key;
+        key_len = len;
+    }
+
+    memset (pad, 0x36, block_len);
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    *inner = g_checksum_new (digest_type);
+    g_checksum_update (*inner, pad, block_len);
+
+    memset (pad, 0x5c, block_len);
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    *outer = g_checksum_new (digest_type);
+    g_checksum_update (*outer, pad, block_len);
+
+    memset (pad, 0, sizeof (pad));
+    memset (hashed_key, 0, sizeof (hashed_key));
+}
+
+/* Replaces @u (@digest_len bytes) with HMAC (K, @u), where @inner and
+ * @outer come from _hmac_init() and are left untouched */
+static void
+_hmac_block (GChecksum *inner,
+             GChecksum *outer,
+             guint8 *u,
+             gsize digest_len)
+{
+    GChecksum *checksum;
+    gsize len;
+
+    checksum = g_checksum_copy (inner);
+    g_checksum_update (checksum, u, digest_len);
+    len = digest_len;
+    g_checksum_get_digest (checksum, u, &len);
+    g_checksum_free (checksum);
+
+    checksum = g_checksum_copy (outer);
+    g_checksum_update (checksum, u, digest_len);
+    len = digest_len;
+    g_checksum_get_digest (checksum, u, &len);
+    g_checksum_free (checksum);
+}
+
+/*
+ * PBKDF2 (RFC 2898) with HMAC over @digest_type as the PRF, producing a
+ * single block of output (the digest length of @digest_type), which is what
+ * SCRAM's Hi() function needs.
+ *
+ * Unlike the implementation inside libgsasl, this one can be interrupted:
+ * @cancel_flag (if not NULL) is polled every GSIGNOND_SASL_KDF_CANCEL_INTERVAL
+ * iterations and the derivation is abandoned as soon as it becomes non-zero,
+ * and so is @check (if not NULL), which abandons it by returning FALSE.
+ *
+ * Returns: TRUE if @output has been filled, FALSE if the derivation was
+ * cancelled.
+ */
+static gboolean
+_pbkdf2 (GChecksumType digest_type,
+         const guchar *password,
+         gsize password_len,
+         const guchar *salt,
+         gsize salt_len,
+         guint iterations,
+         guint8 *output,
+         const volatile gint *cancel_flag,
+         GSignondSaslKdfCheck check,
+         gpointer user_data)
+{
+    static const guint8 block_index[4] = { 0, 0, 0, 1 };
+    gsize digest_len = g_checksum_type_get_length (digest_type);
+    guint8 u[64];
+    GChecksum *inner;
+    GChecksum *outer;
+    GChecksum *checksum;
+    gboolean completed = TRUE;
+    gsize len;
+    guint i, j;
+
+    g_return_val_if_fail (digest_len <= sizeof (u), FALSE);
+    g_return_val_if_fail (iterations > 0, FALSE);
+
+    /* the padded password is hashed once, and the states after it are
+     * copied for every iteration, saving a GHmac for each */
+    _hmac_init (digest_type, password, password_len, &inner, &outer);
+
+    /* U1 = PRF (P, S || INT (1)) */
+    checksum = g_checksum_copy (inner);
+    g_checksum_update (checksum, salt, salt_len);
+    g_checksum_update (checksum, block_index, sizeof (block_index));
+    len = digest_len;
+    g_checksum_get_digest (checksum, u, &len);
+    g_checksum_free (checksum);
+    checksum = g_checksum_copy (outer);
+    g_checksum_update (checksum, u, digest_len);
+    len = digest_len;
+    g_checksum_get_digest (checksum, u, &len);
+    g_checksum_free (checksum);
+    memcpy (output, u, digest_len);
+
+    /* Ui = PRF (P, Ui-1), T = U1 ^ U2 ^ ... ^ Uc */
+    for (i = 1; i < iterations; i++) {
+        if (i % GSIGNOND_SASL_KDF_CANCEL_INTERVAL == 0 &&
+            ((cancel_flag && g_atomic_int_get (cancel_flag)) ||
+             (check && !check (user_data)))) {
+            memset (output, 0, digest_len);
+            completed = FALSE;
+            break;
+        }
+        _hmac_block (inner, outer, u, digest_len);
+        for (j = 0; j < digest_len; j++)
+            output[j] ^= u[j];
+    }
+
+    g_checksum_free (inner);
+    g_checksum_free (outer);
+    memset (u, 0, sizeof (u));
+    return completed;
+}
+
+gboolean
+gsignond_sasl_pbkdf2 (GChecksumType digest_type,
+                      const guchar *password,
+                      gsize password_len,
+                      const guchar *salt,
+                      gsize salt_len,
+                      guint iterations,
+                      guint8 *output,
+                      const volatile gint *cancel_flag)
+{
+    return _pbkdf2 (digest_type, password, password_len, salt, salt_len,
+                    iterations, output, cancel_flag, NULL, NULL);
+}
+
+gboolean
+gsignond_sasl_pbkdf2_checked (GChecksumType digest_type,
+                              const guchar *password,
+                              gsize password_len,
+                              const guchar *salt,
+                              gsize salt_len,
+                              guint iterations,
+                              guint8 *output,
+                              GSignondSaslKdfCheck check,
+                              gpointer user_data)
+{
+    return _pbkdf2 (digest_type, password, password_len, salt, salt_len,
+                    iterations, output, NULL, check, user_data);
+}
+
+gchar *
+gsignond_sasl_kdf_hex_encode (const guint8 *data,
+                              gsize data_len)
+{
+    static const gchar hex[] = "0123456789abcdef";
+    gchar *str = g_malloc (data_len * 2 + 1);
+    gsize i;
+
+    for (i = 0; i < data_len; i++) {
+        str[2 * i] = hex[data[i] >> 4];
+        str[2 * i + 1] = hex[data[i] & 0x0f];
+    }
+    str[2 * data_len] = '\0';
+    return str;
+}
+
+/* Decodes exactly @data_len bytes from @hex; FALSE if it has another length
+ * or a character that isn't a hex digit */
+gboolean
+gsignond_sasl_kdf_hex_decode (const gchar *hex,
+                              guint8 *data,
+                              gsize data_len)
+{
+    gsize i;
+
+    if (strlen (hex) != data_len * 2)
+        return FALSE;
+    for (i = 0; i < data_len; i++) {
+        gint high = g_ascii_xdigit_value (hex[2 * i]);
+        gint low = g_ascii_xdigit_value (hex[2 * i + 1]);
+
+        if (high < 0 || low < 0)
+            return FALSE;
+        data[i] = (high << 4) | low;
+    }
+    return TRUE;
+}
@@ -0,0 +1,72 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_KDF_H__
+#define __GSIGNOND_SASL_KDF_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How many PBKDF2 iterations are run between checks of the cancel flag */
+#define GSIGNOND_SASL_KDF_CANCEL_INTERVAL 256
+
+/* Called between iterations by gsignond_sasl_pbkdf2_checked(); returning
+ * FALSE abandons the derivation */
+typedef gboolean (*GSignondSaslKdfCheck) (gpointer user_data);
+
+gboolean
+gsignond_sasl_pbkdf2 (GChecksumType digest_type,
+                      const guchar *password,
+                      gsize password_len,
+                      const guchar *salt,
+                      gsize salt_len,
+                      guint iterations,
+                      guint8 *output,
+                      const volatile gint *cancel_flag);
+
+gboolean
+gsignond_sasl_pbkdf2_checked (GChecksumType digest_type,
+                              const guchar *password,
+                              gsize password_len,
+                              const guchar *salt,
+                              gsize salt_len,
+                              guint iterations,
+                              guint8 *output,
+                              GSignondSaslKdfCheck check,
+                              gpointer user_data);
+
+gchar *
+gsignond_sasl_kdf_hex_encode (const guint8 *data,
+                              gsize data_len);
+
+gboolean
+gsignond_sasl_kdf_hex_decode (const gchar *hex,
+                              guint8 *data,
+                              gsize data_len);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_KDF_H__ */
@@ -0,0 +1,352 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Cache of keys derived from passwords (SCRAM salted passwords).
+ *
+ * Entries are identified by the hash type, username, salt and iteration
+ * count, and also remember a fingerprint of the password they were derived
+ * from, so that a changed password is never answered with a stale key. The
+ * fingerprint is an HMAC of the password and salt keyed with a key derived
+ * from that of gsignond_sasl_seal(): a plain hash of the password would let
+ * whoever reads the shared memory segment or the cache file test guesses
+ * at the cost of one hash each, rather than of the whole derivation. Keys
+ * found in the shared cache or the file of another process are thus only
+ * used if both share SSO_SASL_SEAL_KEY. The cache is an LRU of at
+ * most 64 entries by default, or SSO_SASL_KEY_CACHE_SIZE; 0 disables it.
+ * Evicted keys are wiped. Misses are looked up in the cache shared with
+ * the other plugin processes of the user, if there is one, and then in
+ * the key cache file, if there is one; new keys are stored in both.
+ */
+
+#include <string.h>
+
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-disk-cache.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-seal.h"
+#include "gsignond-sasl-shared-cache.h"
+
+#define DEFAULT_MAX_ENTRIES 64
+#define FINGERPRINT_SIZE GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE
+
+typedef struct {
+    gchar *id;
+    GList link;
+    guint8 fingerprint[FINGERPRINT_SIZE];
+    guint8 key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize key_len;
+} GSignondSaslKeyCacheEntry;
+
+static GMutex cache_lock;
+static gboolean cache_initialized = FALSE;
+static guint max_entries;
+/* id -> GSignondSaslKeyCacheEntry */
+static GHashTable *entries = NULL;
+/* most recently used first */
+static GQueue lru = G_QUEUE_INIT;
+
+static guint64 n_hits = 0;
+static guint64 n_misses = 0;
+
+static void
+_entry_free (gpointer data)
+{
+    GSignondSaslKeyCacheEntry *entry = data;
+
+    memset (entry->key, 0, sizeof (entry->key));
+    memset (entry->fingerprint, 0, sizeof (entry->fingerprint));
+    g_free (entry->id);
+    g_slice_free (GSignondSaslKeyCacheEntry, entry);
+}
+
+static void
+_init_locked (void)
+{
+    const gchar *value;
+
+    if (cache_initialized)
+        return;
+    value = g_getenv ("SSO_SASL_KEY_CACHE_SIZE");
+    max_entries = value ? (guint) MIN (g_ascii_strtoull (value, NULL, 10),
+                                       G_MAXUINT)
+                        : DEFAULT_MAX_ENTRIES;
+    entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                     _entry_free);
+    cache_initialized = TRUE;
+}
+
+/* Returns the id in hex, and stores it in @digest for the shared cache */
+static gchar *
+_entry_id (GChecksumType checksum_type,
+           const gchar *username,
+           const guchar *salt,
+           gsize salt_len,
+           guint iterations,
+           guint8 *digest)
+{
+    GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+    guint8 type = (guint8) checksum_type;
+    guint32 iterations_be = GUINT32_TO_BE (iterations);
+    gsize digest_len = GSIGNOND_SASL_SHARED_CACHE_ID_SIZE;
+    gchar *id;
+
+    g_checksum_update (checksum, &type, 1);
+    g_checksum_update (checksum, (const guchar *) username,
+                       strlen (username) + 1);
+    g_checksum_update (checksum, (const guchar *) &iterations_be,
+                       sizeof (iterations_be));
+    g_checksum_update (checksum, salt, salt_len);
+    g_checksum_get_digest (checksum, digest, &digest_len);
+    g_checksum_free (checksum);
+    id = gsignond_sasl_kdf_hex_encode (digest, digest_len);
+    return id;
+}
+
+static void
+_fingerprint (const gchar *password,
+              const guchar *salt,
+              gsize salt_len,
+              guint8 *fingerprint)
+{
+    guint8 fingerprint_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+    GHmac *hmac;
+    gsize len = FINGERPRINT_SIZE;
+
+    gsignond_sasl_seal_derive_subkey ("gsignond-sasl key cache fingerprint",
+                                      fingerprint_key);
+    hmac = g_hmac_new (G_CHECKSUM_SHA256, fingerprint_key,
+                       sizeof (fingerprint_key));
+    memset (fingerprint_key, 0, sizeof (fingerprint_key));
+    g_hmac_update (hmac, (const guchar *) password, strlen (password) + 1);
+    g_hmac_update (hmac, salt, salt_len);
+    g_hmac_get_digest (hmac, fingerprint, &len);
+    g_hmac_unref (hmac);
+}
+
+static void
+_remove_locked (GSignondSaslKeyCacheEntry *entry)
+{
+    g_queue_unlink (&lru, &entry->link);
+    g_hash_table_remove (entries, entry->id);
+}
+
+void
+gsignond_sasl_key_cache_set_size (guint size)
+{
+    g_mutex_lock (&cache_lock);
+    _init_locked ();
+    max_entries = size;
+    while (lru.length > max_entries)
+        _remove_locked (lru.tail->data);
+    g_mutex_unlock (&cache_lock);
+}
+
+/* Adds an entry to this process' cache, and to the shared one and the
+ * file if @shared_id is given */
+static void
+_insert (const gchar *id,
+         const guint8 *shared_id,
+         const guint8 *fingerprint,
+         const guint8 *key,
+         gsize key_len)
+{
+    GSignondSaslKeyCacheEntry *entry;
+
+    if (shared_id) {
+        gsignond_sasl_shared_cache_insert (shared_id, fingerprint, key,
+                                           key_len);
+        gsignond_sasl_disk_cache_insert (shared_id, fingerprint, key,
+                                         key_len);
+    }
+
+    entry = g_slice_new0 (GSignondSaslKeyCacheEntry);
+    entry->id = g_strdup (id);
+    entry->link.data = entry;
+    memcpy (entry->fingerprint, fingerprint, FINGERPRINT_SIZE);
+    memcpy (entry->key, key, key_len);
+    entry->key_len = key_len;
+
+    g_mutex_lock (&cache_lock);
+    _init_locked ();
+    if (max_entries == 0) {
+        g_mutex_unlock (&cache_lock);
+        _entry_free (entry);
+        return;
+    }
+    if (g_hash_table_contains (entries, entry->id))
+        _remove_locked (g_hash_table_lookup (entries, entry->id));
+    while (lru.length >= max_entries)
+        _remove_locked (lru.tail->data);
+    g_hash_table_insert (entries, entry->id, entry);
+    g_queue_push_head_link (&lru, &entry->link);
+    g_mutex_unlock (&cache_lock);
+}
+
+static gboolean
+_lookup (GChecksumType checksum_type,
+         const gchar *username,
+         const gchar *password,
+         const guchar *salt,
+         gsize salt_len,
+         guint iterations,
+         guint8 *key,
+         gsize key_len,
+         gboolean counted)
+{
+    GSignondSaslKeyCacheEntry *entry;
+    guint8 digest[GSIGNOND_SASL_SHARED_CACHE_ID_SIZE];
+    guint8 fingerprint[FINGERPRINT_SIZE];
+    gchar *id;
+    gboolean found = FALSE;
+
+    g_return_val_if_fail (username != NULL && password != NULL, FALSE);
+
+    id = _entry_id (checksum_type, username, salt, salt_len, iterations,
+                    digest);
+    _fingerprint (password, salt, salt_len, fingerprint);
+
+    g_mutex_lock (&cache_lock);
+    _init_locked ();
+    entry = g_hash_table_lookup (entries, id);
+    if (entry && entry->key_len == key_len &&
+        memcmp (entry->fingerprint, fingerprint, FINGERPRINT_SIZE) == 0) {
+        memcpy (key, entry->key, key_len);
+        g_queue_unlink (&lru, &entry->link);
+        g_queue_push_head_link (&lru, &entry->link);
+        found = TRUE;
+    }
+    g_mutex_unlock (&cache_lock);
+
+    if (!found) {
+        found = gsignond_sasl_shared_cache_lookup (digest, fingerprint, key,
+                                                   key_len);
+        if (!found) {
+            found = gsignond_sasl_disk_cache_lookup (digest, fingerprint,
+                                                     key, key_len);
+            if (found)
+                gsignond_sasl_shared_cache_insert (digest, fingerprint, key,
+                                                   key_len);
+        }
+        /* kept here too, as the next lookup is likely to be for it */
+        if (found)
+            _insert (id, NULL, fingerprint, key, key_len);
+    }
+    if (counted) {
+        g_mutex_lock (&cache_lock);
+        if (found)
+            n_hits++;
+        else
+            n_misses++;
+        g_mutex_unlock (&cache_lock);
+    }
+
+    memset (fingerprint, 0, sizeof (fingerprint));
+    g_free (id);
+    return found;
+}
+
+gboolean
+gsignond_sasl_key_cache_lookup (GChecksumType checksum_type,
+                                const gchar *username,
+                                const gchar *password,
+                                const guchar *salt,
+                                gsize salt_len,
+                                guint iterations,
+                                guint8 *key,
+                                gsize key_len)
+{
+    return _lookup (checksum_type, username, password, salt, salt_len,
+                    iterations, key, key_len, TRUE);
+}
+
+/* Same as gsignond_sasl_key_cache_lookup(), but left out of the hits and
+ * misses, for callers that only want to know whether a key is there */
+gboolean
+gsignond_sasl_key_cache_probe (GChecksumType checksum_type,
+                               const gchar *username,
+                               const gchar *password,
+                               const guchar *salt,
+                               gsize salt_len,
+                               guint iterations,
+                               guint8 *key,
+                               gsize key_len)
+{
+    return _lookup (checksum_type, username, password, salt, salt_len,
+                    iterations, key, key_len, FALSE);
+}
+
+void
+gsignond_sasl_key_cache_insert (GChecksumType checksum_type,
+                                const gchar *username,
+                                const gchar *password,
+                                const guchar *salt,
+                                gsize salt_len,
+                                guint iterations,
+                                const guint8 *key,
+                                gsize key_len)
+{
+    guint8 digest[GSIGNOND_SASL_SHARED_CACHE_ID_SIZE];
+    guint8 fingerprint[FINGERPRINT_SIZE];
+    gchar *id;
+
+    g_return_if_fail (username != NULL && password != NULL);
+    g_return_if_fail (key_len <= GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE);
+
+    id = _entry_id (checksum_type, username, salt, salt_len, iterations,
+                    digest);
+    _fingerprint (password, salt, salt_len, fingerprint);
+    _insert (id, digest, fingerprint, key, key_len);
+    memset (fingerprint, 0, sizeof (fingerprint));
+    g_free (id);
+}
+
+void
+gsignond_sasl_key_cache_clear (void)
+{
+    g_mutex_lock (&cache_lock);
+    _init_locked ();
+    g_hash_table_remove_all (entries);
+    g_queue_init (&lru);
+    n_hits = 0;
+    n_misses = 0;
+    g_mutex_unlock (&cache_lock);
+}
+
+void
+gsignond_sasl_key_cache_add_statistics (GVariantBuilder *builder)
+{
+    g_mutex_lock (&cache_lock);
+    _init_locked ();
+    g_variant_builder_add (builder, "{sv}", "KeyCacheEntries",
+                           g_variant_new_uint32 (lru.length));
+    g_variant_builder_add (builder, "{sv}", "KeyCacheHits",
+                           g_variant_new_uint64 (n_hits));
+    g_variant_builder_add (builder, "{sv}", "KeyCacheMisses",
+                           g_variant_new_uint64 (n_misses));
+    g_mutex_unlock (&cache_lock);
+    gsignond_sasl_shared_cache_add_statistics (builder);
+    gsignond_sasl_disk_cache_add_statistics (builder);
+}
@@ -0,0 +1,77 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_KEY_CACHE_H__
+#define __GSIGNOND_SASL_KEY_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* large enough for a SHA-256 derived key */
+#define GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE 32
+
+void
+gsignond_sasl_key_cache_set_size (guint size);
+
+gboolean
+gsignond_sasl_key_cache_lookup (GChecksumType checksum_type,
+                                const gchar *username,
+                                const gchar *password,
+                                const guchar *salt,
+                                gsize salt_len,
+                                guint iterations,
+                                guint8 *key,
+                                gsize key_len);
+
+gboolean
+gsignond_sasl_key_cache_probe (GChecksumType checksum_type,
+                               const gchar *username,
+                               const gchar *password,
+                               const guchar *salt,
+                               gsize salt_len,
+                               guint iterations,
+                               guint8 *key,
+                               gsize key_len);
+
+void
+gsignond_sasl_key_cache_insert (GChecksumType checksum_type,
+                                const gchar *username,
+                                const gchar *password,
+                                const guchar *salt,
+                                gsize salt_len,
+                                guint iterations,
+                                const guint8 *key,
+                                gsize key_len);
+
+void
+gsignond_sasl_key_cache_clear (void);
+
+void
+gsignond_sasl_key_cache_add_statistics (GVariantBuilder *builder);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_KEY_CACHE_H__ */
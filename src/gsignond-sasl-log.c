@@ -0,0 +1,194 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Gated logging for the plugin, on top of the DBG, INFO, WARN and ERR
+ * macros of gsignond-log.h.
+ *
+ * Every message has a level; levels above GSIGNOND_SASL_LOG_MAX_LEVEL are
+ * compiled out, and levels above the run-time level (SSO_SASL_LOG_LEVEL
+ * environment variable, "warning" by default) are skipped before anything
+ * is formatted.
+ *
+ * Messages that do get through are rate-limited by call site, whatever
+ * their arguments: at most LOG_BURST messages of a site are written per
+ * LOG_INTERVAL, and the number of suppressed ones is reported once the
+ * interval is over, from a timeout in the default main context, or on
+ * gsignond_sasl_log_flush().
+ */
+
+#include "gsignond-sasl-log.h"
+
+#define LOG_INTERVAL G_TIME_SPAN_SECOND
+#define LOG_BURST 5
+
+typedef struct {
+    GSignondSaslLogSite *site;
+    guint suppressed;
+} GSignondSaslLogSummary;
+
+gint gsignond_sasl_log_level = GSIGNOND_SASL_LOG_WARNING;
+
+static GMutex log_lock;
+/* sites with suppressed messages not yet reported */
+static GSList *pending_sites = NULL;
+static guint flush_source_id = 0;
+
+static const gchar *level_names[] = {
+    [GSIGNOND_SASL_LOG_NONE] = "none",
+    [GSIGNOND_SASL_LOG_ERROR] = "error",
+    [GSIGNOND_SASL_LOG_WARNING] = "warning",
+    [GSIGNOND_SASL_LOG_INFO] = "info",
+    [GSIGNOND_SASL_LOG_DEBUG] = "debug",
+    [GSIGNOND_SASL_LOG_TRACE] = "trace",
+};
+
+static void
+_write_summary (GSignondSaslLogSite *site,
+                guint suppressed)
+{
+    GSIGNOND_SASL_LOG_WRITE (site->level,
+                             "%s: \"%s\" (repeated %u more times)",
+                             site->location, site->format, suppressed);
+}
+
+static gboolean
+_on_flush_timeout (gpointer user_data)
+{
+    g_mutex_lock (&log_lock);
+    flush_source_id = 0;
+    g_mutex_unlock (&log_lock);
+    gsignond_sasl_log_flush ();
+    return G_SOURCE_REMOVE;
+}
+
+static GSignondSaslLogLevel
+_level_from_string (const gchar *value)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (level_names); i++)
+        if (g_ascii_strcasecmp (value, level_names[i]) == 0)
+            return i;
+    if (g_ascii_isdigit (value[0]))
+        return (GSignondSaslLogLevel) MIN (g_ascii_strtoull (value, NULL, 10),
+                                           GSIGNOND_SASL_LOG_TRACE);
+    return GSIGNOND_SASL_LOG_WARNING;
+}
+
+void
+gsignond_sasl_log_init (void)
+{
+    const gchar *value = g_getenv ("SSO_SASL_LOG_LEVEL");
+
+    if (value)
+        gsignond_sasl_log_set_level (_level_from_string (value));
+}
+
+void
+gsignond_sasl_log_set_level (GSignondSaslLogLevel level)
+{
+    g_atomic_int_set (&gsignond_sasl_log_level, level);
+}
+
+GSignondSaslLogLevel
+gsignond_sasl_log_get_level (void)
+{
+    return g_atomic_int_get (&gsignond_sasl_log_level);
+}
+
+/* Called by GSIGNOND_SASL_LOG() before formatting anything; returns TRUE if
+ * the message of @site may be written */
+gboolean
+gsignond_sasl_log_admit (GSignondSaslLogSite *site)
+{
+    gint64 now = g_get_monotonic_time ();
+    guint suppressed = 0;
+    gboolean admitted;
+
+    g_mutex_lock (&log_lock);
+    if (now - site->window_start >= LOG_INTERVAL) {
+        suppressed = site->suppressed;
+        site->window_start = now;
+        site->count = 0;
+        site->suppressed = 0;
+    }
+    admitted = ++site->count <= LOG_BURST;
+    if (!admitted && site->suppressed++ == 0) {
+        if (!site->pending) {
+            site->pending = TRUE;
+            pending_sites = g_slist_prepend (pending_sites, site);
+        }
+        /* reported even if the site is never used again */
+        if (flush_source_id == 0)
+            flush_source_id = g_timeout_add (LOG_INTERVAL / G_TIME_SPAN_MILLISECOND,
+                                             _on_flush_timeout, NULL);
+    }
+    g_mutex_unlock (&log_lock);
+
+    if (suppressed > 0)
+        _write_summary (site, suppressed);
+    return admitted;
+}
+
+/* Writes out how many times the messages of each call site were suppressed
+ * since the last report */
+void
+gsignond_sasl_log_flush (void)
+{
+    GSList *sites;
+    GSList *item;
+    GArray *summaries = g_array_new (FALSE, FALSE,
+                                     sizeof (GSignondSaslLogSummary));
+    guint i;
+
+    g_mutex_lock (&log_lock);
+    sites = pending_sites;
+    pending_sites = NULL;
+    for (item = sites; item; item = item->next) {
+        GSignondSaslLogSite *site = item->data;
+        GSignondSaslLogSummary summary = { site, site->suppressed };
+
+        if (summary.suppressed > 0)
+            g_array_append_val (summaries, summary);
+        site->suppressed = 0;
+        site->pending = FALSE;
+    }
+    if (flush_source_id != 0) {
+        g_source_remove (flush_source_id);
+        flush_source_id = 0;
+    }
+    g_mutex_unlock (&log_lock);
+    g_slist_free (sites);
+
+    /* written without the lock, the site may be logging meanwhile */
+    for (i = 0; i < summaries->len; i++) {
+        GSignondSaslLogSummary *summary =
+            &g_array_index (summaries, GSignondSaslLogSummary, i);
+
+        _write_summary (summary->site, summary->suppressed);
+    }
+    g_array_free (summaries, TRUE);
+}
@@ -0,0 +1,117 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_LOG_H__
+#define __GSIGNOND_SASL_LOG_H__
+
+#include <glib.h>
+#include <gsignond/gsignond-log.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    GSIGNOND_SASL_LOG_NONE = 0,
+    GSIGNOND_SASL_LOG_ERROR,
+    GSIGNOND_SASL_LOG_WARNING,
+    GSIGNOND_SASL_LOG_INFO,
+    GSIGNOND_SASL_LOG_DEBUG,
+    GSIGNOND_SASL_LOG_TRACE
+} GSignondSaslLogLevel;
+
+/* Messages above this level are compiled out entirely; override with
+ * -DGSIGNOND_SASL_LOG_MAX_LEVEL=<n> in CPPFLAGS */
+#ifndef GSIGNOND_SASL_LOG_MAX_LEVEL
+#define GSIGNOND_SASL_LOG_MAX_LEVEL GSIGNOND_SASL_LOG_DEBUG
+#endif
+
+/* the run-time level; read directly by GSIGNOND_SASL_LOG() */
+extern gint gsignond_sasl_log_level;
+
+/* Rate-limiting state of one GSIGNOND_SASL_LOG() call site */
+typedef struct {
+    const gchar *location;
+    const gchar *format;
+    GSignondSaslLogLevel level;
+    gint64 window_start;
+    guint count;
+    guint suppressed;
+    gboolean pending;
+} GSignondSaslLogSite;
+
+/* Writes a message with the gsignond-log.h macro of @level */
+#define GSIGNOND_SASL_LOG_WRITE(level, ...) \
+    G_STMT_START { \
+        switch (level) { \
+            case GSIGNOND_SASL_LOG_ERROR: \
+                ERR (__VA_ARGS__); \
+                break; \
+            case GSIGNOND_SASL_LOG_WARNING: \
+                WARN (__VA_ARGS__); \
+                break; \
+            case GSIGNOND_SASL_LOG_INFO: \
+                INFO (__VA_ARGS__); \
+                break; \
+            default: \
+                DBG (__VA_ARGS__); \
+                break; \
+        } \
+    } G_STMT_END
+
+#define _GSIGNOND_SASL_LOG_FORMAT(...) _GSIGNOND_SASL_LOG_FIRST (__VA_ARGS__, 0)
+#define _GSIGNOND_SASL_LOG_FIRST(format, ...) format
+
+/* A message that is disabled at run time costs one comparison; the
+ * arguments are not evaluated and nothing is formatted. Enabled ones are
+ * rate-limited per call site before they are formatted. */
+#define GSIGNOND_SASL_LOG(level, ...) \
+    G_STMT_START { \
+        if ((level) <= GSIGNOND_SASL_LOG_MAX_LEVEL && \
+            G_UNLIKELY ((gint) (level) <= gsignond_sasl_log_level)) { \
+            static GSignondSaslLogSite _gsignond_sasl_log_site = { \
+                G_STRLOC, _GSIGNOND_SASL_LOG_FORMAT (__VA_ARGS__), (level) \
+            }; \
+            if (gsignond_sasl_log_admit (&_gsignond_sasl_log_site)) \
+                GSIGNOND_SASL_LOG_WRITE ((level), __VA_ARGS__); \
+        } \
+    } G_STMT_END
+
+void
+gsignond_sasl_log_init (void);
+
+void
+gsignond_sasl_log_set_level (GSignondSaslLogLevel level);
+
+GSignondSaslLogLevel
+gsignond_sasl_log_get_level (void);
+
+gboolean
+gsignond_sasl_log_admit (GSignondSaslLogSite *site);
+
+void
+gsignond_sasl_log_flush (void);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_LOG_H__ */
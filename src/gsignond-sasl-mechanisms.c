@@ -0,0 +1,396 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gsignond/gsignond-error.h>
+#include <gsignond/gsignond-session-data.h>
+
+#include "gsignond-sasl-mechanisms.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-outcomes.h"
+/* perfect hash of the mechanism names, generated by gperf */
+#include "gsignond-sasl-mechanism-names.h"
+
+#define MAX_REQUIREMENTS 4
+
+/* estimated costs, in milliseconds, used when choosing a mechanism
+ * automatically: a round trip to the server costs more than deriving a
+ * SCRAM key locally */
+#define ROUND_TRIP_COST 10
+#define KDF_COST 5
+
+/* For each mechanism: the session data keys it can't do without
+ * (alternatives are separated with '|', any one of them is enough; a leading
+ * '?' means that the plugin can ask the user for it instead), its security
+ * tier for automatic selection (higher is stronger, 0 means it is never
+ * chosen automatically, because it depends on credentials outside the
+ * session data or, like NTLM, is obsolete), the number of round trips it
+ * takes, whether the client derives a key from the password, whether the
+ * client speaks first, so that its first message can go out with the
+ * authentication command (RFC 4422 section 4, "initial response"), whether
+ * the plugin implements it itself rather than through libgsasl, and whether
+ * the client verifies the server, so that a completed exchange means the
+ * server accepted the client. */
+typedef struct {
+    const gchar *name;
+    const gchar *required[MAX_REQUIREMENTS];
+    guint tier;
+    guint round_trips;
+    gboolean kdf;
+    gboolean client_first;
+    gboolean native;
+    gboolean mutual;
+} GSignondSaslMechanismInfo;
+
+static const GSignondSaslMechanismInfo mechanisms[GSIGNOND_SASL_N_MECHANISMS] = {
+    [GSIGNOND_SASL_MECHANISM_ANONYMOUS] = {
+        "ANONYMOUS", { "AnonymousToken" }, 1, 1, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_EXTERNAL] = {
+        "EXTERNAL", { NULL }, 0, 1, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_PLAIN] = {
+        "PLAIN", { "UserName", "?Secret" }, 3, 1, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_LOGIN] = {
+        "LOGIN", { "UserName", "?Secret" }, 3, 2, FALSE, FALSE, FALSE, FALSE },
+    /* over TLS, which is how PLAIN is used, the obsolete hash mechanisms
+     * protect nothing more and their stored secrets are weaker */
+    [GSIGNOND_SASL_MECHANISM_CRAM_MD5] = {
+        "CRAM-MD5", { "UserName", "?Secret" }, 2, 1, FALSE, FALSE, FALSE,
+        FALSE },
+    [GSIGNOND_SASL_MECHANISM_DIGEST_MD5] = {
+        "DIGEST-MD5", { "UserName", "?Secret|DigestMd5HashedPassword",
+                        "Service", "Hostname" }, 2, 2, FALSE, FALSE, FALSE,
+        TRUE },
+    [GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1] = {
+        "SCRAM-SHA-1", { "UserName", "?Secret|ScramSaltedPassword" },
+        4, 2, TRUE, TRUE, TRUE, TRUE },
+    [GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1_PLUS] = {
+        "SCRAM-SHA-1-PLUS", { "UserName", "?Secret|ScramSaltedPassword",
+                              "CbTlsUnique" }, 6, 2, TRUE, TRUE, TRUE, TRUE },
+    [GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256] = {
+        "SCRAM-SHA-256", { "UserName", "?Secret|ScramSaltedPassword" },
+        5, 2, TRUE, TRUE, TRUE, TRUE },
+    [GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256_PLUS] = {
+        "SCRAM-SHA-256-PLUS", { "UserName", "?Secret|ScramSaltedPassword",
+                                "CbTlsUnique" }, 7, 2, TRUE, TRUE, TRUE,
+        TRUE },
+    [GSIGNOND_SASL_MECHANISM_SECURID] = {
+        "SECURID", { "UserName", "?Passcode" }, 4, 1, FALSE, TRUE, FALSE,
+        FALSE },
+    [GSIGNOND_SASL_MECHANISM_NTLM] = {
+        "NTLM", { "UserName", "?Secret" }, 0, 2, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_GSSAPI] = {
+        "GSSAPI", { "Service", "Hostname" }, 0, 3, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_GS2_KRB5] = {
+        "GS2-KRB5", { "Service", "Hostname" }, 0, 2, FALSE, TRUE, FALSE,
+        FALSE },
+    [GSIGNOND_SASL_MECHANISM_SAML20] = {
+        "SAML20", { NULL }, 0, 2, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_OPENID20] = {
+        "OPENID20", { NULL }, 0, 2, FALSE, TRUE, FALSE, FALSE },
+    [GSIGNOND_SASL_MECHANISM_OTHER] = {
+        "OTHER", { NULL }, 0, 0, FALSE, FALSE, FALSE, FALSE },
+};
+
+/* Bit mask of the mechanisms picked with --with-mechanisms, one bit per
+ * GSignondSaslMechanism; GSIGNOND_SASL_MECHANISM_OTHER is only there when
+ * the selection wasn't restricted */
+#ifndef WITH_MECHANISMS
+#define WITH_MECHANISMS ((1 << GSIGNOND_SASL_N_MECHANISMS) - 1)
+#endif
+
+/* Called once per step and for every name a server offers, so it hashes
+ * the name instead of comparing it with each known one */
+GSignondSaslMechanism
+gsignond_sasl_mechanism_from_name (const gchar *name)
+{
+    const struct _GSignondSaslMechanismName *entry;
+
+    if (name == NULL)
+        return GSIGNOND_SASL_MECHANISM_OTHER;
+    entry = _gsignond_sasl_mechanism_lookup (name, strlen (name));
+    return entry ? entry->mechanism : GSIGNOND_SASL_MECHANISM_OTHER;
+}
+
+const gchar *
+gsignond_sasl_mechanism_get_name (GSignondSaslMechanism mechanism)
+{
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, NULL);
+
+    return mechanisms[mechanism].name;
+}
+
+/* Whether the plugin was built with @mechanism, see --with-mechanisms */
+gboolean
+gsignond_sasl_mechanism_is_enabled (GSignondSaslMechanism mechanism)
+{
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    return (WITH_MECHANISMS & (1 << mechanism)) != 0;
+}
+
+gboolean
+gsignond_sasl_mechanism_is_native (GSignondSaslMechanism mechanism)
+{
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    return mechanisms[mechanism].native;
+}
+
+gboolean
+gsignond_sasl_mechanism_is_client_first (GSignondSaslMechanism mechanism)
+{
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    return mechanisms[mechanism].client_first;
+}
+
+gboolean
+gsignond_sasl_mechanism_verifies_server (GSignondSaslMechanism mechanism)
+{
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    return mechanisms[mechanism].mutual;
+}
+
+static gboolean
+_requirement_met (const gchar *requirement,
+                  GSignondDictionary *session_data,
+                  gboolean user_input)
+{
+    gchar **alternatives;
+    gboolean met = FALSE;
+    gchar **key;
+
+    if (requirement[0] == '?') {
+        if (user_input)
+            return TRUE;
+        requirement++;
+    }
+    alternatives = g_strsplit (requirement, "|", -1);
+    for (key = alternatives; *key && !met; key++)
+        met = gsignond_dictionary_get (session_data, *key) != NULL;
+    g_strfreev (alternatives);
+    return met;
+}
+
+/* Checks that @session_data has everything @mechanism needs, so that a
+ * session doesn't fail halfway, after a round trip to the server.
+ * @user_input tells whether the secrets may instead be asked from the user
+ * when they are needed. */
+gboolean
+gsignond_sasl_mechanism_check_requirements (GSignondSaslMechanism mechanism,
+                                            GSignondDictionary *session_data,
+                                            gboolean user_input,
+                                            GError **error)
+{
+    const gchar *const *required;
+    GString *missing = NULL;
+    guint i;
+
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    required = mechanisms[mechanism].required;
+    for (i = 0; i < MAX_REQUIREMENTS && required[i]; i++) {
+        gchar **alternatives;
+        gchar *text;
+
+        if (_requirement_met (required[i], session_data, user_input))
+            continue;
+        if (missing)
+            g_string_append (missing, ", ");
+        else
+            missing = g_string_new (NULL);
+        alternatives = g_strsplit (required[i] + (required[i][0] == '?'),
+                                   "|", -1);
+        text = g_strjoinv (" or ", alternatives);
+        g_string_append (missing, text);
+        g_free (text);
+        g_strfreev (alternatives);
+    }
+    if (!missing)
+        return TRUE;
+
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                 "%s needs session data that is missing: %s",
+                 mechanisms[mechanism].name, missing->str);
+    g_string_free (missing, TRUE);
+    return FALSE;
+}
+
+/* Whether the SCRAM key of @mechanism for "ScramSalt" and
+ * "ScramIterations" is in the key cache already */
+static gboolean
+_key_cached (GSignondSaslMechanism mechanism,
+             GSignondDictionary *session_data)
+{
+    GChecksumType checksum_type = G_CHECKSUM_SHA1;
+    guint8 key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    const gchar *salt_base64;
+    const gchar *secret;
+    const gchar *username;
+    char *prepped_secret = NULL;
+    guint32 iterations = 0;
+    guchar *salt;
+    gsize salt_len;
+    gboolean cached;
+
+    if (mechanism == GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256 ||
+        mechanism == GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256_PLUS)
+        checksum_type = G_CHECKSUM_SHA256;
+    salt_base64 = gsignond_dictionary_get_string (session_data, "ScramSalt");
+    secret = gsignond_session_data_get_secret (session_data);
+    if (salt_base64 == NULL || secret == NULL ||
+        !gsignond_dictionary_get_uint32 (session_data, "ScramIterations",
+                                         &iterations) ||
+        gsasl_saslprep (secret, GSASL_ALLOW_UNASSIGNED, &prepped_secret,
+                        NULL) != GSASL_OK)
+        return FALSE;
+
+    username = gsignond_session_data_get_username (session_data);
+    salt = g_base64_decode (salt_base64, &salt_len);
+    cached = gsignond_sasl_key_cache_probe (
+        checksum_type, username ? username : "", prepped_secret, salt,
+        salt_len, iterations, key, g_checksum_type_get_length (checksum_type));
+    memset (key, 0, sizeof (key));
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    free (prepped_secret);
+    g_free (salt);
+    return cached;
+}
+
+/* The time the last successful use of @mechanism against the server took,
+ * or an estimate from its round trips if there is none. A key derivation
+ * is added unless the key is given or cached. */
+static guint
+_mechanism_cost (GSignondSaslMechanism mechanism,
+                 GSignondDictionary *session_data)
+{
+    const GSignondSaslMechanismInfo *info = &mechanisms[mechanism];
+    GSignondSaslOutcome outcome;
+    guint cost = info->round_trips * ROUND_TRIP_COST;
+
+    if (gsignond_sasl_outcomes_lookup (
+            gsignond_dictionary_get_string (session_data, "Hostname"),
+            gsignond_dictionary_get_string (session_data, "Realm"),
+            gsignond_dictionary_get_string (session_data, "Service"),
+            mechanism, &outcome) &&
+        outcome.last_succeeded && outcome.last_duration_us > 0)
+        cost = MAX (MIN (outcome.last_duration_us / 1000, G_MAXUINT / 2), 1);
+    if (info->kdf &&
+        !gsignond_dictionary_get (session_data, "ScramSaltedPassword") &&
+        !_key_cached (mechanism, session_data))
+        cost += KDF_COST;
+    return cost;
+}
+
+/* Whether @mechanism failed the last time it was used against the server */
+static gboolean
+_known_to_fail (GSignondSaslMechanism mechanism,
+                GSignondDictionary *session_data)
+{
+    GSignondSaslOutcome outcome;
+
+    return gsignond_sasl_outcomes_lookup (
+               gsignond_dictionary_get_string (session_data, "Hostname"),
+               gsignond_dictionary_get_string (session_data, "Realm"),
+               gsignond_dictionary_get_string (session_data, "Service"),
+               mechanism, &outcome) &&
+           !outcome.last_succeeded;
+}
+
+/* Picks the mechanism to use among those offered by the server (separated
+ * with spaces or commas, as servers advertise them): the ones that libgsasl
+ * supports, whose required data is present and that didn't just fail against
+ * the same server are ranked by security tier first, then by cost. As each
+ * SCRAM variant has a tier of its own, the cost only decides between
+ * mechanisms of equal strength, such as SCRAM-SHA-1 and SECURID.
+ * libgsasl's own suggestion breaks ties. If "InitialResponse" is set in
+ * @session_data, only mechanisms where the client speaks first qualify. */
+const gchar *
+gsignond_sasl_mechanism_select (Gsasl *context,
+                                const gchar *offered,
+                                GSignondDictionary *session_data,
+                                GError **error)
+{
+    gchar **names;
+    gchar *normalized;
+    const gchar *suggested;
+    GSignondSaslMechanism best = GSIGNOND_SASL_MECHANISM_OTHER;
+    guint best_cost = G_MAXUINT;
+    gboolean initial_response = FALSE;
+    guint i;
+
+    g_return_val_if_fail (context != NULL, NULL);
+
+    gsignond_dictionary_get_boolean (session_data, "InitialResponse",
+                                     &initial_response);
+
+    names = g_strsplit_set (offered ? offered : "", " \t,", -1);
+    normalized = g_strjoinv (" ", names);
+    suggested = gsasl_client_suggest_mechanism (context, normalized);
+
+    for (i = 0; names[i]; i++) {
+        GSignondSaslMechanism mechanism;
+        const GSignondSaslMechanismInfo *info;
+        guint cost;
+
+        mechanism = gsignond_sasl_mechanism_from_name (names[i]);
+        info = &mechanisms[mechanism];
+        if (info->tier == 0 ||
+            !gsignond_sasl_mechanism_is_enabled (mechanism) ||
+            (initial_response && !info->client_first) ||
+            !(info->native || gsasl_client_support_p (context, info->name)) ||
+            !gsignond_sasl_mechanism_check_requirements (mechanism,
+                                                         session_data, FALSE,
+                                                         NULL) ||
+            _known_to_fail (mechanism, session_data))
+            continue;
+        cost = _mechanism_cost (mechanism, session_data);
+        if (best == GSIGNOND_SASL_MECHANISM_OTHER ||
+            info->tier > mechanisms[best].tier ||
+            (info->tier == mechanisms[best].tier &&
+             (cost < best_cost ||
+              (cost == best_cost &&
+               g_strcmp0 (info->name, suggested) == 0)))) {
+            best = mechanism;
+            best_cost = cost;
+        }
+    }
+    g_free (normalized);
+    g_strfreev (names);
+
+    if (best == GSIGNOND_SASL_MECHANISM_OTHER) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                     "None of the mechanisms offered by the server can be "
+                     "used with the given session data");
+        return NULL;
+    }
+    return mechanisms[best].name;
+}
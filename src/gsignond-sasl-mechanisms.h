@@ -0,0 +1,92 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_MECHANISMS_H__
+#define __GSIGNOND_SASL_MECHANISMS_H__
+
+#include <glib.h>
+#include <gsasl.h>
+#include <gsignond/gsignond-dictionary.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    GSIGNOND_SASL_MECHANISM_ANONYMOUS = 0,
+    GSIGNOND_SASL_MECHANISM_EXTERNAL,
+    GSIGNOND_SASL_MECHANISM_PLAIN,
+    GSIGNOND_SASL_MECHANISM_LOGIN,
+    GSIGNOND_SASL_MECHANISM_CRAM_MD5,
+    GSIGNOND_SASL_MECHANISM_DIGEST_MD5,
+    GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1,
+    GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1_PLUS,
+    GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256,
+    GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256_PLUS,
+    GSIGNOND_SASL_MECHANISM_SECURID,
+    GSIGNOND_SASL_MECHANISM_NTLM,
+    GSIGNOND_SASL_MECHANISM_GSSAPI,
+    GSIGNOND_SASL_MECHANISM_GS2_KRB5,
+    GSIGNOND_SASL_MECHANISM_SAML20,
+    GSIGNOND_SASL_MECHANISM_OPENID20,
+    /* any mechanism not listed above */
+    GSIGNOND_SASL_MECHANISM_OTHER,
+    GSIGNOND_SASL_N_MECHANISMS
+} GSignondSaslMechanism;
+
+/* mechanism name that makes the plugin choose from "ServerMechanisms" */
+#define GSIGNOND_SASL_MECHANISM_AUTO_NAME "AUTO"
+
+GSignondSaslMechanism
+gsignond_sasl_mechanism_from_name (const gchar *name);
+
+const gchar *
+gsignond_sasl_mechanism_get_name (GSignondSaslMechanism mechanism);
+
+gboolean
+gsignond_sasl_mechanism_is_enabled (GSignondSaslMechanism mechanism);
+
+gboolean
+gsignond_sasl_mechanism_is_native (GSignondSaslMechanism mechanism);
+
+gboolean
+gsignond_sasl_mechanism_is_client_first (GSignondSaslMechanism mechanism);
+
+gboolean
+gsignond_sasl_mechanism_verifies_server (GSignondSaslMechanism mechanism);
+
+gboolean
+gsignond_sasl_mechanism_check_requirements (GSignondSaslMechanism mechanism,
+                                            GSignondDictionary *session_data,
+                                            gboolean user_input,
+                                            GError **error);
+
+const gchar *
+gsignond_sasl_mechanism_select (Gsasl *context,
+                                const gchar *offered,
+                                GSignondDictionary *session_data,
+                                GError **error);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_MECHANISMS_H__ */
@@ -0,0 +1,263 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Outcomes of the mechanisms used against each server.
+ *
+ * Servers are identified by the Hostname, Realm and Service session data.
+ * For each of them the cache remembers how often each mechanism succeeded
+ * and failed, and how long its last handshake took, so that automatic
+ * mechanism selection doesn't retry a mechanism the server just rejected.
+ * Outcomes are forgotten after a TTL (an hour by default, or
+ * SSO_SASL_OUTCOME_TTL seconds), and at most a fixed number of servers are
+ * remembered (256, or SSO_SASL_OUTCOME_MAX_SERVERS), the least recently used
+ * being dropped first.
+ */
+
+#include <string.h>
+
+#include "gsignond-sasl-outcomes.h"
+
+#define DEFAULT_MAX_SERVERS 256
+#define DEFAULT_TTL 3600
+
+typedef struct {
+    gchar *key;
+    GList link;
+    GSignondSaslOutcome outcomes[GSIGNOND_SASL_N_MECHANISMS];
+} GSignondSaslServerEntry;
+
+static GMutex outcomes_lock;
+static gboolean outcomes_initialized = FALSE;
+static guint max_servers;
+static gint64 ttl;
+/* key -> GSignondSaslServerEntry */
+static GHashTable *servers = NULL;
+/* most recently used first */
+static GQueue lru = G_QUEUE_INIT;
+
+static guint
+_limit_from_env (const gchar *name, guint default_value)
+{
+    const gchar *value = g_getenv (name);
+    guint64 limit;
+
+    if (value == NULL)
+        return default_value;
+    limit = g_ascii_strtoull (value, NULL, 10);
+    return limit > G_MAXUINT ? G_MAXUINT : (guint) limit;
+}
+
+static void
+_entry_free (gpointer data)
+{
+    GSignondSaslServerEntry *entry = data;
+
+    g_free (entry->key);
+    g_slice_free (GSignondSaslServerEntry, entry);
+}
+
+static void
+_init_locked (void)
+{
+    if (outcomes_initialized)
+        return;
+    max_servers = _limit_from_env ("SSO_SASL_OUTCOME_MAX_SERVERS",
+                                   DEFAULT_MAX_SERVERS);
+    ttl = (gint64) _limit_from_env ("SSO_SASL_OUTCOME_TTL", DEFAULT_TTL) *
+          G_TIME_SPAN_SECOND;
+    servers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                     _entry_free);
+    outcomes_initialized = TRUE;
+}
+
+static gchar *
+_server_key (const gchar *hostname, const gchar *realm, const gchar *service)
+{
+    /* the unit separator can't appear in host, realm or service names */
+    return g_strdup_printf ("%s\x1f%s\x1f%s", hostname ? hostname : "",
+                            realm ? realm : "", service ? service : "");
+}
+
+static void
+_remove_entry_locked (GSignondSaslServerEntry *entry)
+{
+    g_queue_unlink (&lru, &entry->link);
+    g_hash_table_remove (servers, entry->key);
+}
+
+static GSignondSaslServerEntry *
+_lookup_locked (const gchar *hostname,
+                const gchar *realm,
+                const gchar *service)
+{
+    gchar *key = _server_key (hostname, realm, service);
+    GSignondSaslServerEntry *entry = g_hash_table_lookup (servers, key);
+
+    g_free (key);
+    return entry;
+}
+
+static gboolean
+_outcome_valid (const GSignondSaslOutcome *outcome, gint64 now)
+{
+    return outcome->updated != 0 && now - outcome->updated < ttl;
+}
+
+void
+gsignond_sasl_outcomes_set_limits (guint max_servers_limit,
+                                   guint ttl_seconds)
+{
+    g_mutex_lock (&outcomes_lock);
+    _init_locked ();
+    max_servers = max_servers_limit;
+    ttl = (gint64) ttl_seconds * G_TIME_SPAN_SECOND;
+    while (lru.length > max_servers)
+        _remove_entry_locked (lru.tail->data);
+    g_mutex_unlock (&outcomes_lock);
+}
+
+void
+gsignond_sasl_outcomes_record (const gchar *hostname,
+                               const gchar *realm,
+                               const gchar *service,
+                               GSignondSaslMechanism mechanism,
+                               gboolean succeeded,
+                               guint64 duration_us)
+{
+    GSignondSaslServerEntry *entry;
+    GSignondSaslOutcome *outcome;
+    gint64 now = g_get_monotonic_time ();
+
+    g_return_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS);
+
+    g_mutex_lock (&outcomes_lock);
+    _init_locked ();
+    if (max_servers == 0) {
+        g_mutex_unlock (&outcomes_lock);
+        return;
+    }
+    entry = _lookup_locked (hostname, realm, service);
+    if (entry) {
+        g_queue_unlink (&lru, &entry->link);
+    } else {
+        if (lru.length >= max_servers)
+            _remove_entry_locked (lru.tail->data);
+        entry = g_slice_new0 (GSignondSaslServerEntry);
+        entry->key = _server_key (hostname, realm, service);
+        entry->link.data = entry;
+        g_hash_table_insert (servers, entry->key, entry);
+    }
+    g_queue_push_head_link (&lru, &entry->link);
+
+    outcome = &entry->outcomes[mechanism];
+    if (!_outcome_valid (outcome, now))
+        memset (outcome, 0, sizeof (*outcome));
+    if (succeeded)
+        outcome->succeeded++;
+    else
+        outcome->failed++;
+    outcome->last_succeeded = succeeded;
+    outcome->last_duration_us = duration_us;
+    outcome->updated = now;
+    g_mutex_unlock (&outcomes_lock);
+}
+
+gboolean
+gsignond_sasl_outcomes_lookup (const gchar *hostname,
+                               const gchar *realm,
+                               const gchar *service,
+                               GSignondSaslMechanism mechanism,
+                               GSignondSaslOutcome *outcome)
+{
+    GSignondSaslServerEntry *entry;
+    gboolean found = FALSE;
+
+    g_return_val_if_fail (mechanism < GSIGNOND_SASL_N_MECHANISMS, FALSE);
+
+    g_mutex_lock (&outcomes_lock);
+    _init_locked ();
+    entry = _lookup_locked (hostname, realm, service);
+    if (entry &&
+        _outcome_valid (&entry->outcomes[mechanism], g_get_monotonic_time ())) {
+        *outcome = entry->outcomes[mechanism];
+        found = TRUE;
+    }
+    g_mutex_unlock (&outcomes_lock);
+    return found;
+}
+
+/* Returns the outcomes for a server as a floating a{sv} dictionary keyed by
+ * mechanism name */
+GVariant *
+gsignond_sasl_outcomes_to_variant (const gchar *hostname,
+                                   const gchar *realm,
+                                   const gchar *service)
+{
+    GSignondSaslServerEntry *entry;
+    GVariantBuilder builder;
+    gint64 now = g_get_monotonic_time ();
+    guint mechanism;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    g_mutex_lock (&outcomes_lock);
+    _init_locked ();
+    entry = _lookup_locked (hostname, realm, service);
+    for (mechanism = 0; entry && mechanism < GSIGNOND_SASL_N_MECHANISMS;
+         mechanism++) {
+        const GSignondSaslOutcome *outcome = &entry->outcomes[mechanism];
+        GVariantBuilder mechanism_builder;
+
+        if (!_outcome_valid (outcome, now))
+            continue;
+        g_variant_builder_init (&mechanism_builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&mechanism_builder, "{sv}", "Succeeded",
+                               g_variant_new_uint64 (outcome->succeeded));
+        g_variant_builder_add (&mechanism_builder, "{sv}", "Failed",
+                               g_variant_new_uint64 (outcome->failed));
+        g_variant_builder_add (&mechanism_builder, "{sv}", "LastSucceeded",
+                               g_variant_new_boolean (outcome->last_succeeded));
+        g_variant_builder_add (&mechanism_builder, "{sv}", "LastDurationUs",
+                               g_variant_new_uint64 (outcome->last_duration_us));
+        g_variant_builder_add (&mechanism_builder, "{sv}", "AgeSeconds",
+                               g_variant_new_uint64 ((now - outcome->updated) /
+                                                     G_TIME_SPAN_SECOND));
+        g_variant_builder_add (&builder, "{sv}",
+                               gsignond_sasl_mechanism_get_name (mechanism),
+                               g_variant_builder_end (&mechanism_builder));
+    }
+    g_mutex_unlock (&outcomes_lock);
+    return g_variant_builder_end (&builder);
+}
+
+void
+gsignond_sasl_outcomes_clear (void)
+{
+    g_mutex_lock (&outcomes_lock);
+    _init_locked ();
+    g_hash_table_remove_all (servers);
+    g_queue_init (&lru);
+    g_mutex_unlock (&outcomes_lock);
+}
@@ -0,0 +1,74 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_OUTCOMES_H__
+#define __GSIGNOND_SASL_OUTCOMES_H__
+
+#include <glib.h>
+
+#include "gsignond-sasl-mechanisms.h"
+
+G_BEGIN_DECLS
+
+/* What happened the last times a mechanism was used against a server */
+typedef struct {
+    guint64 succeeded;
+    guint64 failed;
+    gboolean last_succeeded;
+    guint64 last_duration_us;
+    /* monotonic time of the last use, 0 if never used */
+    gint64 updated;
+} GSignondSaslOutcome;
+
+void
+gsignond_sasl_outcomes_set_limits (guint max_servers,
+                                   guint ttl_seconds);
+
+void
+gsignond_sasl_outcomes_record (const gchar *hostname,
+                               const gchar *realm,
+                               const gchar *service,
+                               GSignondSaslMechanism mechanism,
+                               gboolean succeeded,
+                               guint64 duration_us);
+
+gboolean
+gsignond_sasl_outcomes_lookup (const gchar *hostname,
+                               const gchar *realm,
+                               const gchar *service,
+                               GSignondSaslMechanism mechanism,
+                               GSignondSaslOutcome *outcome);
+
+GVariant *
+gsignond_sasl_outcomes_to_variant (const gchar *hostname,
+                                   const gchar *realm,
+                                   const gchar *service);
+
+void
+gsignond_sasl_outcomes_clear (void);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_OUTCOMES_H__ */
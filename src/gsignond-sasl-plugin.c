@@ -29,8 +29,8 @@
  * @see_also: #GSignondPlugin
  *
  * The SASL plugin provides a client-side implementation of several commonly
- * used SASL authentication mechanisms: ANONYMOUS, PLAIN, DIGEST-MD5, CRAM-MD5
- * and SCRAM-SHA-1. The plugin takes a mechanism name, and parameters specific
+ * used SASL authentication mechanisms: ANONYMOUS, PLAIN, DIGEST-MD5, CRAM-MD5,
+ * SCRAM-SHA-1 and SCRAM-SHA-256. The plugin takes a mechanism name, and parameters specific
  * to that mechanism, and (depending on the mechanism) produces a final or an
  * intermidiate response string that the application transmits to the server. 
  * If the response string was intermidate, the server should return a challenge
@@ -44,7 +44,8 @@
  * PLAIN in <ulink url="http://tools.ietf.org/html/rfc4616">RFC 4616</ulink>,
  * CRAM-MD5 in <ulink url="http://tools.ietf.org/html/rfc2195">RFC 2195</ulink>,
  * DIGEST-MD5 in <ulink url="http://tools.ietf.org/html/rfc2831">RFC 2831</ulink>,
- * SCRAM-SHA-1 in <ulink url="http://tools.ietf.org/html/rfc5802">RFC 5802</ulink>.
+ * SCRAM-SHA-1 in <ulink url="http://tools.ietf.org/html/rfc5802">RFC 5802</ulink>,
+ * SCRAM-SHA-256 in <ulink url="http://tools.ietf.org/html/rfc7677">RFC 7677</ulink>.
  * 
  * The plugin implements the standard #GSignondPlugin interface, and after instantiating
  * a plugin object all interactions happen through that interface.
@@ -82,7 +83,362 @@
  *
  * At any point the application can request to stop the authorization by calling
  * gsignond_plugin_cancel(). The plugin responds with an #GSignondPlugin::error signal
- * containing a %GSIGNOND_ERROR_SESSION_CANCELED error.
+ * containing a %GSIGNOND_ERROR_SESSION_CANCELED error. The session and the data
+ * it holds are released immediately; a SCRAM key derivation running in a worker
+ * thread (see below) is interrupted and releases the session when it stops.
+ * 
+ * <refsect1><title>Automatic mechanism selection</title></refsect1>
+ * 
+ * Instead of a mechanism name, "AUTO" can be passed to
+ * gsignond_plugin_request_initial(), together with the mechanisms advertised
+ * by the server in "ServerMechanisms" string (separated with spaces or
+ * commas). The plugin considers the offered mechanisms it supports whose
+ * required session data (see below) is present, prefers the most secure
+ * ones (channel-bound SCRAM, then SCRAM and SECURID, then PLAIN and LOGIN,
+ * which are no weaker than the obsolete hash mechanisms over TLS, then
+ * CRAM-MD5 and DIGEST-MD5, then ANONYMOUS) and among those the quickest:
+ * the one that took the least time against the same server the last time
+ * it succeeded, or else the one with the fewest round trips, and no key
+ * derivation where the key is given or already cached. The chosen
+ * mechanism is returned in "Mechanism" string of the first response.
+ * EXTERNAL, GSSAPI, GS2-KRB5, SAML20 and OPENID20 rely on credentials outside
+ * the session data, and NTLM is obsolete; they are never chosen
+ * automatically. If nothing can be used, the error is
+ * %GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE.
+ * 
+ * <refsect1><title>Per-server outcomes</title></refsect1>
+ * 
+ * The plugin remembers, for each server identified by the "Hostname", "Realm"
+ * and "Service" session data, how each mechanism fared: the result is
+ * available from gsignond_sasl_plugin_get_server_outcomes() as a dictionary
+ * keyed by mechanism name, with "Succeeded" and "Failed" counts (uint64),
+ * "LastSucceeded" (boolean), "LastDurationUs" (uint64, length of the last
+ * handshake in microseconds) and "AgeSeconds" (uint64, time since the last
+ * use). Automatic mechanism selection skips a mechanism whose last attempt
+ * against the server failed. A finished SCRAM or DIGEST-MD5 exchange
+ * counts as a success since the client has verified the server by then;
+ * with other mechanisms the client can't tell whether the server accepted
+ * it, so nothing is remembered for a finished exchange until the caller
+ * reports the server's answer with gsignond_sasl_plugin_report_verdict().
+ * A failed step is remembered as a failure in every case. Outcomes are
+ * forgotten after an hour, or after SSO_SASL_OUTCOME_TTL seconds; at most
+ * 256 servers, or SSO_SASL_OUTCOME_MAX_SERVERS, are remembered.
+ * 
+ * <refsect1><title>Required session data</title></refsect1>
+ * 
+ * gsignond_plugin_request_initial() checks that the session data contains
+ * what the mechanism needs before starting, and fails with
+ * %GSIGNOND_ERROR_NOT_AUTHORIZED error naming the missing keys otherwise,
+ * so that no round trip to the server is wasted on a login that can't
+ * succeed. ANONYMOUS needs "AnonymousToken"; PLAIN, LOGIN, CRAM-MD5 and NTLM
+ * need a username and a secret; DIGEST-MD5 needs a username, a secret or
+ * "DigestMd5HashedPassword", "Service" and "Hostname"; SCRAM-SHA-1 and
+ * SCRAM-SHA-256 need a username and a secret or "ScramSaltedPassword" (the
+ * -PLUS variants also "CbTlsUnique"); SECURID needs a username and
+ * "Passcode"; GSSAPI and GS2-KRB5 need "Service" and "Hostname".
+ * 
+ * <refsect1><title>Initial response</title></refsect1>
+ * 
+ * Protocols with an initial response (IMAP SASL-IR, SMTP AUTH, XMPP) let the
+ * client send its first message together with the authentication command.
+ * If "InitialResponse" boolean is set to %TRUE in @session_data of
+ * gsignond_plugin_request_initial(), the first step ignores "ChallengeBase64"
+ * and produces the client's opening message. Mechanisms where the server
+ * speaks first (LOGIN, CRAM-MD5, DIGEST-MD5) fail with
+ * %GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED error, and "AUTO" passes them over.
+ * A response that may be used as the initial response carries
+ * "InitialResponse" set to %TRUE, whether or not the mode was requested. An
+ * empty "ResponseBase64" there has to be sent as "=" by the application.
+ * 
+ * <refsect1><title>User interaction</title></refsect1>
+ * 
+ * Unless @session_data of gsignond_plugin_request_initial() sets the UI policy
+ * to %GSIGNOND_UI_POLICY_NO_USER_INTERACTION, the secret (or "Passcode" for
+ * SECURID) may be left out. When a step needs it, the plugin keeps the session
+ * and the pending challenge and issues #GSignondPlugin::user-action-required
+ * with a password query instead of a response. The step is completed once
+ * gsignond_plugin_user_action_finished() supplies the password, or once
+ * gsignond_plugin_request() is called with the missing key in @session_data.
+ * The step is then run again with the same challenge: the SCRAM and
+ * DIGEST-MD5 clients of the plugin and libgsasl's PLAIN, LOGIN, CRAM-MD5,
+ * NTLM and SECURID ask for the credential before changing their state,
+ * and a libgsasl DIGEST-MD5 session, which has parsed the challenge by
+ * then, is started anew for it.
+ * If the user cancels the query the session is dropped with
+ * %GSIGNOND_ERROR_SESSION_CANCELED error. gsignond_sasl_plugin_step_async()
+ * reports the same situation as %GSIGNOND_ERROR_USER_INTERACTION error.
+ * 
+ * <refsect1><title>Step timing</title></refsect1>
+ * 
+ * If "ReportTiming" boolean is set to %TRUE in the session data passed to
+ * gsignond_plugin_request_initial(), every response of the session also
+ * contains the client-side cost of the step that produced it:
+ * "StepWallTimeUs" and "StepCpuTimeUs" (uint64, wall-clock and CPU time of the
+ * calling thread, in microseconds), "StepIndex" (uint32, counted from 0) and
+ * "KdfIterations" (uint32, PBKDF2 iterations the plugin ran during the step,
+ * or 0). Applications can log these next to the server round-trip time.
+ * 
+ * <refsect1><title>Idle sessions</title></refsect1>
+ * 
+ * A session that waits for the next challenge from the server for longer than
+ * #GSignondSaslPlugin:idle-timeout seconds (300 by default), or "IdleTimeout"
+ * seconds if that unsigned 32-bit integer is present in @session_data of
+ * gsignond_plugin_request_initial(), is discarded together with the data it
+ * holds. The plugin then issues a #GSignondPlugin::error signal with a
+ * %GSIGNOND_ERROR_TIMED_OUT error. The timeout is driven by the default main
+ * context.
+ * 
+ * <refsect1><title>Statistics</title></refsect1>
+ * 
+ * #GSignondSaslPlugin:statistics property is a dictionary with the following
+ * keys, covering all plugin objects in the process:
+ * - "LiveSessions" Number of sessions currently in progress (uint32).
+ * - "ExpiredSessions" Number of sessions discarded because of the idle timeout (uint64).
+ * - "ReclaimedBytes" Approximate amount of memory released by discarding idle sessions (uint64).
+ * - "KdfMaxActive", "KdfMaxQueued" Admission limits for SCRAM key derivations, see below (uint32).
+ * - "KdfActive", "KdfQueueDepth" Number of key derivations currently running and waiting (uint32).
+ * - "KdfMaxQueueDepth" Largest number of key derivations that had to wait at once (uint32).
+ * - "KdfAdmitted", "KdfRejected" Number of key derivations started and rejected because the queue was full (uint64).
+ * - "KdfWaitTimeUs", "KdfMaxWaitTimeUs" Total and maximum time key derivations spent waiting in the queue, in microseconds (uint64).
+ * - "KeyCacheEntries" Number of derived SCRAM keys kept in memory, see "Refresh" below (uint32).
+ * - "KeyCacheHits", "KeyCacheMisses" Number of key derivations avoided and done (uint64).
+ * - "SharedKeyCacheSlots" Size of the key cache shared between processes, 0 if there is none (uint32).
+ * - "SharedKeyCacheHits", "SharedKeyCacheMisses", "SharedKeyCacheContention", "SharedKeyCacheEvictions" Lookups answered and not answered by the shared key cache, times one of its slots was being written by another thread or process, and keys it dropped for lack of room; counted for all processes using it (uint64).
+ * - "DiskKeyCacheSlots" Number of records of the key cache file, 0 if there is none (uint32).
+ * - "DiskKeyCacheHits", "DiskKeyCacheMisses" Lookups answered and not answered by the key cache file (uint64).
+ * - "WarmerQueued" Number of keys waiting to be derived in the background (uint32).
+ * - "WarmerDerived", "WarmerDeferred" Number of keys derived in the background, and of times the warming was postponed because of the CPU budget or power saving (uint64).
+ * - "KdfSpeculated", "KdfSpeculationsUsed" Number of SCRAM key derivations started ahead of the server's challenge, and of those whose result was used (uint64).
+ * - "Mechanisms" A dictionary keyed by the names of the mechanisms that have been
+ * used, with the following uint64 counters for each: "Started", "Succeeded",
+ * "Failed" (including sessions that timed out), "Cancelled", "Steps", "BytesIn"
+ * and "BytesOut" (length of the base64 encoded challenges and responses),
+ * "StepTimeUs" and "MaxStepTimeUs" (total and maximum time spent in a step, in
+ * microseconds). The counters are kept per thread, and summed up when the
+ * property is read.
+ * 
+ * <refsect1><title>Latency histograms</title></refsect1>
+ * 
+ * #GSignondSaslPlugin:histograms property is a dictionary keyed by mechanism
+ * name. For each mechanism there is a dictionary keyed by phase: "Start"
+ * (starting the libgsasl session), "Step1", "Step2", "Step3", "Step4" (the
+ * fourth and any further steps) and "Handshake" (from the start of the session
+ * until the final response, including the time spent waiting for the server).
+ * Each phase has the sample count in "Count", the latency percentiles in
+ * microseconds in "P50Us", "P90Us", "P99Us", "P999Us" and "MaxUs" (all uint64),
+ * and the non-empty buckets as an array of (upper bound in microseconds, count)
+ * pairs in "Buckets". Every power of two is split into four buckets, so the
+ * reported latencies are accurate within 25%.
+ * 
+ * The histograms can be written to a file with
+ * gsignond_sasl_plugin_dump_histograms(). The plugin installs no signal
+ * handler for this: the process that loads it decides when to dump them,
+ * for instance from a D-Bus method or its own signal handler.
+ * 
+ * <refsect1><title>Admission control</title></refsect1>
+ * 
+ * Deriving SCRAM keys from a password is CPU-heavy, so the number of such
+ * derivations running at once in the process is limited to the number of
+ * processors, or to the value of SSO_SASL_KDF_MAX_ACTIVE environment variable.
+ * Further ones wait for their turn in a FIFO queue, bounded to four times the
+ * number of processors or SSO_SASL_KDF_MAX_QUEUED. When the queue is full the
+ * step fails immediately with a %GSIGNOND_ERROR_SERVICE_NOT_AVAILABLE error;
+ * the application may retry the authorization later. Only steps run in a
+ * worker thread, such as those of gsignond_sasl_plugin_step_async(), wait in
+ * the queue: a step issued through the #GSignondPlugin interface runs in the
+ * thread of the default main context, which must keep serving cancel requests
+ * and the idle timeout, so it fails with the same error when no derivation
+ * can start right away.
+ * 
+ * <refsect1><title>Refresh</title></refsect1>
+ * 
+ * After a successful SCRAM authorization, gsignond_plugin_refresh() starts
+ * a new one with the same mechanism, username, "Authzid" and salted
+ * password, taking the rest of the session data, such as "ChallengeBase64",
+ * "Hostname" and the allowed realms, from its argument; it is answered like
+ * gsignond_plugin_request_initial(), and continued with
+ * gsignond_plugin_request(). The realm and hostname are checked as for any
+ * authorization. The plugin keeps the salted password, never the secret,
+ * and wipes it when a new authorization starts or the plugin is destroyed;
+ * if the server asks for another salt or iteration count, the refresh fails
+ * with %GSIGNOND_ERROR_NOT_AUTHORIZED. Other mechanisms need the secret
+ * again, so they are authorized anew rather than refreshed.
+ *
+ * SCRAM keys derived from the password are also reused across
+ * authorizations: the plugin keeps the most recently derived keys in memory
+ * (64, or SSO_SASL_KEY_CACHE_SIZE; 0 disables the cache), identified by
+ * username, salt and iteration count and checked against the password.
+ * The final response of a refresh has "RefreshSavedUs" (uint64), the time
+ * spent in the steps of the original authorization minus that of the
+ * refresh, in microseconds.
+ * 
+ * <refsect1><title>Shared key cache</title></refsect1>
+ * 
+ * gSSO daemon runs every plugin in a process of its own, each with its own
+ * key cache. Setting SSO_SASL_SHARED_KEY_CACHE to a number of entries makes
+ * the plugin processes of a user also share derived keys through a POSIX
+ * shared memory segment, "/gsignond-sasl-keys-" followed by the uid, which
+ * the first process creates with that many entries and mode 0600. The
+ * segment holds keys and password fingerprints, never passwords; a segment
+ * that other users can access is not used. The fingerprints are keyed with
+ * a key derived from SSO_SASL_SEAL_KEY (see "Sealed session state"), so that
+ * they can't be used to test password guesses cheaply, and the processes
+ * only share keys if they share SSO_SASL_SEAL_KEY. As the segment stays
+ * until the user logs out or the system restarts, the keys and
+ * fingerprints in it are also encrypted and authenticated with keys derived
+ * from SSO_SASL_SEAL_KEY. Lookups and updates take no locks shared with
+ * other processes: a lookup that keeps finding an entry being written
+ * counts as a miss, and an update that finds one is dropped, unless the
+ * entry stays busy long enough for its writer to be presumed dead.
+ * 
+ * <refsect1><title>On-disk key cache</title></refsect1>
+ * 
+ * Derived keys can also outlive the processes: when SSO_SASL_KEY_CACHE_FILE
+ * names a file and SSO_SASL_KEY_CACHE_FILE_KEY is a key of 64 hexadecimal
+ * digits, keys missing from the memory caches are looked up in that file
+ * before being derived, and new ones are added to it. The file has a fixed
+ * number of records, SSO_SASL_KEY_CACHE_FILE_SLOTS (1024 by default) when
+ * the plugin creates it, and is mapped into memory as is, so opening it
+ * takes the same time however many keys it holds. Keys and password
+ * fingerprints are encrypted and authenticated with the file key; a file
+ * written with another key is replaced. As in the shared key cache, keys
+ * written by another process, or before a restart, are only used if
+ * SSO_SASL_SEAL_KEY is set to the same key. New keys are written out a few
+ * seconds after they are added, and when a plugin object is disposed, to a
+ * temporary file with mode 0600 that is synced and renamed over the cache
+ * file.
+ * 
+ * <refsect1><title>Early SCRAM key derivation</title></refsect1>
+ * 
+ * After a successful SCRAM authorization the plugin issues
+ * #GSignondPlugin::store signal with "ScramSalt" (base64 string) and
+ * "ScramIterations" (uint32), the parameters the server uses for the account,
+ * whenever they differ from those in the session data. If both are present
+ * in the session data of a later gsignond_plugin_request_initial(), the key
+ * derivation starts in a worker thread as soon as the first response is
+ * issued, so that it runs while the application waits for the server. The
+ * next step only waits for it to finish, and does the derivation itself if
+ * the server sent other parameters. gsignond_sasl_plugin_step_async()
+ * returns the two keys in the final response instead.
+ * 
+ * <refsect1><title>Key cache warming</title></refsect1>
+ * 
+ * Keys that have left the cache, for example after a restart of the daemon,
+ * can be derived before they are needed with
+ * gsignond_sasl_plugin_warm_key_cache(), for the SCRAM mechanism named by
+ * "Mechanism" in the session data. The derivations run one at a time
+ * in a thread with the lowest scheduling priority, and are only started from
+ * a low priority idle source in the default main context. They use at most
+ * SSO_SASL_WARMER_BUDGET_MS milliseconds (1000 by default) of CPU time every
+ * SSO_SASL_WARMER_WINDOW seconds (60): a derivation that spends the budget
+ * pauses until the next window. They also take their turn in the admission
+ * control of the derivations like any step does. None is started while the
+ * system is in power saving mode (detected with GPowerProfileMonitor when
+ * the plugin is built with GLib 2.70 or later), and after ten minutes of it
+ * the queued requests and their passwords are dropped.
+ * 
+ * <refsect1><title>Moving sessions</title></refsect1>
+ * 
+ * The SCRAM mechanisms are implemented by the plugin itself rather than by
+ * libgsasl, and a SCRAM sequence waiting for the server can be handed over
+ * to another plugin object, in the same or in another process:
+ * gsignond_sasl_plugin_export_session() returns the state of the sequence as
+ * a blob sealed like the states of gsignond_sasl_plugin_step_sealed() (see
+ * below), and gsignond_sasl_plugin_import_session() resumes it, so that the
+ * next gsignond_plugin_request() continues with the challenge of the
+ * server. The blob holds the user names, the nonces, the messages exchanged
+ * so far and the server signature expected at the end. The signature is
+ * derived from the password, and would let anyone who reads the blob guess
+ * the password offline, which is why the blob is encrypted: only processes
+ * that share the SSO_SASL_SEAL_KEY can import it. The importing side still
+ * needs the secret (or "ScramSaltedPassword") in its own session data, for
+ * the same user name and "Authzid" as the exported sequence; a blob that
+ * was altered or sealed with another key is refused with
+ * %GSIGNOND_ERROR_WRONG_STATE, and one for another user with
+ * %GSIGNOND_ERROR_NOT_AUTHORIZED.
+ * 
+ * <refsect1><title>Sealed session state</title></refsect1>
+ * 
+ * Frontends that spread the steps of one authorization over several
+ * processes can use gsignond_sasl_plugin_step_sealed() for PLAIN, CRAM-MD5,
+ * DIGEST-MD5 (with "qop-auth" only) and the SCRAM mechanisms. It keeps no
+ * state in the plugin: each step returns the state for the next one
+ * encrypted and authenticated as an opaque blob, which the application
+ * passes back with the next challenge and the complete session data. A blob
+ * that was altered, or sealed with another key, is refused with
+ * %GSIGNOND_ERROR_WRONG_STATE, and one older than "IdleTimeout" seconds
+ * (300 by default, 0 for no limit) with %GSIGNOND_ERROR_TIMED_OUT. The
+ * key is read from SSO_SASL_SEAL_KEY (64 hex digits), which all processes
+ * that serve the same clients must share; without it each process makes a
+ * random key of its own. A blob can be replayed until it expires, just
+ * like a challenge can be answered twice. The session data of every step is
+ * checked like that of the first one, and must name the user (and
+ * "Authzid") the sequence was started for, or the step fails with
+ * %GSIGNOND_ERROR_NOT_AUTHORIZED.
+ * 
+ * <refsect1><title>Asynchronous API</title></refsect1>
+ * 
+ * Applications that load the plugin in-process can use
+ * gsignond_sasl_plugin_step_async() and gsignond_sasl_plugin_step_finish()
+ * instead of the #GSignondPlugin signals. Each call performs one step of the
+ * sequence above in a worker thread: passing a @mechanism starts a new sequence
+ * (like gsignond_plugin_request_initial()), passing %NULL continues it (like
+ * gsignond_plugin_request()). The response is returned directly, together with
+ * a flag that tells whether it was final. Cancelling the #GCancellable ends
+ * the sequence with a %GSIGNOND_ERROR_SESSION_CANCELED error.
+ *
+ * <refsect1><title>Direct C API</title></refsect1>
+ *
+ * The plugin object is a thin adapter over #GSignondSaslEngine, which holds
+ * the whole authorization sequence. A daemon that links the library and does
+ * not need GObject signals can create an engine with
+ * gsignond_sasl_engine_new() and call gsignond_sasl_engine_step() directly:
+ * the outcome of each step (a response, a user action or an error) is
+ * written into a caller-owned #GSignondSaslEngineResult, with no dictionary
+ * built for the response and no signal emission. The result is released with
+ * gsignond_sasl_engine_result_clear(). An engine used this way has no idle
+ * timer, so "IdleTimeout" has no effect; the caller ends stale sequences with
+ * gsignond_sasl_engine_cancel().
+ *
+ * <refsect1><title>Logging</title></refsect1>
+ * 
+ * The plugin logs with the macros of gsignond-log.h. Only errors and
+ * warnings are logged by default; SSO_SASL_LOG_LEVEL environment variable
+ * selects another level: "none", "error", "warning", "info", "debug" or
+ * "trace". Debug messages include every property libgsasl asks for; trace
+ * messages are only compiled in when the plugin is built with
+ * -DGSIGNOND_SASL_LOG_MAX_LEVEL=5. At most five messages from the same place
+ * in the code are logged per second, whatever their arguments; the number of
+ * suppressed ones is logged after that, at the latest when the plugin object
+ * is disposed.
+ * 
+ * <refsect1><title>Tracing</title></refsect1>
+ * 
+ * When built with --enable-sdt-probes, the plugin contains USDT static probes
+ * of provider "gsignond_sasl", which SystemTap or bpftrace can attach to with
+ * no overhead while nothing is tracing:
+ * "request__initial" (session id, mechanism) when a session starts,
+ * "step__start" (session id, mechanism, step number) and "step__done" (session
+ * id, mechanism, step number, libgsasl result code, duration in microseconds)
+ * around each step, "callback" (session id, libgsasl property, result code)
+ * for each property libgsasl asks for, "session__reset" (session id,
+ * mechanism) when a session is released, "cancel" (session id) and "error"
+ * (session id, #GSignondError code). Mechanisms are reported as
+ * #GSignondSaslMechanism values. Example bpftrace scripts are in
+ * examples/bpftrace.
+ * 
+ * <refsect1><title>Choosing the mechanisms at build time</title></refsect1>
+ * 
+ * By default the plugin offers every mechanism libgsasl has, plus those it
+ * implements itself. Configuring with --with-mechanisms and a comma-separated
+ * list of mechanism names, for instance
+ * "--with-mechanisms=PLAIN,SCRAM-SHA-256,SCRAM-SHA-256-PLUS", restricts it to
+ * those: the others are missing from #GSignondPlugin:mechanisms, are not
+ * chosen automatically, and requesting them, importing or unsealing a
+ * session of them fails with %GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE. The
+ * plugin's own SCRAM and DIGEST-MD5 code is only compiled in when one of the
+ * mechanisms it serves is in the list. Mechanisms that the plugin doesn't know
+ * by name are only offered when the list is not restricted.
  * 
  * <refsect1><title>Code examples</title></refsect1>
  * 
@@ -120,7 +476,7 @@
  * - "Hostname" Should be the local host name of the machine. 
  * - "Realm" The name of the authentication domain.
  * - "Qop" Quality of protection (QOP). Valid values are qop-auth, qop-int, and qop-conf. 
- * - "ScramSaltedPassword" 40 character long hex-encoded string with the user's hashed password.
+ * - "ScramSaltedPassword" hex-encoded string with the user's hashed password (40 characters for SCRAM-SHA-1, 64 for SCRAM-SHA-256).
  * - "CbTlsUnique" This property holds base64 encoded tls-unique channel binding 
  * data. As a hint, if you use GnuTLS, the API gnutls_session_channel_binding() 
  * can be used to extract channel bindings for a session. 
@@ -156,12 +512,34 @@
  * the server (with gsignond_plugin_request()) the plugin will return a final response via 
  * #GSignondPlugin::response-final signal.
  *
+ * <refsect1><title>Security layer</title></refsect1>
+ * 
+ * With "Qop" set to qop-int or qop-conf, DIGEST-MD5 negotiates a security
+ * layer protecting the integrity, and with qop-conf also the
+ * confidentiality, of the messages that follow the authorization. Only the
+ * RC4 ciphers ("rc4", "rc4-56" and "rc4-40") are available for
+ * confidentiality. After #GSignondPlugin::response-final the negotiated
+ * layer is returned by gsignond_sasl_plugin_get_security_layer():
+ * gsignond_sasl_security_layer_wrapv() and
+ * gsignond_sasl_security_layer_wrap_bytes() turn a message made of several
+ * buffers into one packet written into a buffer of the caller, and
+ * gsignond_sasl_security_layer_unwrap() checks a packet received from the
+ * server and writes its message into a buffer of the caller, which can be
+ * the packet itself. gsignond_sasl_security_layer_peek_packet_size() tells
+ * how long the packet at the start of the received data is. Protocols that
+ * exchange many small messages can use
+ * gsignond_sasl_security_layer_wrap_batch() to wrap a run of messages into
+ * consecutive packets of one buffer, and
+ * gsignond_sasl_security_layer_unwrap_batch() to unwrap all the complete
+ * packets of the received data at once.
+ * 
  * <refsect1><title>How to use SCRAM-SHA-1 mechanism</title></refsect1>
  * Issue gsignond_plugin_request_initial() with @mechanism set to "SCRAM-SHA-1"
  * and @session_data containing authentication identity, initial
  * server challenge and password. The password can be provided via "ScramSaltedPassword" property
  * or if this property is absent, the normal password property is used. Optionally, also
  * authorization identity and channel binding data can be provided.
+ * SCRAM-SHA-256 is used in the same way.
  *
  * This mechanism contains two rounds of response-challenge exchanges (as described
  * above) - gsignond_plugin_request_initial() should be followed by 
@@ -171,13 +549,23 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <gsignond/gsignond-plugin-interface.h>
 #include <gsignond/gsignond-error.h>
-#include <gsignond/gsignond-log.h>
 #include <gsignond/gsignond-utils.h>
 
 #include "gsignond-sasl-plugin.h"
+#include "gsignond-sasl-engine.h"
+#include "gsignond-sasl-admission.h"
+#include "gsignond-sasl-disk-cache.h"
+#include "gsignond-sasl-stats.h"
+#include "gsignond-sasl-log.h"
+#include "gsignond-sasl-outcomes.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-speculation.h"
+#include "gsignond-sasl-stateless.h"
+#include "gsignond-sasl-warmer.h"
 
 static void gsignond_plugin_interface_init (GSignondPluginInterface *iface);
 
@@ -186,197 +574,101 @@ G_DEFINE_TYPE_WITH_CODE (GSignondSaslPlugin, gsignond_sasl_plugin,
                          G_IMPLEMENT_INTERFACE (GSIGNOND_TYPE_PLUGIN,
                                                 gsignond_plugin_interface_init));
 
-static void gsignond_sasl_plugin_cancel (GSignondPlugin *self)
+static void
+_on_session_expired (GObject *owner)
 {
-    GError* error = g_error_new(GSIGNOND_ERROR, 
-                                GSIGNOND_ERROR_SESSION_CANCELED,
-                                "Session canceled");
-    gsignond_plugin_error (self, error); 
-    g_error_free(error);
-}
+    GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (owner);
+    GError *error = NULL;
 
-static void _reset_session(GSignondSaslPlugin *self)
-{
-    if (self->session_data) {
-        gsignond_dictionary_unref(self->session_data);
-        self->session_data = NULL;
-    }
-    if (self->gsasl_session) {
-        gsasl_finish(self->gsasl_session);
-        self->gsasl_session = NULL;
+    if (gsignond_sasl_engine_expire (self->engine, &error)) {
+        gsignond_plugin_error (GSIGNOND_PLUGIN (self), error);
+        g_error_free (error);
     }
-    
 }
 
-static void 
-_do_gsasl_iteration(GSignondPlugin *plugin, const gchar* challenge)
+static void gsignond_sasl_plugin_cancel (GSignondPlugin *plugin)
 {
     GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (plugin);
-    
-    char* output;
-    int step_res = gsasl_step64(self->gsasl_session, challenge, &output);
-    if (step_res != GSASL_OK && step_res != GSASL_NEEDS_MORE) {
-        GError* error = g_error_new(GSIGNOND_ERROR, 
-                                GSIGNOND_ERROR_NOT_AUTHORIZED,
-                                "Authorization error %d",
-                                step_res);
-        gsignond_plugin_error (plugin, error); 
-        g_error_free(error);
-        return;
-    }
 
-    GSignondSessionData *response = gsignond_dictionary_new();
-    gsignond_dictionary_set_string(response, "ResponseBase64", output);
-    
-    if (step_res == GSASL_OK) {
-        _reset_session(self);
-        gsignond_plugin_response_final(plugin, response);
-    } else {
-        gsignond_plugin_response(plugin, response);
-    }
-    
-    free(output);
-    gsignond_dictionary_unref(response);
-    
+    gsignond_sasl_engine_cancel (self->engine);
+
+    GError* error = g_error_new(GSIGNOND_ERROR, 
+                                GSIGNOND_ERROR_SESSION_CANCELED,
+                                "Session canceled");
+    gsignond_plugin_error (plugin, error); 
+    g_error_free(error);
 }
 
-static int
-_set_gsasl_property(Gsasl_session * gsasl_session, 
-                    Gsasl_property gsasl_property,
-                    const gchar* value)
+/* Turns a response of the engine into the dictionary the signals and
+ * gsignond_sasl_plugin_step_finish() return */
+static GSignondSessionData *
+_response_from_result (const GSignondSaslEngineResult *result)
 {
-    if (value == NULL)
-        return GSASL_NO_CALLBACK;
-    gsasl_property_set(gsasl_session, gsasl_property, value);
-    return GSASL_OK;
+    GSignondSessionData *response = gsignond_dictionary_new ();
+
+    gsignond_dictionary_set_string (response, "ResponseBase64",
+                                    result->response_base64);
+    if (result->initial_response)
+        gsignond_dictionary_set_boolean (response, "InitialResponse", TRUE);
+    if (result->timing_reported) {
+        gsignond_dictionary_set_uint64 (response, "StepWallTimeUs",
+                                        result->wall_time_us);
+        gsignond_dictionary_set_uint64 (response, "StepCpuTimeUs",
+                                        result->cpu_time_us);
+        gsignond_dictionary_set_uint32 (response, "StepIndex",
+                                        result->step_index);
+        gsignond_dictionary_set_uint32 (response, "KdfIterations",
+                                        result->kdf_iterations);
+    }
+    if (result->refreshed)
+        gsignond_dictionary_set_uint64 (response, "RefreshSavedUs",
+                                        result->refresh_saved_us);
+    if (result->mechanism)
+        gsignond_dictionary_set_string (response, "Mechanism",
+                                        result->mechanism);
+    return response;
 }
 
-static int
-_gsasl_callback (Gsasl * gsasl_context, 
-                 Gsasl_session * gsasl_session, 
-                 Gsasl_property gsasl_property)
+/* Issues the signals for @result, and clears it */
+static void
+_emit_result (GSignondPlugin *plugin,
+              GSignondSaslEngineResult *result)
 {
-    GSignondSaslPlugin *self = gsasl_callback_hook_get(gsasl_context);
-    
-    INFO ("Gsasl callback invoked, for property %d", gsasl_property);
+    GSignondSessionData *response;
 
-    GSignondSessionData *session_data = self->session_data;
-    if (session_data == NULL)
-        return GSASL_NO_CALLBACK;
-    
-    switch (gsasl_property)
-    {
-        case GSASL_AUTHID:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_session_data_get_username(
-                                           session_data));
-            break;
-        case GSASL_AUTHZID:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Authzid"));
-            break;
-        case GSASL_PASSWORD:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_session_data_get_secret(
-                                           session_data));
-            break;
-        case GSASL_ANONYMOUS_TOKEN:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "AnonymousToken"));
-            break;
-        case GSASL_SERVICE:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Service"));
-            break;
-        case GSASL_HOSTNAME:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Hostname"));
-            break;
-        case GSASL_GSSAPI_DISPLAY_NAME:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "GssapiDisplayName"));
-            break;
-        case GSASL_PASSCODE:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Passcode"));
-            break;
-        case GSASL_SUGGESTED_PIN:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "SuggestedPin"));
-            break;
-        case GSASL_PIN:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Pin"));
-            break;
-        case GSASL_REALM:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Realm"));
-            break;
-        case GSASL_DIGEST_MD5_HASHED_PASSWORD:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "DigestMd5HashedPassword"));
-            break;
-        case GSASL_QOPS:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Qops"));
-            break;
-        case GSASL_QOP:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "Qop"));
-            break;
-        case GSASL_SCRAM_ITER:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "ScramIter"));
+    if (result->store_data)
+        gsignond_plugin_store (plugin, result->store_data);
+    switch (result->status) {
+        case GSIGNOND_SASL_ENGINE_ERROR:
+            gsignond_plugin_error (plugin, result->error);
             break;
-        case GSASL_SCRAM_SALT:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "ScramSalt"));
+        case GSIGNOND_SASL_ENGINE_USER_ACTION:
+            gsignond_plugin_user_action_required (plugin,
+                                                  result->user_action);
             break;
-        case GSASL_SCRAM_SALTED_PASSWORD:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "ScramSaltedPassword"));
+        case GSIGNOND_SASL_ENGINE_RESPONSE_FINAL:
+            response = _response_from_result (result);
+            gsignond_plugin_response_final (plugin, response);
+            gsignond_dictionary_unref (response);
             break;
-        case GSASL_CB_TLS_UNIQUE:
-            return _set_gsasl_property(gsasl_session, gsasl_property, 
-                                       gsignond_dictionary_get_string(
-                                           session_data, "CbTlsUnique"));
-            break;
-        default:
+        case GSIGNOND_SASL_ENGINE_RESPONSE:
+            response = _response_from_result (result);
+            gsignond_plugin_response (plugin, response);
+            gsignond_dictionary_unref (response);
             break;
     }
-     
-    return GSASL_NO_CALLBACK;
+    gsignond_sasl_engine_result_clear (result);
 }
 
 static void gsignond_sasl_plugin_request (
     GSignondPlugin *plugin, GSignondSessionData *session_data)
 {
     GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (plugin);
+    GSignondSaslEngineResult result;
 
-    if (!self->gsasl_session) {
-        GError* error = g_error_new(GSIGNOND_ERROR, 
-                                GSIGNOND_ERROR_WRONG_STATE,
-                                "request_initial needs to be issued first");
-        gsignond_plugin_error (plugin, error); 
-        g_error_free(error);
-        return;
-    }
-    _do_gsasl_iteration(plugin, gsignond_dictionary_get_string(session_data, "ChallengeBase64"));
+    gsignond_sasl_engine_step (self->engine, session_data, NULL, NULL,
+                               &result);
+    _emit_result (plugin, &result);
 }
 
 static void gsignond_sasl_plugin_request_initial (
@@ -385,98 +677,177 @@ static void gsignond_sasl_plugin_request_initial (
     const gchar *mechanism)
 {
     GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (plugin);
-    gboolean realm_ok = FALSE;
-    gboolean host_ok = FALSE;
-    const gchar *realm;
-    const gchar *host;
-    GSequence *allowed_realms;
-    GSequenceIter *realm_iter;
-
-    if (!self->gsasl_context) {
-        GError *error = g_error_new (GSIGNOND_ERROR, 
-                                     GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
-                                     "Couldn't initialize gsasl library");
-        gsignond_plugin_error (plugin, error); 
-        g_error_free (error);
-        return;
-    }
-    realm = gsignond_session_data_get_realm (session_data);
-    host = gsignond_dictionary_get_string(session_data, "Hostname");
-    allowed_realms = gsignond_session_data_get_allowed_realms (session_data);
-    if (allowed_realms) {
-        for (realm_iter = g_sequence_get_begin_iter (allowed_realms);
-             !g_sequence_iter_is_end (realm_iter);
-             realm_iter = g_sequence_iter_next (realm_iter)) {
-            const gchar *item = (const gchar *) g_sequence_get (realm_iter);
-            if (realm) {
-                if (g_strcmp0 (realm, item) == 0)
-                    realm_ok = TRUE;
-            }
-            if (host) {
-                if (gsignond_is_host_in_domain (host, item))
-                    host_ok = TRUE;
-            }
-        }
-        g_sequence_free (allowed_realms);
-    }
-    if (realm && !realm_ok) {
-        GError *error = g_error_new (GSIGNOND_ERROR,
-                                     GSIGNOND_ERROR_NOT_AUTHORIZED,
-                                     "Unauthorized realm");
-        gsignond_plugin_error (plugin, error);
-        g_error_free (error);
-        return;
-    }
-    if (host && !host_ok) {
-        GError *error = g_error_new (GSIGNOND_ERROR,
-                                     GSIGNOND_ERROR_NOT_AUTHORIZED,
-                                     "Unauthorized hostname");
-        gsignond_plugin_error (plugin, error);
-        g_error_free (error);
-        return;
+    GSignondSaslEngineResult result;
+
+    gsignond_sasl_engine_step (self->engine, session_data, mechanism, NULL,
+                               &result);
+    _emit_result (plugin, &result);
+}
+
+typedef struct {
+    GSignondSessionData *session_data;
+    gchar *mechanism;
+    gboolean is_final;
+} GSignondSaslStepData;
+
+static void
+_step_data_free (GSignondSaslStepData *data)
+{
+    gsignond_dictionary_unref (data->session_data);
+    g_free (data->mechanism);
+    g_slice_free (GSignondSaslStepData, data);
+}
+
+static void
+_step_thread (GTask *task,
+              gpointer source_object,
+              gpointer task_data,
+              GCancellable *cancellable)
+{
+    GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (source_object);
+    GSignondSaslStepData *data = task_data;
+    GSignondSessionData *response = NULL;
+    GSignondSaslEngineResult result;
+    GError *error = NULL;
+
+    gsignond_sasl_engine_step (self->engine, data->session_data,
+                               data->mechanism, cancellable, &result);
+    if (result.status == GSIGNOND_SASL_ENGINE_RESPONSE ||
+        result.status == GSIGNOND_SASL_ENGINE_RESPONSE_FINAL) {
+        data->is_final =
+            result.status == GSIGNOND_SASL_ENGINE_RESPONSE_FINAL;
+        response = _response_from_result (&result);
+    } else if (result.status == GSIGNOND_SASL_ENGINE_USER_ACTION) {
+        g_set_error (&error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_USER_INTERACTION,
+                     "%s is needed to continue", result.user_input_key);
+    } else {
+        error = result.error;
+        result.error = NULL;
     }
-    
-    _reset_session(self);
+    /* there is no store signal for the caller here, so the parameters to
+     * keep come with the final response */
+    if (response && result.store_data) {
+        guint32 iterations = 0;
 
-    int res = gsasl_client_start (self->gsasl_context, 
-                                  mechanism, &self->gsasl_session);
-    
-    if (res != GSASL_OK) {
-        GError *error = g_error_new (GSIGNOND_ERROR, 
-                                     GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
-                                     "Couldn't initialize gsasl session, error %d",
-                                     res);
-        gsignond_plugin_error (plugin, error); 
-        g_error_free (error);
-        return;
+        gsignond_dictionary_get_uint32 (result.store_data, "ScramIterations",
+                                        &iterations);
+        gsignond_dictionary_set_string (response, "ScramSalt",
+            gsignond_dictionary_get_string (result.store_data, "ScramSalt"));
+        gsignond_dictionary_set_uint32 (response, "ScramIterations",
+                                        iterations);
     }
-    gsignond_dictionary_ref(session_data);
-    self->session_data = session_data;
-    _do_gsasl_iteration(plugin, gsignond_dictionary_get_string(session_data, "ChallengeBase64"));
+    gsignond_sasl_engine_result_clear (&result);
+
+    if (error)
+        g_task_return_error (task, error);
+    else
+        g_task_return_pointer (task, response,
+                               (GDestroyNotify) gsignond_dictionary_unref);
 }
 
+/**
+ * gsignond_sasl_plugin_step_async:
+ * @self: a #GSignondSaslPlugin
+ * @session_data: the same mechanism-specific parameters that would be passed
+ * to gsignond_plugin_request_initial() or gsignond_plugin_request()
+ * @mechanism: (allow-none): mechanism name to start a new authorization
+ * sequence with, or %NULL to continue the current one
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the step is done
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronously performs one step of the authorization sequence in a worker
+ * thread, without going through the #GSignondPlugin signals. Steps issued on
+ * the same plugin object are serialized; use one plugin object per
+ * authorization sequence to run several of them in parallel.
+ *
+ * When the step is done @callback is invoked in the thread-default main
+ * context of the caller, and it should call gsignond_sasl_plugin_step_finish()
+ * to obtain the response.
+ */
+void
+gsignond_sasl_plugin_step_async (GSignondSaslPlugin *self,
+                                 GSignondSessionData *session_data,
+                                 const gchar *mechanism,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+    GSignondSaslStepData *data;
+    GTask *task;
+
+    g_return_if_fail (GSIGNOND_IS_SASL_PLUGIN (self));
+    g_return_if_fail (session_data != NULL);
+
+    data = g_slice_new0 (GSignondSaslStepData);
+    data->session_data = gsignond_dictionary_ref (session_data);
+    data->mechanism = g_strdup (mechanism);
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gsignond_sasl_plugin_step_async);
+    g_task_set_task_data (task, data, (GDestroyNotify) _step_data_free);
+    g_task_run_in_thread (task, _step_thread);
+    g_object_unref (task);
+}
+
+/**
+ * gsignond_sasl_plugin_step_finish:
+ * @self: a #GSignondSaslPlugin
+ * @result: the #GAsyncResult passed to the callback
+ * @is_final: (out) (allow-none): set to %TRUE if the response is final
+ * (the equivalent of #GSignondPlugin::response-final), %FALSE if the server
+ * is expected to issue another challenge
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with gsignond_sasl_plugin_step_async().
+ * The errors are the same as those issued via #GSignondPlugin::error signal.
+ *
+ * Returns: (transfer full): the response, with the same content as
+ * @session_data parameter of #GSignondPlugin::response or
+ * #GSignondPlugin::response-final signals, or %NULL on error. Release it with
+ * gsignond_dictionary_unref().
+ */
+GSignondSessionData *
+gsignond_sasl_plugin_step_finish (GSignondSaslPlugin *self,
+                                  GAsyncResult *result,
+                                  gboolean *is_final,
+                                  GError **error)
+{
+    GSignondSaslStepData *data;
+
+    g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+    data = g_task_get_task_data (G_TASK (result));
+    if (is_final)
+        *is_final = data->is_final;
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Resumes a session that was suspended for a missing credential */
 static void gsignond_sasl_plugin_user_action_finished (
     GSignondPlugin *plugin, 
     GSignondSessionData *session_data)
 {
-    GError* error = g_error_new(GSIGNOND_ERROR, 
-                            GSIGNOND_ERROR_WRONG_STATE,
-                            "SASL plugin doesn't support user actions");
-    gsignond_plugin_error (plugin, error); 
-    g_error_free(error);
-    return;
+    GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (plugin);
+    GSignondSaslEngineResult result;
+
+    gsignond_sasl_engine_user_action_finished (self->engine, session_data,
+                                               &result);
+    _emit_result (plugin, &result);
 }
 
+/* Re-authenticates with the mechanism and session data of the last
+ * successful authorization; only the challenge comes from @session_data */
 static void gsignond_sasl_plugin_refresh (
     GSignondPlugin *plugin, 
     GSignondSessionData *session_data)
 {
-    GError* error = g_error_new(GSIGNOND_ERROR, 
-                            GSIGNOND_ERROR_WRONG_STATE,
-                            "SASL plugin doesn't support refresh");
-    gsignond_plugin_error (plugin, error); 
-    g_error_free(error);
-    return;
+    GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (plugin);
+    GSignondSaslEngineResult result;
+
+    gsignond_sasl_engine_refresh (self->engine, session_data, &result);
+    _emit_result (plugin, &result);
 }
 
 static void
@@ -492,16 +863,28 @@ gsignond_plugin_interface_init (GSignondPluginInterface *iface)
 static void
 gsignond_sasl_plugin_init (GSignondSaslPlugin *self)
 {
-    self->gsasl_context = NULL;
-    self->gsasl_session = NULL;
-    int rc;
-     
-    if ((rc = gsasl_init (&self->gsasl_context)) != GSASL_OK) {
-        ERR ("Cannot initialize libgsasl (%d): %s",rc, gsasl_strerror (rc));
-    } else {
-        gsasl_callback_hook_set(self->gsasl_context, self);
-        gsasl_callback_set (self->gsasl_context, _gsasl_callback);
+    self->engine = gsignond_sasl_engine_new ();
+    gsignond_sasl_timer_wheel_entry_init (&self->idle_timer, G_OBJECT (self),
+                                          _on_session_expired);
+    gsignond_sasl_engine_set_idle_timer (self->engine, &self->idle_timer);
+}
+
+static void
+gsignond_sasl_plugin_dispose (GObject *gobject)
+{
+    GError *error = NULL;
+
+    /* the process may exit before the next periodic report, or before
+     * the keys added to the cache file are written out */
+    gsignond_sasl_log_flush ();
+    if (!gsignond_sasl_disk_cache_flush (&error)) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                           "Couldn't write key cache file: %s",
+                           error->message);
+        g_error_free (error);
     }
+
+    G_OBJECT_CLASS (gsignond_sasl_plugin_parent_class)->dispose (gobject);
 }
 
 static void
@@ -509,10 +892,9 @@ gsignond_sasl_plugin_finalize (GObject *gobject)
 {
     GSignondSaslPlugin *self = GSIGNOND_SASL_PLUGIN (gobject);
 
-    _reset_session(self);
-    if (self->gsasl_context)
-        gsasl_done(self->gsasl_context);
-        
+    gsignond_sasl_engine_free (self->engine);
+    gsignond_sasl_timer_wheel_entry_clear (&self->idle_timer);
+
     /* Chain up to the parent class */
     G_OBJECT_CLASS (gsignond_sasl_plugin_parent_class)->finalize (gobject);
 }
@@ -522,7 +904,10 @@ enum
     PROP_0,
     
     PROP_TYPE,
-    PROP_MECHANISMS
+    PROP_MECHANISMS,
+    PROP_IDLE_TIMEOUT,
+    PROP_STATISTICS,
+    PROP_HISTOGRAMS
 };
 
 static void
@@ -531,14 +916,286 @@ gsignond_sasl_plugin_set_property (GObject      *object,
                                        const GValue *value,
                                        GParamSpec   *pspec)
 {
+    GSignondSaslPlugin *sasl_plugin = GSIGNOND_SASL_PLUGIN (object);
+
     switch (property_id)
     {
+        case PROP_IDLE_TIMEOUT:
+            gsignond_sasl_engine_set_idle_timeout (sasl_plugin->engine,
+                                                   g_value_get_uint (value));
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
     }
 }
 
+static GVariant *
+_get_statistics (void)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    gsignond_sasl_engine_add_statistics (&builder);
+    gsignond_sasl_admission_add_statistics (&builder);
+    gsignond_sasl_key_cache_add_statistics (&builder);
+    gsignond_sasl_speculation_add_statistics (&builder);
+    gsignond_sasl_warmer_add_statistics (&builder);
+    g_variant_builder_add (&builder, "{sv}", "Mechanisms",
+                           gsignond_sasl_stats_to_variant ());
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * gsignond_sasl_plugin_dump_histograms:
+ * @path: file to write the histograms to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Writes the latency histograms of all SASL plugin objects in the process
+ * (see #GSignondSaslPlugin:histograms) to @path in a plain text format: a
+ * line with the sample count and p50, p90, p99, p999 and maximum latency in
+ * microseconds for every mechanism and phase, followed by a comment line
+ * with the non-empty buckets.
+ *
+ * Returns: %TRUE on success, %FALSE if the file couldn't be written.
+ */
+gboolean
+gsignond_sasl_plugin_dump_histograms (const gchar *path,
+                                      GError **error)
+{
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    return gsignond_sasl_stats_dump_histograms (path, error);
+}
+
+/**
+ * gsignond_sasl_plugin_get_server_outcomes:
+ * @hostname: (allow-none): "Hostname" of the server, as in the session data
+ * @realm: (allow-none): "Realm" of the server
+ * @service: (allow-none): "Service" of the server
+ *
+ * Returns what is known about the mechanisms used against a server by the
+ * plugins of this process. See "Per-server outcomes" in the description of
+ * #GSignondSaslPlugin.
+ *
+ * Returns: (transfer full): a #GVariant of type a{sv} keyed by mechanism
+ * name; empty if the server is not known
+ */
+GVariant *
+gsignond_sasl_plugin_get_server_outcomes (const gchar *hostname,
+                                          const gchar *realm,
+                                          const gchar *service)
+{
+    return g_variant_ref_sink (gsignond_sasl_outcomes_to_variant (hostname,
+                                                                  realm,
+                                                                  service));
+}
+
+/**
+ * gsignond_sasl_plugin_warm_key_cache:
+ * @session_data: session data of an identity: "UserName", "Secret",
+ * "ScramSalt", "ScramIterations" and "Mechanism" are used
+ *
+ * Queues the SCRAM key of the identity for derivation in the background,
+ * so that its first authorization doesn't have to wait for it. The key is
+ * that of the SCRAM mechanism named by "Mechanism" (as returned in the
+ * first response of the identity's last authorization), SCRAM-SHA-1 if it
+ * is missing.
+ * gSSO daemon is expected to call this when it loads the plugin for an
+ * identity whose SCRAM parameters it has stored. See "Key cache warming"
+ * above.
+ *
+ * Returns: %TRUE if the key will be derived, %FALSE if @session_data lacks
+ * the needed keys, names a mechanism other than SCRAM, the key is in the
+ * cache already or too many keys are queued.
+ */
+gboolean
+gsignond_sasl_plugin_warm_key_cache (GSignondSessionData *session_data)
+{
+    GChecksumType checksum_type;
+    const gchar *mechanism;
+    const gchar *salt_base64;
+    const gchar *secret;
+    char *prepped_secret = NULL;
+    guint32 iterations = 0;
+    guchar *salt;
+    gsize salt_len;
+    gboolean queued;
+
+    g_return_val_if_fail (session_data != NULL, FALSE);
+
+    mechanism = gsignond_dictionary_get_string (session_data, "Mechanism");
+    switch (mechanism ? gsignond_sasl_mechanism_from_name (mechanism)
+                      : GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1) {
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1_PLUS:
+            checksum_type = G_CHECKSUM_SHA1;
+            break;
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256_PLUS:
+            checksum_type = G_CHECKSUM_SHA256;
+            break;
+        default:
+            return FALSE;
+    }
+    salt_base64 = gsignond_dictionary_get_string (session_data, "ScramSalt");
+    secret = gsignond_session_data_get_secret (session_data);
+    if (salt_base64 == NULL || secret == NULL ||
+        !gsignond_dictionary_get_uint32 (session_data, "ScramIterations",
+                                         &iterations) ||
+        iterations == 0)
+        return FALSE;
+    if (gsasl_saslprep (secret, GSASL_ALLOW_UNASSIGNED,
+                        &prepped_secret, NULL) != GSASL_OK)
+        return FALSE;
+
+    salt = g_base64_decode (salt_base64, &salt_len);
+    queued = gsignond_sasl_warmer_add (
+        checksum_type, gsignond_session_data_get_username (session_data),
+        prepped_secret, salt, salt_len, iterations);
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    free (prepped_secret);
+    g_free (salt);
+    return queued;
+}
+
+/**
+ * gsignond_sasl_plugin_export_session:
+ * @self: a #GSignondSaslPlugin
+ * @error: return location for a #GError
+ *
+ * Serializes the SCRAM session in progress, so that another plugin,
+ * possibly in another process, can complete it with
+ * gsignond_sasl_plugin_import_session(). The session is left in place.
+ * See "Moving sessions" above.
+ *
+ * Returns: (transfer full): the state of the session, or %NULL with
+ * @error set if no SCRAM session waits for the server
+ */
+GBytes *
+gsignond_sasl_plugin_export_session (GSignondSaslPlugin *self,
+                                     GError **error)
+{
+    g_return_val_if_fail (GSIGNOND_IS_SASL_PLUGIN (self), NULL);
+
+    return gsignond_sasl_engine_export_session (self->engine, error);
+}
+
+/**
+ * gsignond_sasl_plugin_import_session:
+ * @self: a #GSignondSaslPlugin
+ * @state: a session state returned by gsignond_sasl_plugin_export_session()
+ * @session_data: the session data to continue the session with
+ * @error: return location for a #GError
+ *
+ * Replaces any session of @self with the one serialized in @state. The
+ * next gsignond_plugin_request() continues it with the challenge of the
+ * server that the exporting plugin was waiting for. @session_data provides
+ * the credentials, as it did to gsignond_plugin_request_initial(), and must
+ * name the same user.
+ *
+ * Returns: %TRUE if the session was imported, %FALSE with @error set if
+ * @state is not a valid session state or @session_data doesn't suit it
+ */
+gboolean
+gsignond_sasl_plugin_import_session (GSignondSaslPlugin *self,
+                                     GBytes *state,
+                                     GSignondSessionData *session_data,
+                                     GError **error)
+{
+    g_return_val_if_fail (GSIGNOND_IS_SASL_PLUGIN (self), FALSE);
+
+    return gsignond_sasl_engine_import_session (self->engine, state,
+                                                session_data, error);
+}
+
+/**
+ * gsignond_sasl_plugin_get_security_layer:
+ * @self: a #GSignondSaslPlugin
+ *
+ * Gives the security layer negotiated by the last authorization of @self,
+ * see "Security layer" above. It stays valid until the next
+ * gsignond_plugin_request_initial() or until @self is destroyed, and must
+ * not be used while a step of @self is running.
+ *
+ * Returns: (transfer none): the security layer, or %NULL if the last
+ * authorization didn't negotiate one
+ */
+GSignondSaslSecurityLayer *
+gsignond_sasl_plugin_get_security_layer (GSignondSaslPlugin *self)
+{
+    g_return_val_if_fail (GSIGNOND_IS_SASL_PLUGIN (self), NULL);
+
+    return gsignond_sasl_engine_get_security_layer (self->engine);
+}
+
+/**
+ * gsignond_sasl_plugin_report_verdict:
+ * @self: a #GSignondSaslPlugin
+ * @accepted: whether the server accepted the authorization
+ *
+ * Reports whether the server accepted the last authorization of @self,
+ * which the plugin can't tell by itself for mechanisms that don't verify
+ * the server, see "Per-server outcomes" above. It is ignored if the last
+ * authorization has already been counted, or if another one has started
+ * since.
+ */
+void
+gsignond_sasl_plugin_report_verdict (GSignondSaslPlugin *self,
+                                     gboolean accepted)
+{
+    g_return_if_fail (GSIGNOND_IS_SASL_PLUGIN (self));
+
+    gsignond_sasl_engine_report_verdict (self->engine, accepted);
+}
+
+/**
+ * gsignond_sasl_plugin_step_sealed:
+ * @session_data: the session data of the step: credentials and
+ * "ChallengeBase64" as for gsignond_plugin_request_initial()
+ * @mechanism: (allow-none): the mechanism to start a sequence with, or
+ * %NULL to continue the sequence of @state
+ * @state: (allow-none): the sealed state returned by the previous step,
+ * %NULL when starting a sequence
+ * @next_state: (out) (transfer full): return location for the sealed state
+ * to pass to the next step, %NULL after the final step
+ * @is_final: (out): return location for whether the response is final
+ * @error: return location for a #GError
+ *
+ * Performs one step of an authorization sequence without keeping anything
+ * in the plugin, so that the steps of a sequence can be served by different
+ * processes. See "Sealed session state" above.
+ *
+ * Returns: (transfer full): the response, or %NULL with @error set
+ */
+GSignondSessionData *
+gsignond_sasl_plugin_step_sealed (GSignondSessionData *session_data,
+                                  const gchar *mechanism,
+                                  GBytes *state,
+                                  GBytes **next_state,
+                                  gboolean *is_final,
+                                  GError **error)
+{
+    GSignondSaslMechanism mechanism_id = GSIGNOND_SASL_MECHANISM_OTHER;
+
+    g_return_val_if_fail (session_data != NULL, NULL);
+    g_return_val_if_fail (mechanism != NULL || state != NULL, NULL);
+    g_return_val_if_fail (next_state != NULL && is_final != NULL, NULL);
+
+    if (state == NULL) {
+        mechanism_id = gsignond_sasl_mechanism_from_name (mechanism);
+        if (!gsignond_sasl_stateless_is_supported (mechanism_id)) {
+            g_set_error (error, GSIGNOND_ERROR,
+                         GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                         "%s mechanism can't run with a sealed state",
+                         mechanism);
+            return NULL;
+        }
+    }
+    return gsignond_sasl_stateless_step (session_data, mechanism_id, state,
+                                         next_state, is_final, error);
+}
+
 static void
 gsignond_sasl_plugin_get_property (GObject    *object,
                                        guint       prop_id,
@@ -547,27 +1204,28 @@ gsignond_sasl_plugin_get_property (GObject    *object,
 {
     GSignondSaslPlugin *sasl_plugin = GSIGNOND_SASL_PLUGIN (object);
 
-    gchar *empty_mechanisms[] = { NULL };
-    char *mechanisms;
-    
     switch (prop_id)
     {
         case PROP_TYPE:
-            if (sasl_plugin->gsasl_context)
+            if (gsignond_sasl_engine_is_initialized (sasl_plugin->engine))
                 g_value_set_string (value, "sasl");
             else
                 g_value_set_string (value, "");
             break;
         case PROP_MECHANISMS:
-            if (sasl_plugin->gsasl_context &&
-                gsasl_client_mechlist (sasl_plugin->gsasl_context, 
-                                       &mechanisms) == GSASL_OK) {
-                gchar ** mechanism_list = g_strsplit(mechanisms, " ", 0);
-                g_value_set_boxed(value, mechanism_list);
-                g_strfreev(mechanism_list);
-                free(mechanisms);
-            } else
-                g_value_set_boxed (value, empty_mechanisms);
+            g_value_take_boxed (value, gsignond_sasl_engine_get_mechanisms (
+                                           sasl_plugin->engine));
+            break;
+        case PROP_IDLE_TIMEOUT:
+            g_value_set_uint (value, gsignond_sasl_engine_get_idle_timeout (
+                                         sasl_plugin->engine));
+            break;
+        case PROP_STATISTICS:
+            g_value_take_variant (value, _get_statistics ());
+            break;
+        case PROP_HISTOGRAMS:
+            g_value_take_variant (value, g_variant_ref_sink (
+                gsignond_sasl_stats_histograms_to_variant ()));
             break;
             
         default:
@@ -583,9 +1241,52 @@ gsignond_sasl_plugin_class_init (GSignondSaslPluginClass *klass)
     
     gobject_class->set_property = gsignond_sasl_plugin_set_property;
     gobject_class->get_property = gsignond_sasl_plugin_get_property;
+    gobject_class->dispose = gsignond_sasl_plugin_dispose;
     gobject_class->finalize = gsignond_sasl_plugin_finalize;
+
+    gsignond_sasl_log_init ();
     
     g_object_class_override_property (gobject_class, PROP_TYPE, "type");
     g_object_class_override_property (gobject_class, PROP_MECHANISMS, 
                                       "mechanisms");
+
+    /**
+     * GSignondSaslPlugin:idle-timeout:
+     *
+     * Number of seconds a session may wait for the next challenge from the
+     * server before it's discarded, unless overridden with "IdleTimeout" in
+     * @session_data. 0 disables the timeout.
+     */
+    g_object_class_install_property (gobject_class, PROP_IDLE_TIMEOUT,
+        g_param_spec_uint ("idle-timeout", "Idle timeout",
+                           "Session idle timeout in seconds",
+                           0, G_MAXUINT,
+                           GSIGNOND_SASL_ENGINE_DEFAULT_IDLE_TIMEOUT,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    /**
+     * GSignondSaslPlugin:statistics:
+     *
+     * Runtime statistics of all SASL plugin objects in the process, as a
+     * dictionary (#GVariant of type a{sv}). See "Statistics" in the
+     * plugin description for its content.
+     */
+    g_object_class_install_property (gobject_class, PROP_STATISTICS,
+        g_param_spec_variant ("statistics", "Statistics",
+                              "Runtime statistics of the plugin",
+                              G_VARIANT_TYPE_VARDICT, NULL,
+                              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+    /**
+     * GSignondSaslPlugin:histograms:
+     *
+     * Latency histograms of all SASL plugin objects in the process, as a
+     * dictionary (#GVariant of type a{sv}). See "Latency histograms" in the
+     * plugin description for its content.
+     */
+    g_object_class_install_property (gobject_class, PROP_HISTOGRAMS,
+        g_param_spec_variant ("histograms", "Histograms",
+                              "Latency histograms of the plugin",
+                              G_VARIANT_TYPE_VARDICT, NULL,
+                              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
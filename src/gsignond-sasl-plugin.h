@@ -27,9 +27,14 @@
 #define __GSIGNOND_SASL_PLUGIN_H__
 
 #include <glib-object.h>
-#include <gsasl.h>
+#include <gio/gio.h>
 #include <gsignond/gsignond-plugin-interface.h>
 
+#include "gsignond-sasl-engine.h"
+#include "gsignond-sasl-mechanisms.h"
+#include "gsignond-sasl-security-layer.h"
+#include "gsignond-sasl-timer-wheel.h"
+
 
 #define GSIGNOND_TYPE_SASL_PLUGIN             (gsignond_sasl_plugin_get_type ())
 #define GSIGNOND_SASL_PLUGIN(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), GSIGNOND_TYPE_SASL_PLUGIN, GSignondSaslPlugin))
@@ -55,9 +60,8 @@ struct _GSignondSaslPlugin
 {
     GObject parent_instance;
     
-    Gsasl *gsasl_context;
-    Gsasl_session *gsasl_session;
-    GSignondDictionary* session_data;
+    GSignondSaslEngine *engine;
+    GSignondSaslTimerWheelEntry idle_timer;
 };
 
 struct _GSignondSaslPluginClass
@@ -68,4 +72,55 @@ struct _GSignondSaslPluginClass
 
 GType gsignond_sasl_plugin_get_type (void);
 
+void
+gsignond_sasl_plugin_step_async (GSignondSaslPlugin *self,
+                                 GSignondSessionData *session_data,
+                                 const gchar *mechanism,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data);
+
+GSignondSessionData *
+gsignond_sasl_plugin_step_finish (GSignondSaslPlugin *self,
+                                  GAsyncResult *result,
+                                  gboolean *is_final,
+                                  GError **error);
+
+gboolean
+gsignond_sasl_plugin_dump_histograms (const gchar *path,
+                                      GError **error);
+
+GVariant *
+gsignond_sasl_plugin_get_server_outcomes (const gchar *hostname,
+                                          const gchar *realm,
+                                          const gchar *service);
+
+gboolean
+gsignond_sasl_plugin_warm_key_cache (GSignondSessionData *session_data);
+
+GBytes *
+gsignond_sasl_plugin_export_session (GSignondSaslPlugin *self,
+                                     GError **error);
+
+gboolean
+gsignond_sasl_plugin_import_session (GSignondSaslPlugin *self,
+                                     GBytes *state,
+                                     GSignondSessionData *session_data,
+                                     GError **error);
+
+GSignondSaslSecurityLayer *
+gsignond_sasl_plugin_get_security_layer (GSignondSaslPlugin *self);
+
+void
+gsignond_sasl_plugin_report_verdict (GSignondSaslPlugin *self,
+                                     gboolean accepted);
+
+GSignondSessionData *
+gsignond_sasl_plugin_step_sealed (GSignondSessionData *session_data,
+                                  const gchar *mechanism,
+                                  GBytes *state,
+                                  GBytes **next_state,
+                                  gboolean *is_final,
+                                  GError **error);
+
 #endif /* __GSIGNOND_SASL_PLUGIN_H__ */
\ No newline at end of file
@@ -0,0 +1,73 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_PROBES_H__
+#define __GSIGNOND_SASL_PROBES_H__
+
+/*
+ * USDT static probes of provider "gsignond_sasl", for tracing the plugin
+ * with SystemTap or bpftrace (see examples/bpftrace). They are compiled in
+ * with --enable-sdt-probes; a probe site is then a single nop instruction
+ * until a tracer attaches to it. Without that option they expand to nothing.
+ *
+ * The first argument of every probe is the session id, which is unique
+ * within the process.
+ *
+ * request__initial  (session_id, mechanism)
+ * step__start       (session_id, mechanism, step)
+ * step__done        (session_id, mechanism, step, gsasl_result, duration_us)
+ * callback          (session_id, gsasl_property, gsasl_result)
+ * session__reset    (session_id, mechanism)
+ * cancel            (session_id)
+ * error             (session_id, error_code)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SDT_PROBES
+
+#include <sys/sdt.h>
+
+#define GSIGNOND_SASL_PROBE1(name, a1) \
+    STAP_PROBE1 (gsignond_sasl, name, a1)
+#define GSIGNOND_SASL_PROBE2(name, a1, a2) \
+    STAP_PROBE2 (gsignond_sasl, name, a1, a2)
+#define GSIGNOND_SASL_PROBE3(name, a1, a2, a3) \
+    STAP_PROBE3 (gsignond_sasl, name, a1, a2, a3)
+#define GSIGNOND_SASL_PROBE5(name, a1, a2, a3, a4, a5) \
+    STAP_PROBE5 (gsignond_sasl, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define GSIGNOND_SASL_PROBE1(name, a1) do {} while (0)
+#define GSIGNOND_SASL_PROBE2(name, a1, a2) do {} while (0)
+#define GSIGNOND_SASL_PROBE3(name, a1, a2, a3) do {} while (0)
+#define GSIGNOND_SASL_PROBE5(name, a1, a2, a3, a4, a5) do {} while (0)
+
+#endif
+
+#endif /* __GSIGNOND_SASL_PROBES_H__ */
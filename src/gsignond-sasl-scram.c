@@ -0,0 +1,734 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Client side of SCRAM (RFC 5802, and RFC 7677 for SCRAM-SHA-256).
+ *
+ * Unlike a libgsasl session, everything a SCRAM exchange needs between two
+ * steps is kept in a small plain structure: the GS2 header and channel
+ * binding data, the client nonce, the client-first-message-bare, the
+ * AuthMessage and the server signature expected at the end. No password or
+ * key derived from it is kept. gsignond_sasl_scram_export() serializes that
+ * state into a versioned GVariant, and gsignond_sasl_scram_import() restores
+ * it, possibly in another process, so that an exchange can continue
+ * there. The serialized state is not protected here: the callers seal it,
+ * and check with gsignond_sasl_scram_check_user() that it is resumed for
+ * the user it was started for.
+ *
+ * The salted password is not derived here: the caller gets the salt and
+ * iteration count from gsignond_sasl_scram_parse_server_first(), which
+ * doesn't change the state, and passes the key to
+ * gsignond_sasl_scram_client_final().
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gsasl.h>
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-scram.h"
+
+#ifdef WITH_SCRAM_ENGINE
+
+#define STATE_FORMAT "(yyysaysssay)"
+#define NONCE_SIZE 18
+#define MAX_DIGEST_SIZE 32
+
+typedef struct {
+    const gchar *name;
+    GChecksumType checksum_type;
+    gboolean plus;
+} GSignondSaslScramMechanism;
+
+static const GSignondSaslScramMechanism scram_mechanisms[] = {
+    { "SCRAM-SHA-1", G_CHECKSUM_SHA1, FALSE },
+    { "SCRAM-SHA-1-PLUS", G_CHECKSUM_SHA1, TRUE },
+    { "SCRAM-SHA-256", G_CHECKSUM_SHA256, FALSE },
+    { "SCRAM-SHA-256-PLUS", G_CHECKSUM_SHA256, TRUE },
+};
+
+struct _GSignondSaslScram {
+    guint mechanism;
+    GSignondSaslScramState state;
+    gchar *gs2_header;
+    guchar *cb_data;
+    gsize cb_data_len;
+    gchar *client_nonce;
+    gchar *client_first_bare;
+    gchar *auth_message;
+    guint8 server_signature[MAX_DIGEST_SIZE];
+    gsize server_signature_len;
+};
+
+static gint
+_find_mechanism (const gchar *name)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (scram_mechanisms); i++) {
+        if (g_strcmp0 (scram_mechanisms[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+gboolean
+gsignond_sasl_scram_is_supported (const gchar *mechanism)
+{
+    return _find_mechanism (mechanism) >= 0;
+}
+
+/* SASLprep, then '=' and ',' escaped as required in SCRAM attributes */
+static gchar *
+_prepare_name (const gchar *name)
+{
+    char *prepped = NULL;
+    GString *escaped;
+    const gchar *p;
+
+    if (gsasl_saslprep (name, GSASL_ALLOW_UNASSIGNED, &prepped, NULL) !=
+        GSASL_OK)
+        return NULL;
+    escaped = g_string_sized_new (strlen (prepped));
+    for (p = prepped; *p; p++) {
+        if (*p == '=')
+            g_string_append (escaped, "=3D");
+        else if (*p == ',')
+            g_string_append (escaped, "=2C");
+        else
+            g_string_append_c (escaped, *p);
+    }
+    free (prepped);
+    return g_string_free (escaped, FALSE);
+}
+
+static gchar *
+_gs2_header (guint mechanism,
+             const gchar *authz)
+{
+    return g_strdup_printf (
+        "%s,%s%s,", scram_mechanisms[mechanism].plus ? "p=tls-unique" : "n",
+        authz ? "a=" : "", authz ? authz : "");
+}
+
+static gsize
+_digest_len (GSignondSaslScram *scram)
+{
+    return g_checksum_type_get_length (
+        scram_mechanisms[scram->mechanism].checksum_type);
+}
+
+static void
+_hmac (GChecksumType checksum_type,
+       const guint8 *key,
+       gsize key_len,
+       const gchar *data,
+       guint8 *output)
+{
+    GHmac *hmac = g_hmac_new (checksum_type, key, key_len);
+    gsize len = g_checksum_type_get_length (checksum_type);
+
+    g_hmac_update (hmac, (const guchar *) data, -1);
+    g_hmac_get_digest (hmac, output, &len);
+    g_hmac_unref (hmac);
+}
+
+static gboolean
+_fail (GError **error, const gchar *message)
+{
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                 "SCRAM: %s", message);
+    return FALSE;
+}
+
+GSignondSaslScram *
+gsignond_sasl_scram_new (const gchar *mechanism,
+                         const gchar *username,
+                         const gchar *authzid,
+                         const gchar *cb_data_base64,
+                         GError **error)
+{
+    GSignondSaslScram *scram;
+    gchar *name;
+    gchar *authz = NULL;
+    gchar nonce[NONCE_SIZE];
+    gint index = _find_mechanism (mechanism);
+
+    g_return_val_if_fail (index >= 0, NULL);
+
+    name = _prepare_name (username ? username : "");
+    if (authzid)
+        authz = _prepare_name (authzid);
+    if (name == NULL || (authzid && authz == NULL)) {
+        g_free (name);
+        g_free (authz);
+        _fail (error, "invalid user name");
+        return NULL;
+    }
+    if (scram_mechanisms[index].plus && cb_data_base64 == NULL) {
+        g_free (name);
+        g_free (authz);
+        _fail (error, "channel binding data is missing");
+        return NULL;
+    }
+    if (gsasl_nonce (nonce, sizeof (nonce)) != GSASL_OK) {
+        g_free (name);
+        g_free (authz);
+        _fail (error, "couldn't generate a nonce");
+        return NULL;
+    }
+
+    scram = g_slice_new0 (GSignondSaslScram);
+    scram->mechanism = index;
+    scram->state = GSIGNOND_SASL_SCRAM_STATE_INITIAL;
+    scram->gs2_header = _gs2_header (index, authz);
+    if (scram_mechanisms[index].plus)
+        scram->cb_data = g_base64_decode (cb_data_base64,
+                                          &scram->cb_data_len);
+    scram->client_nonce = g_base64_encode ((const guchar *) nonce,
+                                           sizeof (nonce));
+    scram->client_first_bare = g_strdup_printf ("n=%s,r=%s", name,
+                                                scram->client_nonce);
+    g_free (name);
+    g_free (authz);
+    return scram;
+}
+
+void
+gsignond_sasl_scram_free (GSignondSaslScram *scram)
+{
+    if (scram == NULL)
+        return;
+    g_free (scram->gs2_header);
+    g_free (scram->cb_data);
+    g_free (scram->client_nonce);
+    g_free (scram->client_first_bare);
+    g_free (scram->auth_message);
+    memset (scram->server_signature, 0, sizeof (scram->server_signature));
+    g_slice_free (GSignondSaslScram, scram);
+}
+
+const gchar *
+gsignond_sasl_scram_get_mechanism (GSignondSaslScram *scram)
+{
+    g_return_val_if_fail (scram != NULL, NULL);
+
+    return scram_mechanisms[scram->mechanism].name;
+}
+
+GChecksumType
+gsignond_sasl_scram_get_checksum_type (GSignondSaslScram *scram)
+{
+    g_return_val_if_fail (scram != NULL, G_CHECKSUM_SHA1);
+
+    return scram_mechanisms[scram->mechanism].checksum_type;
+}
+
+GSignondSaslScramState
+gsignond_sasl_scram_get_state (GSignondSaslScram *scram)
+{
+    g_return_val_if_fail (scram != NULL, GSIGNOND_SASL_SCRAM_STATE_DONE);
+
+    return scram->state;
+}
+
+/* Returns the client-first-message */
+gchar *
+gsignond_sasl_scram_client_first (GSignondSaslScram *scram)
+{
+    g_return_val_if_fail (scram != NULL, NULL);
+    g_return_val_if_fail (
+        scram->state == GSIGNOND_SASL_SCRAM_STATE_INITIAL, NULL);
+
+    scram->state = GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT;
+    return g_strconcat (scram->gs2_header, scram->client_first_bare, NULL);
+}
+
+/* Splits server-first-message into the combined nonce, the salt and the
+ * iteration count; extensions after those are ignored */
+static gboolean
+_parse_server_first (GSignondSaslScram *scram,
+                     const gchar *server_first,
+                     const gchar **nonce,
+                     gsize *nonce_len,
+                     const gchar **salt,
+                     gsize *salt_len,
+                     guint *iterations,
+                     GError **error)
+{
+    const gchar *p = server_first;
+    const gchar *end;
+    guint64 value;
+    gchar *iter_end;
+
+    if (server_first == NULL)
+        return _fail (error, "server-first-message is missing");
+    if (g_str_has_prefix (p, "m="))
+        return _fail (error, "unsupported mandatory extension");
+    if (!g_str_has_prefix (p, "r="))
+        return _fail (error, "nonce is missing");
+    p += 2;
+    end = strchr (p, ',');
+    if (end == NULL)
+        return _fail (error, "salt is missing");
+    *nonce = p;
+    *nonce_len = end - p;
+    if (*nonce_len <= strlen (scram->client_nonce) ||
+        strncmp (p, scram->client_nonce, strlen (scram->client_nonce)) != 0)
+        return _fail (error, "server nonce doesn't extend the client nonce");
+
+    p = end + 1;
+    if (!g_str_has_prefix (p, "s="))
+        return _fail (error, "salt is missing");
+    p += 2;
+    end = strchr (p, ',');
+    if (end == NULL || end == p)
+        return _fail (error, "iteration count is missing");
+    *salt = p;
+    *salt_len = end - p;
+
+    p = end + 1;
+    if (!g_str_has_prefix (p, "i=") || !g_ascii_isdigit (p[2]))
+        return _fail (error, "iteration count is missing");
+    value = g_ascii_strtoull (p + 2, &iter_end, 10);
+    if ((*iter_end != '\0' && *iter_end != ',') ||
+        value == 0 || value > G_MAXUINT)
+        return _fail (error, "invalid iteration count");
+    *iterations = (guint) value;
+    return TRUE;
+}
+
+/* Returns the salt (base64) and iteration count the server sent; the state
+ * is left as it was */
+gboolean
+gsignond_sasl_scram_parse_server_first (GSignondSaslScram *scram,
+                                        const gchar *server_first,
+                                        gchar **salt_base64,
+                                        guint *iterations,
+                                        GError **error)
+{
+    const gchar *nonce;
+    const gchar *salt;
+    gsize nonce_len;
+    gsize salt_len;
+
+    g_return_val_if_fail (scram != NULL, FALSE);
+
+    if (scram->state != GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT)
+        return _fail (error, "unexpected server-first-message");
+    if (!_parse_server_first (scram, server_first, &nonce, &nonce_len,
+                              &salt, &salt_len, iterations, error))
+        return FALSE;
+    *salt_base64 = g_strndup (salt, salt_len);
+    return TRUE;
+}
+
+/* Returns client-final-message with the proof computed from
+ * @salted_password; afterwards only the server's signature is awaited */
+gchar *
+gsignond_sasl_scram_client_final (GSignondSaslScram *scram,
+                                  const gchar *server_first,
+                                  const guint8 *salted_password,
+                                  gsize salted_password_len,
+                                  GError **error)
+{
+    GChecksumType checksum_type;
+    const gchar *nonce;
+    const gchar *salt;
+    gsize nonce_len;
+    gsize salt_len;
+    gsize digest_len;
+    guint iterations;
+    guint8 client_key[MAX_DIGEST_SIZE];
+    guint8 stored_key[MAX_DIGEST_SIZE];
+    guint8 signature[MAX_DIGEST_SIZE];
+    guint8 server_key[MAX_DIGEST_SIZE];
+    GChecksum *checksum;
+    GByteArray *cbind_input;
+    gchar *cbind;
+    gchar *without_proof;
+    gchar *proof;
+    gchar *message;
+    gsize i;
+
+    g_return_val_if_fail (scram != NULL, NULL);
+
+    if (scram->state != GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT) {
+        _fail (error, "unexpected server-first-message");
+        return NULL;
+    }
+    digest_len = _digest_len (scram);
+    if (salted_password_len != digest_len) {
+        _fail (error, "salted password has a wrong size");
+        return NULL;
+    }
+    if (!_parse_server_first (scram, server_first, &nonce, &nonce_len,
+                              &salt, &salt_len, &iterations, error))
+        return NULL;
+    checksum_type = scram_mechanisms[scram->mechanism].checksum_type;
+
+    cbind_input = g_byte_array_new ();
+    g_byte_array_append (cbind_input, (const guint8 *) scram->gs2_header,
+                         strlen (scram->gs2_header));
+    if (scram->cb_data)
+        g_byte_array_append (cbind_input, scram->cb_data,
+                             scram->cb_data_len);
+    cbind = g_base64_encode (cbind_input->data, cbind_input->len);
+    g_byte_array_free (cbind_input, TRUE);
+    without_proof = g_strdup_printf ("c=%s,r=%.*s", cbind, (int) nonce_len,
+                                     nonce);
+    g_free (cbind);
+
+    g_free (scram->auth_message);
+    scram->auth_message = g_strjoin (",", scram->client_first_bare,
+                                     server_first, without_proof, NULL);
+
+    /* ClientProof = ClientKey XOR HMAC(H(ClientKey), AuthMessage) */
+    _hmac (checksum_type, salted_password, digest_len, "Client Key",
+           client_key);
+    checksum = g_checksum_new (checksum_type);
+    g_checksum_update (checksum, client_key, digest_len);
+    g_checksum_get_digest (checksum, stored_key, &digest_len);
+    g_checksum_free (checksum);
+    _hmac (checksum_type, stored_key, digest_len, scram->auth_message,
+           signature);
+    for (i = 0; i < digest_len; i++)
+        client_key[i] ^= signature[i];
+    proof = g_base64_encode (client_key, digest_len);
+
+    /* ServerSignature = HMAC(HMAC(SaltedPassword, "Server Key"), AuthMessage) */
+    _hmac (checksum_type, salted_password, digest_len, "Server Key",
+           server_key);
+    _hmac (checksum_type, server_key, digest_len, scram->auth_message,
+           scram->server_signature);
+    scram->server_signature_len = digest_len;
+
+    message = g_strdup_printf ("%s,p=%s", without_proof, proof);
+    g_free (without_proof);
+    g_free (proof);
+    memset (client_key, 0, sizeof (client_key));
+    memset (stored_key, 0, sizeof (stored_key));
+    memset (signature, 0, sizeof (signature));
+    memset (server_key, 0, sizeof (server_key));
+
+    scram->state = GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT;
+    return message;
+}
+
+/* Checks the server's signature, which proves that it knows the password
+ * too */
+gboolean
+gsignond_sasl_scram_verify_server_final (GSignondSaslScram *scram,
+                                         const gchar *server_final,
+                                         GError **error)
+{
+    guchar *verifier;
+    gsize verifier_len;
+    guint8 diff = 0;
+    gsize i;
+
+    g_return_val_if_fail (scram != NULL, FALSE);
+
+    if (scram->state != GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT)
+        return _fail (error, "unexpected server-final-message");
+    if (server_final == NULL)
+        return _fail (error, "server-final-message is missing");
+    if (g_str_has_prefix (server_final, "e=")) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "SCRAM: server rejected the authentication: %s",
+                     server_final + 2);
+        return FALSE;
+    }
+    if (!g_str_has_prefix (server_final, "v="))
+        return _fail (error, "server signature is missing");
+
+    verifier = g_base64_decode (server_final + 2, &verifier_len);
+    if (verifier_len != scram->server_signature_len) {
+        g_free (verifier);
+        return _fail (error, "invalid server signature");
+    }
+    for (i = 0; i < verifier_len; i++)
+        diff |= verifier[i] ^ scram->server_signature[i];
+    g_free (verifier);
+    if (diff != 0)
+        return _fail (error, "server signature doesn't match");
+
+    scram->state = GSIGNOND_SASL_SCRAM_STATE_DONE;
+    return TRUE;
+}
+
+/* Serializes the state of the exchange; it holds nothing the password can
+ * be recovered from without a dictionary attack, but does let the exchange
+ * be completed, and the server signature in it lets the password be
+ * guessed offline, so it has to be sealed by the caller */
+GBytes *
+gsignond_sasl_scram_export (GSignondSaslScram *scram)
+{
+    GVariant *state;
+    GBytes *bytes;
+
+    g_return_val_if_fail (scram != NULL, NULL);
+
+    state = g_variant_new (
+        STATE_FORMAT,
+        (guchar) GSIGNOND_SASL_SCRAM_STATE_VERSION,
+        (guchar) scram->mechanism,
+        (guchar) scram->state,
+        scram->gs2_header,
+        g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                   scram->cb_data ? scram->cb_data
+                                                  : (guchar *) "",
+                                   scram->cb_data_len, 1),
+        scram->client_nonce,
+        scram->client_first_bare,
+        scram->auth_message ? scram->auth_message : "",
+        g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                   scram->server_signature,
+                                   scram->server_signature_len, 1));
+    g_variant_ref_sink (state);
+    bytes = g_variant_get_data_as_bytes (state);
+    g_variant_unref (state);
+    return bytes;
+}
+
+GSignondSaslScram *
+gsignond_sasl_scram_import (GBytes *bytes,
+                            GError **error)
+{
+    GSignondSaslScram *scram = NULL;
+    GVariant *state;
+    GVariant *cb_data;
+    GVariant *signature;
+    guchar version;
+    guchar mechanism;
+    guchar scram_state;
+    const gchar *gs2_header;
+    const gchar *client_nonce;
+    const gchar *client_first_bare;
+    const gchar *auth_message;
+    gconstpointer data;
+    gsize cb_data_len;
+    gsize signature_len;
+
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    state = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (STATE_FORMAT), bytes, FALSE));
+    if (!g_variant_is_normal_form (state)) {
+        g_variant_unref (state);
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "SCRAM session state is malformed");
+        return NULL;
+    }
+    g_variant_get (state, "(yyy&s@ay&s&s&s@ay)", &version, &mechanism,
+                   &scram_state, &gs2_header, &cb_data, &client_nonce,
+                   &client_first_bare, &auth_message, &signature);
+    g_variant_get_fixed_array (signature, &signature_len, 1);
+
+    if (version != GSIGNOND_SASL_SCRAM_STATE_VERSION ||
+        mechanism >= G_N_ELEMENTS (scram_mechanisms) ||
+        scram_state > GSIGNOND_SASL_SCRAM_STATE_DONE ||
+        *client_nonce == '\0' ||
+        signature_len > MAX_DIGEST_SIZE ||
+        (scram_state >= GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT &&
+         signature_len != g_checksum_type_get_length (
+             scram_mechanisms[mechanism].checksum_type))) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Unsupported SCRAM session state (version %u)",
+                     version);
+        goto out;
+    }
+
+    scram = g_slice_new0 (GSignondSaslScram);
+    scram->mechanism = mechanism;
+    scram->state = scram_state;
+    scram->gs2_header = g_strdup (gs2_header);
+    data = g_variant_get_fixed_array (cb_data, &cb_data_len, 1);
+    if (cb_data_len > 0) {
+        scram->cb_data = g_malloc (cb_data_len);
+        memcpy (scram->cb_data, data, cb_data_len);
+        scram->cb_data_len = cb_data_len;
+    }
+    scram->client_nonce = g_strdup (client_nonce);
+    scram->client_first_bare = g_strdup (client_first_bare);
+    if (*auth_message)
+        scram->auth_message = g_strdup (auth_message);
+    data = g_variant_get_fixed_array (signature, &signature_len, 1);
+    memcpy (scram->server_signature, data, signature_len);
+    scram->server_signature_len = signature_len;
+
+out:
+    g_variant_unref (cb_data);
+    g_variant_unref (signature);
+    g_variant_unref (state);
+    return scram;
+}
+
+/* Checks that @scram was started for @username and @authzid, as written in
+ * the client-first message, before an imported exchange continues */
+gboolean
+gsignond_sasl_scram_check_user (GSignondSaslScram *scram,
+                                const gchar *username,
+                                const gchar *authzid,
+                                GError **error)
+{
+    gchar *name;
+    gchar *authz = NULL;
+    gchar *expected;
+    gboolean matches = FALSE;
+
+    g_return_val_if_fail (scram != NULL, FALSE);
+
+    name = _prepare_name (username ? username : "");
+    if (authzid)
+        authz = _prepare_name (authzid);
+    if (name && (authzid == NULL || authz)) {
+        expected = g_strdup_printf ("n=%s,", name);
+        matches = g_str_has_prefix (scram->client_first_bare, expected);
+        g_free (expected);
+        expected = _gs2_header (scram->mechanism, authz);
+        matches = matches && g_strcmp0 (scram->gs2_header, expected) == 0;
+        g_free (expected);
+    }
+    g_free (name);
+    g_free (authz);
+    if (!matches)
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "SCRAM session state belongs to another user");
+    return matches;
+}
+
+#else /* WITH_SCRAM_ENGINE */
+
+/* --with-mechanisms left all the SCRAM mechanisms out */
+
+static GSignondSaslScram *
+_not_built (GError **error)
+{
+    g_set_error (error, GSIGNOND_ERROR,
+                 GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                 "SCRAM was left out of this build");
+    return NULL;
+}
+
+gboolean
+gsignond_sasl_scram_is_supported (const gchar *mechanism)
+{
+    return FALSE;
+}
+
+GSignondSaslScram *
+gsignond_sasl_scram_new (const gchar *mechanism,
+                         const gchar *username,
+                         const gchar *authzid,
+                         const gchar *cb_data_base64,
+                         GError **error)
+{
+    return _not_built (error);
+}
+
+void
+gsignond_sasl_scram_free (GSignondSaslScram *scram)
+{
+}
+
+const gchar *
+gsignond_sasl_scram_get_mechanism (GSignondSaslScram *scram)
+{
+    g_return_val_if_reached (NULL);
+}
+
+GChecksumType
+gsignond_sasl_scram_get_checksum_type (GSignondSaslScram *scram)
+{
+    g_return_val_if_reached (G_CHECKSUM_SHA1);
+}
+
+GSignondSaslScramState
+gsignond_sasl_scram_get_state (GSignondSaslScram *scram)
+{
+    g_return_val_if_reached (GSIGNOND_SASL_SCRAM_STATE_DONE);
+}
+
+gchar *
+gsignond_sasl_scram_client_first (GSignondSaslScram *scram)
+{
+    g_return_val_if_reached (NULL);
+}
+
+gboolean
+gsignond_sasl_scram_parse_server_first (GSignondSaslScram *scram,
+                                        const gchar *server_first,
+                                        gchar **salt_base64,
+                                        guint *iterations,
+                                        GError **error)
+{
+    g_return_val_if_reached (FALSE);
+}
+
+gchar *
+gsignond_sasl_scram_client_final (GSignondSaslScram *scram,
+                                  const gchar *server_first,
+                                  const guint8 *salted_password,
+                                  gsize salted_password_len,
+                                  GError **error)
+{
+    g_return_val_if_reached (NULL);
+}
+
+gboolean
+gsignond_sasl_scram_verify_server_final (GSignondSaslScram *scram,
+                                         const gchar *server_final,
+                                         GError **error)
+{
+    g_return_val_if_reached (FALSE);
+}
+
+GBytes *
+gsignond_sasl_scram_export (GSignondSaslScram *scram)
+{
+    g_return_val_if_reached (NULL);
+}
+
+GSignondSaslScram *
+gsignond_sasl_scram_import (GBytes *state,
+                            GError **error)
+{
+    return _not_built (error);
+}
+
+gboolean
+gsignond_sasl_scram_check_user (GSignondSaslScram *scram,
+                                const gchar *username,
+                                const gchar *authzid,
+                                GError **error)
+{
+    g_return_val_if_reached (FALSE);
+}
+
+#endif /* WITH_SCRAM_ENGINE */
@@ -0,0 +1,104 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_SCRAM_H__
+#define __GSIGNOND_SASL_SCRAM_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* version of the format written by gsignond_sasl_scram_export() */
+#define GSIGNOND_SASL_SCRAM_STATE_VERSION 1
+
+typedef enum {
+    GSIGNOND_SASL_SCRAM_STATE_INITIAL = 0,
+    GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT,
+    GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT,
+    GSIGNOND_SASL_SCRAM_STATE_DONE
+} GSignondSaslScramState;
+
+typedef struct _GSignondSaslScram GSignondSaslScram;
+
+gboolean
+gsignond_sasl_scram_is_supported (const gchar *mechanism);
+
+GSignondSaslScram *
+gsignond_sasl_scram_new (const gchar *mechanism,
+                         const gchar *username,
+                         const gchar *authzid,
+                         const gchar *cb_data_base64,
+                         GError **error);
+
+void
+gsignond_sasl_scram_free (GSignondSaslScram *scram);
+
+const gchar *
+gsignond_sasl_scram_get_mechanism (GSignondSaslScram *scram);
+
+GChecksumType
+gsignond_sasl_scram_get_checksum_type (GSignondSaslScram *scram);
+
+GSignondSaslScramState
+gsignond_sasl_scram_get_state (GSignondSaslScram *scram);
+
+gchar *
+gsignond_sasl_scram_client_first (GSignondSaslScram *scram);
+
+gboolean
+gsignond_sasl_scram_parse_server_first (GSignondSaslScram *scram,
+                                        const gchar *server_first,
+                                        gchar **salt_base64,
+                                        guint *iterations,
+                                        GError **error);
+
+gchar *
+gsignond_sasl_scram_client_final (GSignondSaslScram *scram,
+                                  const gchar *server_first,
+                                  const guint8 *salted_password,
+                                  gsize salted_password_len,
+                                  GError **error);
+
+gboolean
+gsignond_sasl_scram_verify_server_final (GSignondSaslScram *scram,
+                                         const gchar *server_final,
+                                         GError **error);
+
+GBytes *
+gsignond_sasl_scram_export (GSignondSaslScram *scram);
+
+GSignondSaslScram *
+gsignond_sasl_scram_import (GBytes *state,
+                            GError **error);
+
+gboolean
+gsignond_sasl_scram_check_user (GSignondSaslScram *scram,
+                                const gchar *username,
+                                const gchar *authzid,
+                                GError **error);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_SCRAM_H__ */
@@ -0,0 +1,262 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Authenticated encryption of session state handed to the application.
+ *
+ * A sealed blob is the version byte, a random 16 byte nonce, the ciphertext
+ * and a 32 byte tag. The ciphertext is the plaintext XORed with
+ * HMAC-SHA256(enc_key, nonce || block counter), and the tag is
+ * HMAC-SHA256(mac_key, version || nonce || ciphertext), checked before
+ * anything is decrypted. Both keys are derived from one master key: the
+ * 64 hex digits of SSO_SASL_SEAL_KEY, so that all processes serving the
+ * same clients can open each other's blobs, or else a random key made
+ * when the first blob is sealed, which only this process knows. Other keys
+ * that have to be the same in all those processes, such as that of the key
+ * cache fingerprints, are derived from it too.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gsasl.h>
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-seal.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-log.h"
+
+#define NONCE_SIZE GSIGNOND_SASL_SEAL_NONCE_SIZE
+#define TAG_SIZE 32
+#define HEADER_SIZE (1 + NONCE_SIZE)
+
+static GMutex seal_lock;
+static gboolean seal_initialized = FALSE;
+static guint8 seal_master_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+static guint8 enc_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+static guint8 mac_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+
+/* Derives the key for @label from @master_key; both are
+ * GSIGNOND_SASL_SEAL_KEY_SIZE bytes long */
+void
+gsignond_sasl_seal_derive_key (const guint8 *master_key,
+                               const gchar *label,
+                               guint8 *key)
+{
+    GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, master_key,
+                              GSIGNOND_SASL_SEAL_KEY_SIZE);
+    gsize len = GSIGNOND_SASL_SEAL_KEY_SIZE;
+
+    g_hmac_update (hmac, (const guchar *) label, -1);
+    g_hmac_get_digest (hmac, key, &len);
+    g_hmac_unref (hmac);
+}
+
+static void
+_set_key_locked (const guint8 *master_key)
+{
+    memcpy (seal_master_key, master_key, sizeof (seal_master_key));
+    gsignond_sasl_seal_derive_key (master_key, "gsignond-sasl seal encryption",
+                                   enc_key);
+    gsignond_sasl_seal_derive_key (master_key,
+                                   "gsignond-sasl seal authentication",
+                                   mac_key);
+    seal_initialized = TRUE;
+}
+
+static void
+_init_locked (void)
+{
+    guint8 master_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+    const gchar *value;
+
+    if (seal_initialized)
+        return;
+    value = g_getenv ("SSO_SASL_SEAL_KEY");
+    if (value == NULL ||
+        !gsignond_sasl_kdf_hex_decode (value, master_key,
+                                       sizeof (master_key))) {
+        if (value)
+            GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                               "SSO_SASL_SEAL_KEY is not 64 hex digits, "
+                               "using a key of this process");
+        gsasl_random ((char *) master_key, sizeof (master_key));
+    }
+    _set_key_locked (master_key);
+    memset (master_key, 0, sizeof (master_key));
+}
+
+/* Replaces the key, with a new random one if @key is NULL; blobs sealed
+ * before can't be opened anymore */
+void
+gsignond_sasl_seal_set_key (const guint8 *key)
+{
+    guint8 master_key[GSIGNOND_SASL_SEAL_KEY_SIZE];
+
+    if (key)
+        memcpy (master_key, key, sizeof (master_key));
+    else
+        gsasl_random ((char *) master_key, sizeof (master_key));
+    g_mutex_lock (&seal_lock);
+    _set_key_locked (master_key);
+    g_mutex_unlock (&seal_lock);
+    memset (master_key, 0, sizeof (master_key));
+}
+
+/* Derives the key for @label from the master key of the seal */
+void
+gsignond_sasl_seal_derive_subkey (const gchar *label,
+                                  guint8 *key)
+{
+    g_mutex_lock (&seal_lock);
+    _init_locked ();
+    gsignond_sasl_seal_derive_key (seal_master_key, label, key);
+    g_mutex_unlock (&seal_lock);
+}
+
+/* XORs @data with the keystream of @key for @nonce, which is
+ * GSIGNOND_SASL_SEAL_NONCE_SIZE bytes long */
+void
+gsignond_sasl_seal_apply_keystream (const guint8 *key,
+                                    const guint8 *nonce,
+                                    guint8 *data,
+                                    gsize len)
+{
+    guint8 block[32];
+    guint32 counter;
+    gsize offset;
+
+    for (offset = 0, counter = 0; offset < len;
+         offset += sizeof (block), counter++) {
+        GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, key,
+                                  GSIGNOND_SASL_SEAL_KEY_SIZE);
+        guint32 counter_be = GUINT32_TO_BE (counter);
+        gsize block_len = sizeof (block);
+        gsize i;
+
+        g_hmac_update (hmac, nonce, NONCE_SIZE);
+        g_hmac_update (hmac, (const guchar *) &counter_be,
+                       sizeof (counter_be));
+        g_hmac_get_digest (hmac, block, &block_len);
+        g_hmac_unref (hmac);
+        for (i = 0; i < sizeof (block) && offset + i < len; i++)
+            data[offset + i] ^= block[i];
+    }
+    memset (block, 0, sizeof (block));
+}
+
+static void
+_compute_tag (const guint8 *key,
+              const guint8 *data,
+              gsize len,
+              guint8 *tag)
+{
+    GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, key,
+                              GSIGNOND_SASL_SEAL_KEY_SIZE);
+    gsize tag_len = TAG_SIZE;
+
+    g_hmac_update (hmac, data, len);
+    g_hmac_get_digest (hmac, tag, &tag_len);
+    g_hmac_unref (hmac);
+}
+
+GBytes *
+gsignond_sasl_seal (GBytes *plaintext)
+{
+    guint8 keys[2][GSIGNOND_SASL_SEAL_KEY_SIZE];
+    gconstpointer data;
+    gsize len;
+    guint8 *sealed;
+
+    g_return_val_if_fail (plaintext != NULL, NULL);
+
+    g_mutex_lock (&seal_lock);
+    _init_locked ();
+    memcpy (keys[0], enc_key, sizeof (enc_key));
+    memcpy (keys[1], mac_key, sizeof (mac_key));
+    g_mutex_unlock (&seal_lock);
+
+    data = g_bytes_get_data (plaintext, &len);
+    sealed = g_malloc (HEADER_SIZE + len + TAG_SIZE);
+    sealed[0] = GSIGNOND_SASL_SEAL_VERSION;
+    gsasl_nonce ((char *) sealed + 1, NONCE_SIZE);
+    if (len > 0)
+        memcpy (sealed + HEADER_SIZE, data, len);
+    gsignond_sasl_seal_apply_keystream (keys[0], sealed + 1,
+                                        sealed + HEADER_SIZE, len);
+    _compute_tag (keys[1], sealed, HEADER_SIZE + len,
+                  sealed + HEADER_SIZE + len);
+    memset (keys, 0, sizeof (keys));
+    return g_bytes_new_take (sealed, HEADER_SIZE + len + TAG_SIZE);
+}
+
+GBytes *
+gsignond_sasl_unseal (GBytes *sealed,
+                      GError **error)
+{
+    guint8 keys[2][GSIGNOND_SASL_SEAL_KEY_SIZE];
+    guint8 tag[TAG_SIZE];
+    const guint8 *data;
+    guint8 *plaintext;
+    guint8 diff = 0;
+    gsize len;
+    gsize i;
+
+    g_return_val_if_fail (sealed != NULL, NULL);
+
+    data = g_bytes_get_data (sealed, &len);
+    if (len < HEADER_SIZE + TAG_SIZE ||
+        data[0] != GSIGNOND_SASL_SEAL_VERSION) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Sealed session state is malformed");
+        return NULL;
+    }
+    len -= HEADER_SIZE + TAG_SIZE;
+
+    g_mutex_lock (&seal_lock);
+    _init_locked ();
+    memcpy (keys[0], enc_key, sizeof (enc_key));
+    memcpy (keys[1], mac_key, sizeof (mac_key));
+    g_mutex_unlock (&seal_lock);
+
+    _compute_tag (keys[1], data, HEADER_SIZE + len, tag);
+    for (i = 0; i < TAG_SIZE; i++)
+        diff |= tag[i] ^ data[HEADER_SIZE + len + i];
+    if (diff != 0) {
+        memset (keys, 0, sizeof (keys));
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Sealed session state was altered or sealed with "
+                     "another key");
+        return NULL;
+    }
+
+    plaintext = g_malloc (len + 1);
+    if (len > 0)
+        memcpy (plaintext, data + HEADER_SIZE, len);
+    gsignond_sasl_seal_apply_keystream (keys[0], data + 1, plaintext,
+                                        len);
+    memset (keys, 0, sizeof (keys));
+    return g_bytes_new_take (plaintext, len);
+}
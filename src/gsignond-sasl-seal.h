@@ -0,0 +1,65 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_SEAL_H__
+#define __GSIGNOND_SASL_SEAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* version byte at the start of every sealed blob */
+#define GSIGNOND_SASL_SEAL_VERSION 1
+#define GSIGNOND_SASL_SEAL_KEY_SIZE 32
+#define GSIGNOND_SASL_SEAL_NONCE_SIZE 16
+
+void
+gsignond_sasl_seal_set_key (const guint8 *key);
+
+GBytes *
+gsignond_sasl_seal (GBytes *plaintext);
+
+GBytes *
+gsignond_sasl_unseal (GBytes *sealed,
+                      GError **error);
+
+void
+gsignond_sasl_seal_derive_key (const guint8 *master_key,
+                               const gchar *label,
+                               guint8 *key);
+
+void
+gsignond_sasl_seal_derive_subkey (const gchar *label,
+                                  guint8 *key);
+
+void
+gsignond_sasl_seal_apply_keystream (const guint8 *key,
+                                    const guint8 *nonce,
+                                    guint8 *data,
+                                    gsize len);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_SEAL_H__ */
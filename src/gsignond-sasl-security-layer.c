@@ -0,0 +1,695 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * DIGEST-MD5 security layer (RFC 2831, sections 2.3 and 2.4).
+ *
+ * Every wrapped packet is a 4 byte length followed by the message, the
+ * first 10 bytes of HMAC-MD5(Ki, sequence number || message), the message
+ * type 1 and the sequence number. With confidentiality the message and the
+ * MAC are encrypted with RC4; the DES based ciphers are not implemented.
+ * Each direction has its own keys, cipher state and sequence number, so
+ * one thread can wrap while another unwraps.
+ *
+ * The message is read from the caller's vectors and written, encrypted or
+ * not, straight into the caller's buffer: nothing is copied or allocated
+ * apart from the HMAC state, which is copied from one keyed when the layer
+ * is created. The batch functions process a run of packets into a single
+ * arena, checking sizes once for the whole run.
+ */
+
+#include <string.h>
+
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-security-layer.h"
+
+#define SESSION_KEY_SIZE 16
+#define MAC_SIZE 10
+#define LENGTH_SIZE 4
+#define MESSAGE_TYPE 1
+/* on-stack vectors for gsignond_sasl_security_layer_wrap_bytes() */
+#define STACK_VECTORS 16
+
+typedef struct {
+    guint8 s[256];
+    guint8 i;
+    guint8 j;
+} GSignondSaslRc4;
+
+typedef struct {
+    /* keyed with Ki, copied for every packet */
+    GHmac *mac;
+    GSignondSaslRc4 cipher;
+    guint32 sequence;
+    /* an unwrap failed, the cipher state can't be trusted anymore */
+    gboolean broken;
+} GSignondSaslDirection;
+
+struct _GSignondSaslSecurityLayer {
+    GSignondSaslQop qop;
+    gsize max_send;
+    GSignondSaslDirection send;
+    GSignondSaslDirection receive;
+};
+
+static void
+_rc4_init (GSignondSaslRc4 *rc4,
+           const guint8 *key,
+           gsize key_len)
+{
+    guint8 j = 0;
+    guint i;
+
+    for (i = 0; i < 256; i++)
+        rc4->s[i] = i;
+    for (i = 0; i < 256; i++) {
+        guint8 t = rc4->s[i];
+
+        j += t + key[i % key_len];
+        rc4->s[i] = rc4->s[j];
+        rc4->s[j] = t;
+    }
+    rc4->i = 0;
+    rc4->j = 0;
+}
+
+/* @out may be @in, or before it in the same buffer */
+static void
+_rc4_apply (GSignondSaslRc4 *rc4,
+            const guint8 *in,
+            guint8 *out,
+            gsize len)
+{
+    guint8 *s = rc4->s;
+    guint8 i = rc4->i;
+    guint8 j = rc4->j;
+    gsize k;
+
+    for (k = 0; k < len; k++) {
+        guint8 t;
+
+        i++;
+        j += s[i];
+        t = s[i];
+        s[i] = s[j];
+        s[j] = t;
+        out[k] = in[k] ^ s[(guint8) (s[i] + s[j])];
+    }
+    rc4->i = i;
+    rc4->j = j;
+}
+
+/* MD5 of the first @len bytes of @session_key followed by @magic */
+static void
+_derive_key (const guint8 *session_key,
+             gsize len,
+             const gchar *magic,
+             guint8 *key)
+{
+    GChecksum *md5 = g_checksum_new (G_CHECKSUM_MD5);
+    gsize key_len = SESSION_KEY_SIZE;
+
+    g_checksum_update (md5, session_key, len);
+    g_checksum_update (md5, (const guchar *) magic, -1);
+    g_checksum_get_digest (md5, key, &key_len);
+    g_checksum_free (md5);
+}
+
+static void
+_direction_init (GSignondSaslDirection *direction,
+                 const guint8 *session_key,
+                 GSignondSaslQop qop,
+                 gsize cipher_key_len,
+                 const gchar *from_to)
+{
+    guint8 key[SESSION_KEY_SIZE];
+    gchar *magic;
+
+    magic = g_strdup_printf ("Digest session key to %s signing key magic "
+                             "constant", from_to);
+    _derive_key (session_key, SESSION_KEY_SIZE, magic, key);
+    direction->mac = g_hmac_new (G_CHECKSUM_MD5, key, sizeof (key));
+    g_free (magic);
+
+    if (qop == GSIGNOND_SASL_QOP_AUTH_CONF) {
+        magic = g_strdup_printf ("Digest H(A1) to %s sealing key magic "
+                                 "constant", from_to);
+        _derive_key (session_key, cipher_key_len, magic, key);
+        _rc4_init (&direction->cipher, key, sizeof (key));
+        g_free (magic);
+    }
+    memset (key, 0, sizeof (key));
+}
+
+/**
+ * gsignond_sasl_security_layer_new_digest_md5:
+ * @session_key: H(A1) of the DIGEST-MD5 exchange, 16 bytes
+ * @qop: the negotiated quality of protection, other than
+ * %GSIGNOND_SASL_QOP_AUTH
+ * @cipher_key_len: number of bytes of @session_key the RC4 keys are derived
+ * from: 16 for "rc4", 7 for "rc4-56" and 5 for "rc4-40"; unused without
+ * confidentiality
+ * @max_send: the maxbuf of the peer
+ * @server: whether the layer is for the server end
+ *
+ * Returns: a new security layer, to free with
+ * gsignond_sasl_security_layer_free()
+ */
+GSignondSaslSecurityLayer *
+gsignond_sasl_security_layer_new_digest_md5 (const guint8 *session_key,
+                                             GSignondSaslQop qop,
+                                             gsize cipher_key_len,
+                                             gsize max_send,
+                                             gboolean server)
+{
+    GSignondSaslSecurityLayer *layer;
+
+    g_return_val_if_fail (session_key != NULL, NULL);
+    g_return_val_if_fail (qop == GSIGNOND_SASL_QOP_AUTH_INT ||
+                          qop == GSIGNOND_SASL_QOP_AUTH_CONF, NULL);
+    g_return_val_if_fail (qop != GSIGNOND_SASL_QOP_AUTH_CONF ||
+                          (cipher_key_len > 0 &&
+                           cipher_key_len <= SESSION_KEY_SIZE), NULL);
+    g_return_val_if_fail (max_send > GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD -
+                          LENGTH_SIZE, NULL);
+
+    layer = g_slice_new0 (GSignondSaslSecurityLayer);
+    layer->qop = qop;
+    layer->max_send = max_send;
+    _direction_init (&layer->send, session_key, qop, cipher_key_len,
+                     server ? "server-to-client" : "client-to-server");
+    _direction_init (&layer->receive, session_key, qop, cipher_key_len,
+                     server ? "client-to-server" : "server-to-client");
+    return layer;
+}
+
+/**
+ * gsignond_sasl_security_layer_free:
+ * @layer: (allow-none): a #GSignondSaslSecurityLayer
+ *
+ * Frees @layer and wipes its keys.
+ */
+void
+gsignond_sasl_security_layer_free (GSignondSaslSecurityLayer *layer)
+{
+    if (layer == NULL)
+        return;
+    g_hmac_unref (layer->send.mac);
+    g_hmac_unref (layer->receive.mac);
+    memset (layer, 0, sizeof (*layer));
+    g_slice_free (GSignondSaslSecurityLayer, layer);
+}
+
+/**
+ * gsignond_sasl_security_layer_get_qop:
+ * @layer: a #GSignondSaslSecurityLayer
+ *
+ * Returns: the quality of protection of @layer
+ */
+GSignondSaslQop
+gsignond_sasl_security_layer_get_qop (GSignondSaslSecurityLayer *layer)
+{
+    g_return_val_if_fail (layer != NULL, GSIGNOND_SASL_QOP_AUTH);
+
+    return layer->qop;
+}
+
+/**
+ * gsignond_sasl_security_layer_get_max_message_size:
+ * @layer: a #GSignondSaslSecurityLayer
+ *
+ * Returns: the length of the longest message that can be wrapped in a
+ * packet the peer accepts
+ */
+gsize
+gsignond_sasl_security_layer_get_max_message_size (
+                                        GSignondSaslSecurityLayer *layer)
+{
+    g_return_val_if_fail (layer != NULL, 0);
+
+    return layer->max_send -
+        (GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD - LENGTH_SIZE);
+}
+
+/**
+ * gsignond_sasl_security_layer_peek_packet_size:
+ * @data: the start of the data received from the peer
+ * @len: the length of @data
+ *
+ * Returns: the length of the packet at the start of @data, including its
+ * length field, or 0 if @len is too short to tell
+ */
+gsize
+gsignond_sasl_security_layer_peek_packet_size (const guint8 *data,
+                                               gsize len)
+{
+    guint32 packet_len;
+
+    if (len < LENGTH_SIZE)
+        return 0;
+    memcpy (&packet_len, data, LENGTH_SIZE);
+    return (gsize) GUINT32_FROM_BE (packet_len) + LENGTH_SIZE;
+}
+
+/* Writes the packet of a message of @message_len bytes made of @vectors to
+ * @out, which has room for it */
+static void
+_wrap_one (GSignondSaslSecurityLayer *layer,
+           const GOutputVector *vectors,
+           gsize n_vectors,
+           gsize message_len,
+           guint8 *out)
+{
+    GSignondSaslDirection *send = &layer->send;
+    guint8 digest[SESSION_KEY_SIZE];
+    gsize digest_len = sizeof (digest);
+    guint32 sequence = GUINT32_TO_BE (send->sequence);
+    guint32 length;
+    GHmac *hmac;
+    gsize i;
+
+    length = GUINT32_TO_BE (message_len +
+                            GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD -
+                            LENGTH_SIZE);
+    memcpy (out, &length, LENGTH_SIZE);
+    out += LENGTH_SIZE;
+
+    hmac = g_hmac_copy (send->mac);
+    g_hmac_update (hmac, (const guchar *) &sequence, sizeof (sequence));
+    for (i = 0; i < n_vectors; i++) {
+        g_hmac_update (hmac, vectors[i].buffer, vectors[i].size);
+        if (layer->qop == GSIGNOND_SASL_QOP_AUTH_CONF)
+            _rc4_apply (&send->cipher, vectors[i].buffer, out,
+                        vectors[i].size);
+        else
+            memcpy (out, vectors[i].buffer, vectors[i].size);
+        out += vectors[i].size;
+    }
+    g_hmac_get_digest (hmac, digest, &digest_len);
+    g_hmac_unref (hmac);
+    if (layer->qop == GSIGNOND_SASL_QOP_AUTH_CONF)
+        _rc4_apply (&send->cipher, digest, out, MAC_SIZE);
+    else
+        memcpy (out, digest, MAC_SIZE);
+    out += MAC_SIZE;
+    out[0] = MESSAGE_TYPE >> 8;
+    out[1] = MESSAGE_TYPE & 0xff;
+    memcpy (out + 2, &sequence, sizeof (sequence));
+    send->sequence++;
+}
+
+static gboolean
+_check_message_size (GSignondSaslSecurityLayer *layer,
+                     gsize message_len,
+                     GError **error)
+{
+    if (message_len <= gsignond_sasl_security_layer_get_max_message_size (
+                           layer))
+        return TRUE;
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                 "Message of %" G_GSIZE_FORMAT " bytes is longer than the "
+                 "peer accepts", message_len);
+    return FALSE;
+}
+
+/**
+ * gsignond_sasl_security_layer_wrapv:
+ * @layer: a #GSignondSaslSecurityLayer
+ * @vectors: (array length=n_vectors): the parts of the message
+ * @n_vectors: the number of parts
+ * @buffer: where to write the packet
+ * @buffer_size: the size of @buffer, at least the length of the message
+ * plus %GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD
+ * @error: return location for a #GError
+ *
+ * Wraps the concatenation of @vectors in a single packet, ready to be sent
+ * to the peer.
+ *
+ * Returns: the length of the packet, or -1 with @error set if the message
+ * is longer than gsignond_sasl_security_layer_get_max_message_size() or
+ * @buffer is too small
+ */
+gssize
+gsignond_sasl_security_layer_wrapv (GSignondSaslSecurityLayer *layer,
+                                    const GOutputVector *vectors,
+                                    gsize n_vectors,
+                                    guint8 *buffer,
+                                    gsize buffer_size,
+                                    GError **error)
+{
+    gsize message_len = 0;
+    gsize packet_len;
+    gsize i;
+
+    g_return_val_if_fail (layer != NULL, -1);
+    g_return_val_if_fail (vectors != NULL || n_vectors == 0, -1);
+    g_return_val_if_fail (buffer != NULL, -1);
+
+    for (i = 0; i < n_vectors; i++)
+        message_len += vectors[i].size;
+    if (!_check_message_size (layer, message_len, error))
+        return -1;
+    packet_len = message_len + GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+    if (buffer_size < packet_len) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_OPERATION_FAILED,
+                     "Packet of %" G_GSIZE_FORMAT " bytes doesn't fit in "
+                     "the buffer", packet_len);
+        return -1;
+    }
+    _wrap_one (layer, vectors, n_vectors, message_len, buffer);
+    return packet_len;
+}
+
+/**
+ * gsignond_sasl_security_layer_wrap_bytes:
+ * @layer: a #GSignondSaslSecurityLayer
+ * @chain: (array length=n_bytes): the parts of the message
+ * @n_bytes: the number of parts
+ * @buffer: where to write the packet
+ * @buffer_size: the size of @buffer
+ * @error: return location for a #GError
+ *
+ * Like gsignond_sasl_security_layer_wrapv(), for a message held in
+ * #GBytes.
+ *
+ * Returns: the length of the packet, or -1 with @error set
+ */
+gssize
+gsignond_sasl_security_layer_wrap_bytes (GSignondSaslSecurityLayer *layer,
+                                         GBytes *const *chain,
+                                         gsize n_bytes,
+                                         guint8 *buffer,
+                                         gsize buffer_size,
+                                         GError **error)
+{
+    GOutputVector stack_vectors[STACK_VECTORS];
+    GOutputVector *vectors = stack_vectors;
+    gssize packet_len;
+    gsize i;
+
+    g_return_val_if_fail (chain != NULL || n_bytes == 0, -1);
+
+    if (n_bytes > STACK_VECTORS)
+        vectors = g_new (GOutputVector, n_bytes);
+    for (i = 0; i < n_bytes; i++)
+        vectors[i].buffer = g_bytes_get_data (chain[i], &vectors[i].size);
+    packet_len = gsignond_sasl_security_layer_wrapv (layer, vectors, n_bytes,
+                                                     buffer, buffer_size,
+                                                     error);
+    if (vectors != stack_vectors)
+        g_free (vectors);
+    return packet_len;
+}
+
+/**
+ * gsignond_sasl_security_layer_wrap_batch:
+ * @layer: a #GSignondSaslSecurityLayer
+ * @messages: (array length=n_messages): the messages
+ * @n_messages: the number of messages
+ * @arena: where to write the packets
+ * @arena_size: the size of @arena, at least the total length of the
+ * messages plus %GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD for each
+ * @error: return location for a #GError
+ *
+ * Wraps each of @messages in a packet of its own, the packets following
+ * each other in @arena, ready to be sent to the peer in one write. Either
+ * all the messages are wrapped or none is.
+ *
+ * Returns: the total length of the packets, or -1 with @error set
+ */
+gssize
+gsignond_sasl_security_layer_wrap_batch (GSignondSaslSecurityLayer *layer,
+                                         const GOutputVector *messages,
+                                         gsize n_messages,
+                                         guint8 *arena,
+                                         gsize arena_size,
+                                         GError **error)
+{
+    gsize total_len = 0;
+    gsize i;
+
+    g_return_val_if_fail (layer != NULL, -1);
+    g_return_val_if_fail (messages != NULL || n_messages == 0, -1);
+    g_return_val_if_fail (arena != NULL, -1);
+
+    for (i = 0; i < n_messages; i++) {
+        if (!_check_message_size (layer, messages[i].size, error))
+            return -1;
+        total_len += messages[i].size + GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+    }
+    if (arena_size < total_len) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_OPERATION_FAILED,
+                     "Packets of %" G_GSIZE_FORMAT " bytes don't fit in "
+                     "the arena", total_len);
+        return -1;
+    }
+    for (i = 0; i < n_messages; i++) {
+        _wrap_one (layer, &messages[i], 1, messages[i].size, arena);
+        arena += messages[i].size + GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+    }
+    return total_len;
+}
+
+/* Checks the packet of @packet_len bytes at @packet, which the caller made
+ * sure is well formed, and writes its message to @out; @out may be before
+ * @packet in the same buffer */
+static gboolean
+_unwrap_one (GSignondSaslSecurityLayer *layer,
+             const guint8 *packet,
+             gsize packet_len,
+             guint8 *out,
+             GError **error)
+{
+    GSignondSaslDirection *receive = &layer->receive;
+    gsize message_len = packet_len - GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+    const guint8 *trailer = packet + packet_len - 6;
+    guint8 digest[SESSION_KEY_SIZE];
+    gsize digest_len = sizeof (digest);
+    guint8 mac[MAC_SIZE];
+    guint32 sequence;
+    GHmac *hmac;
+    guint8 diff = 0;
+    guint i;
+
+    memcpy (&sequence, trailer + 2, sizeof (sequence));
+    if (trailer[0] != (MESSAGE_TYPE >> 8) ||
+        trailer[1] != (MESSAGE_TYPE & 0xff) ||
+        GUINT32_FROM_BE (sequence) != receive->sequence) {
+        receive->broken = TRUE;
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Security layer packet is out of sequence");
+        return FALSE;
+    }
+
+    hmac = g_hmac_copy (receive->mac);
+    g_hmac_update (hmac, (const guchar *) &sequence, sizeof (sequence));
+    if (layer->qop == GSIGNOND_SASL_QOP_AUTH_CONF) {
+        _rc4_apply (&receive->cipher, packet + LENGTH_SIZE, out,
+                    message_len);
+        _rc4_apply (&receive->cipher, packet + LENGTH_SIZE + message_len,
+                    mac, MAC_SIZE);
+        g_hmac_update (hmac, out, message_len);
+    } else {
+        memcpy (mac, packet + LENGTH_SIZE + message_len, MAC_SIZE);
+        g_hmac_update (hmac, packet + LENGTH_SIZE, message_len);
+    }
+    g_hmac_get_digest (hmac, digest, &digest_len);
+    g_hmac_unref (hmac);
+    for (i = 0; i < MAC_SIZE; i++)
+        diff |= digest[i] ^ mac[i];
+    if (diff != 0) {
+        if (layer->qop == GSIGNOND_SASL_QOP_AUTH_CONF)
+            memset (out, 0, message_len);
+        receive->broken = TRUE;
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Security layer packet failed the integrity check");
+        return FALSE;
+    }
+    if (layer->qop != GSIGNOND_SASL_QOP_AUTH_CONF)
+        memmove (out, packet + LENGTH_SIZE, message_len);
+    receive->sequence++;
+    return TRUE;
+}
+
+static gboolean
+_check_receive (GSignondSaslSecurityLayer *layer,
+                GError **error)
+{
+    if (!layer->receive.broken)
+        return TRUE;
+    g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                 "Security layer rejected an earlier packet");
+    return FALSE;
+}
+
+/* The length of the packet at the start of @data if it is complete, 0 if
+ * it isn't, -1 if it's malformed */
+static gssize
+_packet_size (GSignondSaslSecurityLayer *layer,
+              const guint8 *data,
+              gsize len,
+              GError **error)
+{
+    gsize packet_len = gsignond_sasl_security_layer_peek_packet_size (data,
+                                                                      len);
+
+    if (packet_len == 0 || (packet_len > len &&
+        packet_len <= GSIGNOND_SASL_SECURITY_LAYER_MAX_RECEIVE + LENGTH_SIZE))
+        return 0;
+    if (packet_len < GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD ||
+        packet_len > GSIGNOND_SASL_SECURITY_LAYER_MAX_RECEIVE + LENGTH_SIZE) {
+        layer->receive.broken = TRUE;
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Malformed security layer packet");
+        return -1;
+    }
+    return packet_len;
+}
+
+/**
+ * gsignond_sasl_security_layer_unwrap:
+ * @layer: a #GSignondSaslSecurityLayer
+ * @packet: a packet received from the peer, including its length field
+ * @packet_len: the length of @packet, see
+ * gsignond_sasl_security_layer_peek_packet_size()
+ * @buffer: where to write the message; may be @packet itself
+ * @buffer_size: the size of @buffer, at least @packet_len minus
+ * %GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD
+ * @error: return location for a #GError
+ *
+ * Checks and unwraps a packet. Packets have to be unwrapped in the order
+ * they were sent. Once a packet is rejected because it is malformed, was
+ * tampered with or is out of sequence, @layer rejects all the following
+ * ones.
+ *
+ * Returns: the length of the message, or -1 with @error set
+ */
+gssize
+gsignond_sasl_security_layer_unwrap (GSignondSaslSecurityLayer *layer,
+                                     const guint8 *packet,
+                                     gsize packet_len,
+                                     guint8 *buffer,
+                                     gsize buffer_size,
+                                     GError **error)
+{
+    gssize packet_size;
+    gsize message_len;
+
+    g_return_val_if_fail (layer != NULL, -1);
+    g_return_val_if_fail (packet != NULL && buffer != NULL, -1);
+
+    if (!_check_receive (layer, error))
+        return -1;
+    packet_size = _packet_size (layer, packet, packet_len, error);
+    if (packet_size < 0)
+        return -1;
+    if ((gsize) packet_size != packet_len) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Security layer packet isn't %" G_GSIZE_FORMAT
+                     " bytes long", packet_len);
+        return -1;
+    }
+    message_len = packet_len - GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+    if (buffer_size < message_len) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_OPERATION_FAILED,
+                     "Message of %" G_GSIZE_FORMAT " bytes doesn't fit in "
+                     "the buffer", message_len);
+        return -1;
+    }
+    if (!_unwrap_one (layer, packet, packet_len, buffer, error))
+        return -1;
+    return message_len;
+}
+
+/**
+ * gsignond_sasl_security_layer_unwrap_batch:
+ * @layer: a #GSignondSaslSecurityLayer
+ * @data: data received from the peer, starting at a packet boundary
+ * @data_len: the length of @data
+ * @arena: where to write the messages; may be @data itself
+ * @arena_size: the size of @arena
+ * @messages: (array length=n_messages): return location for the messages,
+ * which point into @arena
+ * @n_messages: (inout): the number of elements of @messages; set to the
+ * number of messages unwrapped
+ * @error: return location for a #GError
+ *
+ * Unwraps the packets at the start of @data, writing their messages one
+ * after the other into @arena. It stops at a packet that is incomplete,
+ * whose message doesn't fit in what is left of @arena, or when @messages
+ * is full; the rest of @data is to be passed again, completed with the
+ * data received next.
+ *
+ * Returns: the number of bytes of @data that were unwrapped, or -1 with
+ * @error set if a packet is rejected; @n_messages is then the number of
+ * messages unwrapped before it
+ */
+gssize
+gsignond_sasl_security_layer_unwrap_batch (GSignondSaslSecurityLayer *layer,
+                                           const guint8 *data,
+                                           gsize data_len,
+                                           guint8 *arena,
+                                           gsize arena_size,
+                                           GOutputVector *messages,
+                                           gsize *n_messages,
+                                           GError **error)
+{
+    gsize max_messages;
+    gsize consumed = 0;
+    gsize used = 0;
+
+    g_return_val_if_fail (layer != NULL, -1);
+    g_return_val_if_fail (data != NULL || data_len == 0, -1);
+    g_return_val_if_fail (arena != NULL, -1);
+    g_return_val_if_fail (messages != NULL && n_messages != NULL, -1);
+
+    max_messages = *n_messages;
+    *n_messages = 0;
+    if (!_check_receive (layer, error))
+        return -1;
+    while (*n_messages < max_messages) {
+        gssize packet_len = _packet_size (layer, data + consumed,
+                                          data_len - consumed, error);
+        gsize message_len;
+
+        if (packet_len < 0)
+            return -1;
+        if (packet_len == 0)
+            break;
+        message_len = packet_len - GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD;
+        if (arena_size - used < message_len)
+            break;
+        if (!_unwrap_one (layer, data + consumed, packet_len, arena + used,
+                          error))
+            return -1;
+        messages[*n_messages].buffer = arena + used;
+        messages[*n_messages].size = message_len;
+        (*n_messages)++;
+        consumed += packet_len;
+        used += message_len;
+    }
+    return consumed;
+}
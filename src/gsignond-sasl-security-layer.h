@@ -0,0 +1,126 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_SECURITY_LAYER_H__
+#define __GSIGNOND_SASL_SECURITY_LAYER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* bytes a wrapped packet adds to the message: length, MAC, type and
+ * sequence number */
+#define GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD 20
+/* largest packet accepted from the peer, the default DIGEST-MD5 maxbuf */
+#define GSIGNOND_SASL_SECURITY_LAYER_MAX_RECEIVE 65536
+
+/**
+ * GSignondSaslQop:
+ * @GSIGNOND_SASL_QOP_AUTH: authentication only, there is no security layer
+ * @GSIGNOND_SASL_QOP_AUTH_INT: messages are integrity protected
+ * @GSIGNOND_SASL_QOP_AUTH_CONF: messages are integrity protected and
+ * encrypted
+ *
+ * Quality of protection negotiated by a mechanism.
+ */
+typedef enum {
+    GSIGNOND_SASL_QOP_AUTH = 0,
+    GSIGNOND_SASL_QOP_AUTH_INT,
+    GSIGNOND_SASL_QOP_AUTH_CONF
+} GSignondSaslQop;
+
+/**
+ * GSignondSaslSecurityLayer:
+ *
+ * Opaque structure for the security layer negotiated by a session
+ */
+typedef struct _GSignondSaslSecurityLayer GSignondSaslSecurityLayer;
+
+GSignondSaslSecurityLayer *
+gsignond_sasl_security_layer_new_digest_md5 (const guint8 *session_key,
+                                             GSignondSaslQop qop,
+                                             gsize cipher_key_len,
+                                             gsize max_send,
+                                             gboolean server);
+
+void
+gsignond_sasl_security_layer_free (GSignondSaslSecurityLayer *layer);
+
+GSignondSaslQop
+gsignond_sasl_security_layer_get_qop (GSignondSaslSecurityLayer *layer);
+
+gsize
+gsignond_sasl_security_layer_get_max_message_size (
+                                        GSignondSaslSecurityLayer *layer);
+
+gsize
+gsignond_sasl_security_layer_peek_packet_size (const guint8 *data,
+                                               gsize len);
+
+gssize
+gsignond_sasl_security_layer_wrapv (GSignondSaslSecurityLayer *layer,
+                                    const GOutputVector *vectors,
+                                    gsize n_vectors,
+                                    guint8 *buffer,
+                                    gsize buffer_size,
+                                    GError **error);
+
+gssize
+gsignond_sasl_security_layer_wrap_bytes (GSignondSaslSecurityLayer *layer,
+                                         GBytes *const *chain,
+                                         gsize n_bytes,
+                                         guint8 *buffer,
+                                         gsize buffer_size,
+                                         GError **error);
+
+gssize
+gsignond_sasl_security_layer_wrap_batch (GSignondSaslSecurityLayer *layer,
+                                         const GOutputVector *messages,
+                                         gsize n_messages,
+                                         guint8 *arena,
+                                         gsize arena_size,
+                                         GError **error);
+
+gssize
+gsignond_sasl_security_layer_unwrap (GSignondSaslSecurityLayer *layer,
+                                     const guint8 *packet,
+                                     gsize packet_len,
+                                     guint8 *buffer,
+                                     gsize buffer_size,
+                                     GError **error);
+
+gssize
+gsignond_sasl_security_layer_unwrap_batch (GSignondSaslSecurityLayer *layer,
+                                           const guint8 *data,
+                                           gsize data_len,
+                                           guint8 *arena,
+                                           gsize arena_size,
+                                           GOutputVector *messages,
+                                           gsize *n_messages,
+                                           GError **error);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_SECURITY_LAYER_H__ */
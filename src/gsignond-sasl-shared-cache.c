@@ -0,0 +1,581 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Derived keys shared by the plugin processes of a user.
+ *
+ * gSSO runs each plugin in its own process, so the key cache of one process
+ * is of no use to the others. When SSO_SASL_SHARED_KEY_CACHE is set to a
+ * number of slots, the key cache also stores its entries in a POSIX shared
+ * memory segment named after the effective uid, created with mode 0600 and
+ * refused if another user owns it or can access it. Like the in-process
+ * cache it holds derived keys and keyed password fingerprints, never
+ * secrets; processes only find each other's keys if they share the key of
+ * the fingerprints, see gsignond-sasl-key-cache.c.
+ *
+ * The segment outlives the processes, until the user logs out or the
+ * system restarts, so the fingerprint and key of each entry are encrypted
+ * like the records of the key cache file: with the keystream of
+ * gsignond_sasl_seal_apply_keystream() under a nonce of their own, and
+ * followed by an HMAC-SHA256 tag, both keyed from the seal key. A copy of
+ * the segment is of no use without SSO_SASL_SEAL_KEY.
+ *
+ * The segment is a header followed by an open addressing table of fixed
+ * size slots; an entry lives in one of the MAX_PROBES slots following the
+ * one its id hashes to, and a new entry replaces the oldest of those when
+ * they are all taken. Every slot has a sequence counter that is odd while a
+ * writer updates it: readers copy the slot and retry if the counter changed
+ * meanwhile, and a writer that finds the counter odd or loses the race to
+ * make it odd gives up, as caching is best effort. Readers never block, and
+ * a writer only waits for a counter that stays odd, which is left by a
+ * process that died while writing: after MAX_STALE_CHECKS checks the
+ * writer takes the slot over, and a writer that was only slow notices it
+ * when it ends its update. Should both have written the slot, its tag no
+ * longer matches and it reads as a miss. Hits, misses, evictions and the
+ * times a slot was found busy are counted in the header, for all processes
+ * together.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+#include <gsasl.h>
+#ifdef HAVE_SHM_OPEN
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "gsignond-sasl-shared-cache.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-log.h"
+#include "gsignond-sasl-seal.h"
+
+#define MAGIC 0x474b5343 /* "GKSC" */
+/* 2: keyed password fingerprints
+ * 3: encrypted entries */
+#define LAYOUT_VERSION 3
+#define MAX_SLOTS (1 << 20)
+#define MAX_PROBES 8
+#define MAX_READ_ATTEMPTS 4
+/* how many times, STALE_CHECK_US apart, a writer finds a slot odd before
+ * taking it over */
+#define MAX_STALE_CHECKS 8
+#define STALE_CHECK_US 100
+#define TAG_SIZE 32
+#define SECRET_SIZE (GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE + \
+                     GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE)
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 n_slots;
+    guint32 slot_size;
+    guint64 hits;
+    guint64 misses;
+    guint64 contention;
+    guint64 evictions;
+    guint8 reserved[16];
+} GSignondSaslSharedHeader;
+
+typedef struct {
+    /* odd while a writer updates the slot */
+    guint32 sequence;
+    /* when the entry was stored, in seconds; 0 for an empty slot */
+    guint32 stamp;
+    guint8 id[GSIGNOND_SASL_SHARED_CACHE_ID_SIZE];
+    guint8 nonce[GSIGNOND_SASL_SEAL_NONCE_SIZE];
+    guint32 key_len;
+    /* fingerprint followed by the key, encrypted */
+    guint8 secret[SECRET_SIZE];
+    guint8 reserved[4];
+    /* over everything from the id on */
+    guint8 tag[TAG_SIZE];
+} GSignondSaslSharedSlot;
+
+G_STATIC_ASSERT (sizeof (GSignondSaslSharedHeader) == 64);
+G_STATIC_ASSERT (sizeof (GSignondSaslSharedSlot) == 160);
+
+#ifdef HAVE_SHM_OPEN
+
+static GMutex init_lock;
+static gboolean shared_initialized = FALSE;
+/* held for reading while the segment is used, for writing to map it */
+static GRWLock mapping_lock;
+static GSignondSaslSharedHeader *header = NULL;
+static GSignondSaslSharedSlot *slots = NULL;
+static gsize mapping_size = 0;
+static gchar *segment_name = NULL;
+
+static void
+_count (guint64 *counter)
+{
+    __atomic_fetch_add (counter, 1, __ATOMIC_RELAXED);
+}
+
+static void
+_unmap_locked (void)
+{
+    if (header)
+        munmap (header, mapping_size);
+    header = NULL;
+    slots = NULL;
+    mapping_size = 0;
+}
+
+static gboolean
+_map_locked (const gchar *name,
+             guint n_slots)
+{
+    struct stat st;
+    gsize size;
+    gpointer mapping = MAP_FAILED;
+    GSignondSaslSharedHeader *mapped;
+    int fd;
+
+    fd = shm_open (name, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                           "Couldn't open shared key cache %s: %s", name,
+                           g_strerror (errno));
+        return FALSE;
+    }
+    /* the segment is initialized by whoever locks it first */
+    if (flock (fd, LOCK_EX) < 0 || fstat (fd, &st) < 0)
+        goto out;
+    if (st.st_uid != geteuid () || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                           "Shared key cache %s is accessible to other "
+                           "users, not using it", name);
+        goto out;
+    }
+
+    if (st.st_size == 0) {
+        size = sizeof (GSignondSaslSharedHeader) +
+            (gsize) n_slots * sizeof (GSignondSaslSharedSlot);
+        if (ftruncate (fd, size) < 0)
+            goto out;
+        mapping = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+        if (mapping == MAP_FAILED)
+            goto out;
+        mapped = mapping;
+        mapped->version = LAYOUT_VERSION;
+        mapped->n_slots = n_slots;
+        mapped->slot_size = sizeof (GSignondSaslSharedSlot);
+        __atomic_store_n (&mapped->magic, MAGIC, __ATOMIC_RELEASE);
+    } else {
+        size = st.st_size;
+        mapping = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+        if (mapping == MAP_FAILED)
+            goto out;
+        mapped = mapping;
+        /* a segment left by another version of the plugin is not used */
+        if (size < sizeof (GSignondSaslSharedHeader) ||
+            __atomic_load_n (&mapped->magic, __ATOMIC_ACQUIRE) != MAGIC ||
+            mapped->version != LAYOUT_VERSION ||
+            mapped->slot_size != sizeof (GSignondSaslSharedSlot) ||
+            mapped->n_slots == 0 || mapped->n_slots > MAX_SLOTS ||
+            size != sizeof (GSignondSaslSharedHeader) +
+                    (gsize) mapped->n_slots * sizeof (GSignondSaslSharedSlot)) {
+            GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_WARNING,
+                               "Shared key cache %s has an unknown layout, "
+                               "not using it", name);
+            munmap (mapping, size);
+            mapping = MAP_FAILED;
+            goto out;
+        }
+    }
+    header = mapping;
+    slots = (GSignondSaslSharedSlot *) (header + 1);
+    mapping_size = size;
+
+out:
+    flock (fd, LOCK_UN);
+    close (fd);
+    return mapping != MAP_FAILED;
+}
+
+/* Maps the segment of SSO_SASL_SHARED_KEY_CACHE slots the first time the
+ * cache is used */
+static void
+_init (void)
+{
+    const gchar *value;
+    guint64 n_slots;
+
+    g_mutex_lock (&init_lock);
+    if (!shared_initialized) {
+        shared_initialized = TRUE;
+        value = g_getenv ("SSO_SASL_SHARED_KEY_CACHE");
+        n_slots = value ? g_ascii_strtoull (value, NULL, 10) : 0;
+        if (n_slots > 0) {
+            g_rw_lock_writer_lock (&mapping_lock);
+            segment_name = g_strdup_printf ("/gsignond-sasl-keys-%u",
+                                            (guint) geteuid ());
+            _map_locked (segment_name, MIN (n_slots, MAX_SLOTS));
+            g_rw_lock_writer_unlock (&mapping_lock);
+        }
+    }
+    g_mutex_unlock (&init_lock);
+}
+
+/* Replaces the segment in use by @name, created with @n_slots if it
+ * doesn't exist yet */
+gboolean
+gsignond_sasl_shared_cache_open (const gchar *name,
+                                 guint n_slots)
+{
+    gboolean mapped;
+
+    g_return_val_if_fail (name != NULL && n_slots > 0, FALSE);
+
+    g_mutex_lock (&init_lock);
+    shared_initialized = TRUE;
+    g_rw_lock_writer_lock (&mapping_lock);
+    _unmap_locked ();
+    g_free (segment_name);
+    segment_name = g_strdup (name);
+    mapped = _map_locked (name, MIN (n_slots, MAX_SLOTS));
+    g_rw_lock_writer_unlock (&mapping_lock);
+    g_mutex_unlock (&init_lock);
+    return mapped;
+}
+
+void
+gsignond_sasl_shared_cache_close (gboolean unlink_segment)
+{
+    g_mutex_lock (&init_lock);
+    g_rw_lock_writer_lock (&mapping_lock);
+    _unmap_locked ();
+    if (unlink_segment && segment_name)
+        shm_unlink (segment_name);
+    g_free (segment_name);
+    segment_name = NULL;
+    g_rw_lock_writer_unlock (&mapping_lock);
+    g_mutex_unlock (&init_lock);
+}
+
+static void
+_entry_keys (guint8 *enc_key,
+             guint8 *mac_key)
+{
+    gsignond_sasl_seal_derive_subkey ("gsignond-sasl shared cache encryption",
+                                      enc_key);
+    gsignond_sasl_seal_derive_subkey (
+        "gsignond-sasl shared cache authentication", mac_key);
+}
+
+static void
+_slot_tag (const guint8 *mac_key,
+           const GSignondSaslSharedSlot *slot,
+           guint8 *tag)
+{
+    GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, mac_key,
+                              GSIGNOND_SASL_SEAL_KEY_SIZE);
+    gsize len = TAG_SIZE;
+
+    g_hmac_update (hmac, slot->id,
+                   G_STRUCT_OFFSET (GSignondSaslSharedSlot, tag) -
+                   G_STRUCT_OFFSET (GSignondSaslSharedSlot, id));
+    g_hmac_get_digest (hmac, tag, &len);
+    g_hmac_unref (hmac);
+}
+
+static guint
+_home_slot (const guint8 *id)
+{
+    guint32 hash;
+
+    memcpy (&hash, id, sizeof (hash));
+    return hash % header->n_slots;
+}
+
+typedef enum {
+    SLOT_MATCH,
+    SLOT_OTHER,
+    SLOT_EMPTY,
+    SLOT_BUSY
+} GSignondSaslSlotResult;
+
+/* Takes a consistent copy of @slot and compares it with @id */
+static GSignondSaslSlotResult
+_read_slot (GSignondSaslSharedSlot *slot,
+            const guint8 *id,
+            GSignondSaslSharedSlot *copy)
+{
+    guint attempt;
+
+    for (attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        guint32 before = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+
+        if (before & 1) {
+            _count (&header->contention);
+            continue;
+        }
+        memcpy (copy, slot, sizeof (*copy));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&slot->sequence, __ATOMIC_RELAXED) != before) {
+            _count (&header->contention);
+            continue;
+        }
+        if (copy->stamp == 0)
+            return SLOT_EMPTY;
+        return memcmp (copy->id, id, GSIGNOND_SASL_SHARED_CACHE_ID_SIZE) == 0
+            ? SLOT_MATCH : SLOT_OTHER;
+    }
+    return SLOT_BUSY;
+}
+
+gboolean
+gsignond_sasl_shared_cache_lookup (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   guint8 *key,
+                                   gsize key_len)
+{
+    GSignondSaslSharedSlot copy;
+    guint8 keys[2][GSIGNOND_SASL_SEAL_KEY_SIZE];
+    guint8 tag[TAG_SIZE];
+    gboolean found = FALSE;
+    gboolean done = FALSE;
+    guint home;
+    guint probe;
+
+    _init ();
+    g_rw_lock_reader_lock (&mapping_lock);
+    if (header == NULL) {
+        g_rw_lock_reader_unlock (&mapping_lock);
+        return FALSE;
+    }
+    home = _home_slot (id);
+    for (probe = 0; probe < MIN (MAX_PROBES, header->n_slots) && !done;
+         probe++) {
+        switch (_read_slot (&slots[(home + probe) % header->n_slots], id,
+                            &copy)) {
+            case SLOT_MATCH:
+                done = TRUE;
+                if (copy.key_len != key_len)
+                    break;
+                _entry_keys (keys[0], keys[1]);
+                _slot_tag (keys[1], &copy, tag);
+                if (memcmp (tag, copy.tag, TAG_SIZE) != 0)
+                    break;
+                gsignond_sasl_seal_apply_keystream (keys[0], copy.nonce,
+                                                    copy.secret, SECRET_SIZE);
+                found = memcmp (copy.secret, fingerprint,
+                        GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE) == 0;
+                if (found)
+                    memcpy (key, copy.secret +
+                            GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE,
+                            key_len);
+                break;
+            case SLOT_EMPTY:
+                done = TRUE;
+                break;
+            default:
+                break;
+        }
+    }
+    _count (found ? &header->hits : &header->misses);
+    g_rw_lock_reader_unlock (&mapping_lock);
+    memset (&copy, 0, sizeof (copy));
+    memset (keys, 0, sizeof (keys));
+    return found;
+}
+
+/* Makes the sequence counter of @slot odd for a new update and returns
+ * its value, or 0 if another writer is at work. A counter that stays odd
+ * is taken over from the writer that left it. */
+static guint32
+_begin_write (GSignondSaslSharedSlot *slot)
+{
+    guint32 sequence = __atomic_load_n (&slot->sequence, __ATOMIC_RELAXED);
+    guint32 start = sequence + 1;
+    guint check;
+
+    for (check = 0; (sequence & 1) && check < MAX_STALE_CHECKS; check++) {
+        g_usleep (STALE_CHECK_US);
+        if (__atomic_load_n (&slot->sequence, __ATOMIC_RELAXED) != sequence)
+            return 0;
+    }
+    if (sequence & 1) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG,
+                           "Taking over a shared key cache slot left busy");
+        start = sequence + 2;
+    }
+    if (!__atomic_compare_exchange_n (&slot->sequence, &sequence, start,
+                                      FALSE, __ATOMIC_ACQUIRE,
+                                      __ATOMIC_RELAXED))
+        return 0;
+    /* the odd counter is visible before any of the new contents */
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    return start;
+}
+
+void
+gsignond_sasl_shared_cache_insert (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   const guint8 *key,
+                                   gsize key_len)
+{
+    GSignondSaslSharedSlot *victim = NULL;
+    GSignondSaslSharedSlot entry;
+    guint8 keys[2][GSIGNOND_SASL_SEAL_KEY_SIZE];
+    guint32 oldest = G_MAXUINT32;
+    guint32 sequence;
+    guint home;
+    guint probe;
+
+    g_return_if_fail (key_len <= GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE);
+
+    _init ();
+    g_rw_lock_reader_lock (&mapping_lock);
+    if (header == NULL) {
+        g_rw_lock_reader_unlock (&mapping_lock);
+        return;
+    }
+    /* the slot is picked from unsynchronized reads: a wrong guess only
+     * costs a cache entry */
+    home = _home_slot (id);
+    for (probe = 0; probe < MIN (MAX_PROBES, header->n_slots); probe++) {
+        GSignondSaslSharedSlot *slot = &slots[(home + probe) %
+                                              header->n_slots];
+        guint32 stamp = __atomic_load_n (&slot->stamp, __ATOMIC_RELAXED);
+
+        if (stamp == 0 ||
+            memcmp (slot->id, id, GSIGNOND_SASL_SHARED_CACHE_ID_SIZE) == 0) {
+            victim = slot;
+            break;
+        }
+        if (stamp < oldest) {
+            victim = slot;
+            oldest = stamp;
+        }
+    }
+    if (probe == MIN (MAX_PROBES, header->n_slots))
+        _count (&header->evictions);
+
+    _entry_keys (keys[0], keys[1]);
+    memset (&entry, 0, sizeof (entry));
+    memcpy (entry.id, id, GSIGNOND_SASL_SHARED_CACHE_ID_SIZE);
+    gsasl_nonce ((char *) entry.nonce, sizeof (entry.nonce));
+    entry.key_len = key_len;
+    memcpy (entry.secret, fingerprint,
+            GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE);
+    memcpy (entry.secret + GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE, key,
+            key_len);
+    gsignond_sasl_seal_apply_keystream (keys[0], entry.nonce, entry.secret,
+                                        SECRET_SIZE);
+    _slot_tag (keys[1], &entry, entry.tag);
+    memset (keys, 0, sizeof (keys));
+
+    sequence = _begin_write (victim);
+    if (sequence == 0) {
+        _count (&header->contention);
+        g_rw_lock_reader_unlock (&mapping_lock);
+        return;
+    }
+    memcpy (victim->id, entry.id,
+            sizeof (entry) - G_STRUCT_OFFSET (GSignondSaslSharedSlot, id));
+    victim->stamp = MAX ((guint32) time (NULL), 1);
+    /* fails if the slot was taken over meanwhile */
+    __atomic_compare_exchange_n (&victim->sequence, &sequence, sequence + 1,
+                                 FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    g_rw_lock_reader_unlock (&mapping_lock);
+}
+
+void
+gsignond_sasl_shared_cache_add_statistics (GVariantBuilder *builder)
+{
+    guint32 n_slots = 0;
+    guint64 hits = 0, misses = 0, contention = 0, evictions = 0;
+
+    _init ();
+    g_rw_lock_reader_lock (&mapping_lock);
+    if (header) {
+        n_slots = header->n_slots;
+        hits = __atomic_load_n (&header->hits, __ATOMIC_RELAXED);
+        misses = __atomic_load_n (&header->misses, __ATOMIC_RELAXED);
+        contention = __atomic_load_n (&header->contention, __ATOMIC_RELAXED);
+        evictions = __atomic_load_n (&header->evictions, __ATOMIC_RELAXED);
+    }
+    g_rw_lock_reader_unlock (&mapping_lock);
+
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheSlots",
+                           g_variant_new_uint32 (n_slots));
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheHits",
+                           g_variant_new_uint64 (hits));
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheMisses",
+                           g_variant_new_uint64 (misses));
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheContention",
+                           g_variant_new_uint64 (contention));
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheEvictions",
+                           g_variant_new_uint64 (evictions));
+}
+
+#else /* HAVE_SHM_OPEN */
+
+gboolean
+gsignond_sasl_shared_cache_open (const gchar *name,
+                                 guint n_slots)
+{
+    return FALSE;
+}
+
+void
+gsignond_sasl_shared_cache_close (gboolean unlink_segment)
+{
+}
+
+gboolean
+gsignond_sasl_shared_cache_lookup (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   guint8 *key,
+                                   gsize key_len)
+{
+    return FALSE;
+}
+
+void
+gsignond_sasl_shared_cache_insert (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   const guint8 *key,
+                                   gsize key_len)
+{
+}
+
+void
+gsignond_sasl_shared_cache_add_statistics (GVariantBuilder *builder)
+{
+    g_variant_builder_add (builder, "{sv}", "SharedKeyCacheSlots",
+                           g_variant_new_uint32 (0));
+}
+
+#endif /* HAVE_SHM_OPEN */
@@ -0,0 +1,60 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_SHARED_CACHE_H__
+#define __GSIGNOND_SASL_SHARED_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GSIGNOND_SASL_SHARED_CACHE_ID_SIZE 32
+#define GSIGNOND_SASL_SHARED_CACHE_FINGERPRINT_SIZE 32
+
+gboolean
+gsignond_sasl_shared_cache_open (const gchar *name,
+                                 guint n_slots);
+
+void
+gsignond_sasl_shared_cache_close (gboolean unlink_segment);
+
+gboolean
+gsignond_sasl_shared_cache_lookup (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   guint8 *key,
+                                   gsize key_len);
+
+void
+gsignond_sasl_shared_cache_insert (const guint8 *id,
+                                   const guint8 *fingerprint,
+                                   const guint8 *key,
+                                   gsize key_len);
+
+void
+gsignond_sasl_shared_cache_add_statistics (GVariantBuilder *builder);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_SHARED_CACHE_H__ */
@@ -0,0 +1,234 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Speculative SCRAM key derivation.
+ *
+ * When the salt and iteration count of an account are known in advance, the
+ * salted password can be derived in a worker thread while the client-first
+ * message travels to the server and the server-first message comes back.
+ * The step that handles the server-first message then only waits for the
+ * result, if it isn't there yet, instead of running PBKDF2 itself. The
+ * derivation goes through the same admission control as a regular one and
+ * its result is added to the key cache.
+ *
+ * A speculation is shared by the session that started it and the worker:
+ * the session abandons it when it is no longer needed, which makes the
+ * worker stop at its next cancellation check.
+ */
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "gsignond-sasl-speculation.h"
+#include "gsignond-sasl-admission.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-key-cache.h"
+
+/* how often a waiting step checks whether its session was canceled */
+#define CANCEL_POLL_INTERVAL (50 * G_TIME_SPAN_MILLISECOND)
+
+struct _GSignondSaslSpeculation {
+    gint ref_count;
+    volatile gint abandoned;
+    GMutex lock;
+    GCond done_cond;
+    gboolean done;
+    gboolean derived;
+    GChecksumType checksum_type;
+    gchar *username;
+    gchar *password;
+    guchar *salt;
+    gsize salt_len;
+    guint iterations;
+    guint8 key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize key_len;
+};
+
+static guint64 n_started = 0;
+static guint64 n_used = 0;
+
+static void
+_speculation_unref (GSignondSaslSpeculation *speculation)
+{
+    if (!g_atomic_int_dec_and_test (&speculation->ref_count))
+        return;
+    memset (speculation->password, 0, strlen (speculation->password));
+    memset (speculation->key, 0, sizeof (speculation->key));
+    g_free (speculation->username);
+    g_free (speculation->password);
+    g_free (speculation->salt);
+    g_mutex_clear (&speculation->lock);
+    g_cond_clear (&speculation->done_cond);
+    g_slice_free (GSignondSaslSpeculation, speculation);
+}
+
+static void
+_derive_thread (GTask *task,
+                gpointer source_object,
+                gpointer task_data,
+                GCancellable *cancellable)
+{
+    GSignondSaslSpeculation *speculation = task_data;
+    gboolean derived = FALSE;
+
+    if (gsignond_sasl_admission_acquire (&speculation->abandoned, NULL)) {
+        derived = gsignond_sasl_pbkdf2 (
+            speculation->checksum_type,
+            (const guchar *) speculation->password,
+            strlen (speculation->password),
+            speculation->salt, speculation->salt_len,
+            speculation->iterations, speculation->key,
+            &speculation->abandoned);
+        gsignond_sasl_admission_release ();
+    }
+    if (derived)
+        gsignond_sasl_key_cache_insert (speculation->checksum_type,
+                                        speculation->username,
+                                        speculation->password,
+                                        speculation->salt,
+                                        speculation->salt_len,
+                                        speculation->iterations,
+                                        speculation->key,
+                                        speculation->key_len);
+    /* the password isn't needed any more, whoever waits only needs the key */
+    memset (speculation->password, 0, strlen (speculation->password));
+
+    g_mutex_lock (&speculation->lock);
+    speculation->derived = derived;
+    speculation->done = TRUE;
+    g_cond_broadcast (&speculation->done_cond);
+    g_mutex_unlock (&speculation->lock);
+    g_task_return_boolean (task, derived);
+}
+
+/*
+ * Starts deriving the salted password of @username in a worker thread.
+ * @password must already be prepared with SASLprep.
+ */
+GSignondSaslSpeculation *
+gsignond_sasl_speculation_start (GChecksumType checksum_type,
+                                 const gchar *username,
+                                 const gchar *password,
+                                 const guchar *salt,
+                                 gsize salt_len,
+                                 guint iterations)
+{
+    GSignondSaslSpeculation *speculation;
+    GTask *task;
+
+    g_return_val_if_fail (password != NULL, NULL);
+    g_return_val_if_fail (iterations > 0, NULL);
+
+    speculation = g_slice_new0 (GSignondSaslSpeculation);
+    speculation->ref_count = 2;
+    g_mutex_init (&speculation->lock);
+    g_cond_init (&speculation->done_cond);
+    speculation->checksum_type = checksum_type;
+    speculation->username = g_strdup (username ? username : "");
+    speculation->password = g_strdup (password);
+    speculation->salt = g_malloc (salt_len);
+    memcpy (speculation->salt, salt, salt_len);
+    speculation->salt_len = salt_len;
+    speculation->iterations = iterations;
+    speculation->key_len = g_checksum_type_get_length (checksum_type);
+
+    task = g_task_new (NULL, NULL, NULL, NULL);
+    g_task_set_task_data (task, speculation,
+                          (GDestroyNotify) _speculation_unref);
+    g_task_run_in_thread (task, _derive_thread);
+    g_object_unref (task);
+
+    __atomic_fetch_add (&n_started, 1, __ATOMIC_RELAXED);
+    return speculation;
+}
+
+/* Whether @speculation derives the key for the parameters the server sent */
+gboolean
+gsignond_sasl_speculation_matches (GSignondSaslSpeculation *speculation,
+                                   const guchar *salt,
+                                   gsize salt_len,
+                                   guint iterations)
+{
+    g_return_val_if_fail (speculation != NULL, FALSE);
+
+    return speculation->iterations == iterations &&
+           speculation->salt_len == salt_len &&
+           memcmp (speculation->salt, salt, salt_len) == 0;
+}
+
+/*
+ * Waits for the derivation to finish and copies the key to @key. Returns
+ * %FALSE if it failed, or if @cancel_flag became non-zero in the meantime.
+ */
+gboolean
+gsignond_sasl_speculation_wait (GSignondSaslSpeculation *speculation,
+                                const volatile gint *cancel_flag,
+                                guint8 *key,
+                                gsize key_len)
+{
+    gboolean derived = FALSE;
+
+    g_return_val_if_fail (speculation != NULL, FALSE);
+    g_return_val_if_fail (key_len == speculation->key_len, FALSE);
+
+    g_mutex_lock (&speculation->lock);
+    while (!speculation->done &&
+           !(cancel_flag && g_atomic_int_get (cancel_flag)))
+        g_cond_wait_until (&speculation->done_cond, &speculation->lock,
+                           g_get_monotonic_time () + CANCEL_POLL_INTERVAL);
+    if (speculation->done && speculation->derived) {
+        memcpy (key, speculation->key, key_len);
+        derived = TRUE;
+    }
+    g_mutex_unlock (&speculation->lock);
+
+    if (derived)
+        __atomic_fetch_add (&n_used, 1, __ATOMIC_RELAXED);
+    return derived;
+}
+
+/* Drops the session's reference; an unfinished derivation is stopped */
+void
+gsignond_sasl_speculation_abandon (GSignondSaslSpeculation *speculation)
+{
+    if (speculation == NULL)
+        return;
+    g_atomic_int_set (&speculation->abandoned, 1);
+    _speculation_unref (speculation);
+}
+
+void
+gsignond_sasl_speculation_add_statistics (GVariantBuilder *builder)
+{
+    g_variant_builder_add (builder, "{sv}", "KdfSpeculated",
+                           g_variant_new_uint64 (
+                               __atomic_load_n (&n_started,
+                                                __ATOMIC_RELAXED)));
+    g_variant_builder_add (builder, "{sv}", "KdfSpeculationsUsed",
+                           g_variant_new_uint64 (
+                               __atomic_load_n (&n_used, __ATOMIC_RELAXED)));
+}
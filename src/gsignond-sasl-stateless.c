@@ -0,0 +1,541 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Steps of a session whose state is kept by the application.
+ *
+ * Every step gets the complete session data and the sealed state returned
+ * by the previous one, so consecutive steps can run in different processes
+ * that share the sealing key. The sealed plaintext is a GVariant holding
+ * the mechanism, the time after which the state is refused, the user name
+ * and authzid the sequence was started for, and the state exported by the
+ * mechanism's own client. Each step checks the session data it gets like
+ * the first one, and that it names the same user. PLAIN and CRAM-MD5 finish
+ * in one step and never produce a state.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gsasl.h>
+#include <gsignond/gsignond-error.h>
+
+#include "gsignond-sasl-stateless.h"
+#include "gsignond-sasl-admission.h"
+#include "gsignond-sasl-digest-md5.h"
+#include "gsignond-sasl-engine.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-key-cache.h"
+#include "gsignond-sasl-scram.h"
+#include "gsignond-sasl-seal.h"
+#include "gsignond-sasl-stats.h"
+
+#define STATE_FORMAT "(yxss@ay)"
+/* lifetime of a state when the session data has no "IdleTimeout" */
+#define DEFAULT_STATE_TTL 300
+
+gboolean
+gsignond_sasl_stateless_is_supported (GSignondSaslMechanism mechanism)
+{
+    switch (mechanism) {
+        case GSIGNOND_SASL_MECHANISM_PLAIN:
+        case GSIGNOND_SASL_MECHANISM_CRAM_MD5:
+        case GSIGNOND_SASL_MECHANISM_DIGEST_MD5:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_1_PLUS:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256:
+        case GSIGNOND_SASL_MECHANISM_SCRAM_SHA_256_PLUS:
+            return gsignond_sasl_mechanism_is_enabled (mechanism);
+        default:
+            return FALSE;
+    }
+}
+
+static gchar *
+_prepare (const gchar *text)
+{
+    char *prepped = NULL;
+    gchar *copy;
+
+    if (gsasl_saslprep (text, GSASL_ALLOW_UNASSIGNED, &prepped, NULL) !=
+        GSASL_OK)
+        return NULL;
+    copy = g_strdup (prepped);
+    memset (prepped, 0, strlen (prepped));
+    free (prepped);
+    return copy;
+}
+
+static void
+_wipe_string (gpointer data)
+{
+    GString *string = data;
+
+    memset (string->str, 0, string->len);
+    g_string_free (string, TRUE);
+}
+
+static GBytes *
+_plain_response (GSignondSessionData *session_data,
+                 GError **error)
+{
+    const gchar *authzid = gsignond_dictionary_get_string (session_data,
+                                                           "Authzid");
+    const gchar *username = gsignond_session_data_get_username (session_data);
+    const gchar *secret = gsignond_session_data_get_secret (session_data);
+    GString *message;
+
+    if (username == NULL || secret == NULL) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "PLAIN needs a user name and a secret");
+        return NULL;
+    }
+    message = g_string_new (authzid);
+    g_string_append_c (message, '\0');
+    g_string_append (message, username);
+    g_string_append_c (message, '\0');
+    g_string_append (message, secret);
+    return g_bytes_new_with_free_func (message->str, message->len,
+                                       _wipe_string, message);
+}
+
+static GBytes *
+_cram_md5_response (GSignondSessionData *session_data,
+                    const guchar *challenge,
+                    gsize challenge_len,
+                    GError **error)
+{
+    const gchar *username = gsignond_session_data_get_username (session_data);
+    const gchar *secret = gsignond_session_data_get_secret (session_data);
+    gchar *prepped_username;
+    gchar *prepped_secret;
+    GHmac *hmac;
+    gchar *message;
+
+    if (challenge_len == 0) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "CRAM-MD5 needs the challenge of the server");
+        return NULL;
+    }
+    prepped_username = username ? _prepare (username) : NULL;
+    prepped_secret = secret ? _prepare (secret) : NULL;
+    if (prepped_username == NULL || prepped_secret == NULL) {
+        g_free (prepped_username);
+        g_free (prepped_secret);
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "CRAM-MD5 needs a valid user name and secret");
+        return NULL;
+    }
+    hmac = g_hmac_new (G_CHECKSUM_MD5, (const guchar *) prepped_secret,
+                       strlen (prepped_secret));
+    g_hmac_update (hmac, challenge, challenge_len);
+    message = g_strdup_printf ("%s %s", prepped_username,
+                               g_hmac_get_string (hmac));
+    g_hmac_unref (hmac);
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    g_free (prepped_secret);
+    g_free (prepped_username);
+    return g_bytes_new_take (message, strlen (message));
+}
+
+static GBytes *
+_digest_md5_step (GSignondSaslDigestMd5 *digest,
+                  GSignondSessionData *session_data,
+                  const gchar *challenge,
+                  GError **error)
+{
+    GSignondSaslDigestMd5Credentials credentials;
+    const gchar *qop;
+    gchar *message;
+
+    if (gsignond_sasl_digest_md5_get_state (digest) ==
+        GSIGNOND_SASL_DIGEST_MD5_STATE_RESPONSE_SENT) {
+        if (!gsignond_sasl_digest_md5_verify (digest, challenge, error))
+            return NULL;
+        return g_bytes_new_static ("", 0);
+    }
+    /* like libgsasl, an empty first challenge is answered with nothing,
+     * and the digest-challenge is awaited in the next step */
+    if (challenge == NULL)
+        return g_bytes_new_static ("", 0);
+
+    qop = gsignond_dictionary_get_string (session_data, "Qop");
+    if (qop && g_strcmp0 (qop, "qop-auth") != 0) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_OPERATION_NOT_SUPPORTED,
+                     "Only qop-auth is available when the state is sealed");
+        return NULL;
+    }
+    credentials.username = gsignond_session_data_get_username (session_data);
+    credentials.authzid = gsignond_dictionary_get_string (session_data,
+                                                          "Authzid");
+    credentials.password = gsignond_session_data_get_secret (session_data);
+    credentials.hashed_password = gsignond_dictionary_get_string (
+        session_data, "DigestMd5HashedPassword");
+    credentials.realm = gsignond_session_data_get_realm (session_data);
+    credentials.service = gsignond_dictionary_get_string (session_data,
+                                                          "Service");
+    credentials.hostname = gsignond_dictionary_get_string (session_data,
+                                                           "Hostname");
+    credentials.qop = GSIGNOND_SASL_QOP_AUTH;
+    message = gsignond_sasl_digest_md5_response (digest, challenge,
+                                                 &credentials, error);
+    if (message == NULL)
+        return NULL;
+    return g_bytes_new_take (message, strlen (message));
+}
+
+/* The salted password from "ScramSaltedPassword", the key cache or PBKDF2;
+ * there is no session to derive it ahead of time for */
+static gboolean
+_scram_salted_password (GSignondSessionData *session_data,
+                        GChecksumType checksum_type,
+                        const gchar *salt_base64,
+                        guint iterations,
+                        guint8 *derived,
+                        gsize derived_len,
+                        GError **error)
+{
+    const gchar *salted_password;
+    const gchar *secret;
+    const gchar *username;
+    gchar *prepped_secret;
+    guchar *salt;
+    gsize salt_len;
+    gboolean completed;
+
+    salted_password = gsignond_dictionary_get_string (session_data,
+                                                      "ScramSaltedPassword");
+    if (salted_password) {
+        if (gsignond_sasl_kdf_hex_decode (salted_password, derived,
+                                          derived_len))
+            return TRUE;
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "ScramSaltedPassword doesn't suit the mechanism");
+        return FALSE;
+    }
+    secret = gsignond_session_data_get_secret (session_data);
+    prepped_secret = secret ? _prepare (secret) : NULL;
+    if (prepped_secret == NULL) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "SCRAM needs a valid secret");
+        return FALSE;
+    }
+
+    username = gsignond_session_data_get_username (session_data);
+    if (username == NULL)
+        username = "";
+    salt = g_base64_decode (salt_base64, &salt_len);
+    completed = gsignond_sasl_key_cache_lookup (checksum_type, username,
+                                                prepped_secret, salt,
+                                                salt_len, iterations,
+                                                derived, derived_len);
+    if (!completed &&
+        gsignond_sasl_admission_acquire (NULL, error)) {
+        completed = gsignond_sasl_pbkdf2 (checksum_type,
+                                          (const guchar *) prepped_secret,
+                                          strlen (prepped_secret),
+                                          salt, salt_len, iterations,
+                                          derived, NULL);
+        gsignond_sasl_admission_release ();
+        if (completed)
+            gsignond_sasl_key_cache_insert (checksum_type, username,
+                                            prepped_secret, salt, salt_len,
+                                            iterations, derived, derived_len);
+    }
+    memset (prepped_secret, 0, strlen (prepped_secret));
+    g_free (prepped_secret);
+    g_free (salt);
+    return completed;
+}
+
+static GBytes *
+_scram_step (GSignondSaslScram *scram,
+             GSignondSessionData *session_data,
+             const gchar *challenge,
+             GError **error)
+{
+    GChecksumType checksum_type = gsignond_sasl_scram_get_checksum_type (scram);
+    guint8 derived[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize derived_len = g_checksum_type_get_length (checksum_type);
+    gchar *salt_base64 = NULL;
+    guint iterations = 0;
+    gchar *message;
+
+    switch (gsignond_sasl_scram_get_state (scram)) {
+        case GSIGNOND_SASL_SCRAM_STATE_INITIAL:
+            message = gsignond_sasl_scram_client_first (scram);
+            break;
+        case GSIGNOND_SASL_SCRAM_STATE_CLIENT_FIRST_SENT:
+            if (!gsignond_sasl_scram_parse_server_first (scram, challenge,
+                                                         &salt_base64,
+                                                         &iterations, error))
+                return NULL;
+            if (!_scram_salted_password (session_data, checksum_type,
+                                         salt_base64, iterations, derived,
+                                         derived_len, error)) {
+                g_free (salt_base64);
+                return NULL;
+            }
+            g_free (salt_base64);
+            message = gsignond_sasl_scram_client_final (scram, challenge,
+                                                        derived, derived_len,
+                                                        error);
+            memset (derived, 0, sizeof (derived));
+            break;
+        case GSIGNOND_SASL_SCRAM_STATE_CLIENT_FINAL_SENT:
+            if (!gsignond_sasl_scram_verify_server_final (scram, challenge,
+                                                          error))
+                return NULL;
+            message = g_strdup ("");
+            break;
+        default:
+            message = NULL;
+            g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                         "SCRAM session is already complete");
+            break;
+    }
+    if (message == NULL)
+        return NULL;
+    return g_bytes_new_take (message, strlen (message));
+}
+
+static const gchar *
+_user_or_empty (const gchar *name)
+{
+    return name ? name : "";
+}
+
+/* Takes @engine_state */
+static GBytes *
+_seal_state (GSignondSessionData *session_data,
+             GSignondSaslMechanism mechanism,
+             GBytes *engine_state)
+{
+    GVariant *state;
+    GBytes *plaintext;
+    GBytes *sealed;
+    guint32 ttl;
+    gint64 expires = 0;
+
+    if (!gsignond_dictionary_get_uint32 (session_data, "IdleTimeout", &ttl))
+        ttl = DEFAULT_STATE_TTL;
+    if (ttl > 0)
+        expires = g_get_real_time () + (gint64) ttl * G_USEC_PER_SEC;
+    state = g_variant_ref_sink (g_variant_new (
+        STATE_FORMAT, (guchar) mechanism, expires,
+        _user_or_empty (gsignond_session_data_get_username (session_data)),
+        _user_or_empty (gsignond_dictionary_get_string (session_data,
+                                                        "Authzid")),
+        g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, engine_state,
+                                  TRUE)));
+    g_bytes_unref (engine_state);
+    plaintext = g_variant_get_data_as_bytes (state);
+    sealed = gsignond_sasl_seal (plaintext);
+    g_bytes_unref (plaintext);
+    g_variant_unref (state);
+    return sealed;
+}
+
+static GBytes *
+_unseal_state (GSignondSessionData *session_data,
+               GBytes *sealed_state,
+               GSignondSaslMechanism *mechanism,
+               GError **error)
+{
+    GBytes *plaintext;
+    GVariant *state;
+    GVariant *engine_state;
+    GBytes *engine_bytes = NULL;
+    const gchar *username;
+    const gchar *authzid;
+    guchar mechanism_id;
+    gint64 expires;
+
+    plaintext = gsignond_sasl_unseal (sealed_state, error);
+    if (plaintext == NULL)
+        return NULL;
+    state = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (STATE_FORMAT), plaintext, FALSE));
+    g_bytes_unref (plaintext);
+    if (!g_variant_is_normal_form (state)) {
+        g_variant_unref (state);
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Sealed session state is malformed");
+        return NULL;
+    }
+    g_variant_get (state, "(yx&s&s@ay)", &mechanism_id, &expires,
+                   &username, &authzid, &engine_state);
+    if (mechanism_id >= GSIGNOND_SASL_N_MECHANISMS ||
+        !gsignond_sasl_stateless_is_supported (mechanism_id)) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_WRONG_STATE,
+                     "Sealed session state is malformed");
+    } else if (expires != 0 && g_get_real_time () > expires) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_TIMED_OUT,
+                     "Sealed session state has expired");
+    } else if (g_strcmp0 (username, _user_or_empty (
+                   gsignond_session_data_get_username (session_data))) != 0 ||
+               g_strcmp0 (authzid, _user_or_empty (
+                   gsignond_dictionary_get_string (session_data,
+                                                   "Authzid"))) != 0) {
+        g_set_error (error, GSIGNOND_ERROR, GSIGNOND_ERROR_NOT_AUTHORIZED,
+                     "Sealed session state belongs to another user");
+    } else {
+        *mechanism = mechanism_id;
+        engine_bytes = g_variant_get_data_as_bytes (engine_state);
+    }
+    g_variant_unref (engine_state);
+    g_variant_unref (state);
+    return engine_bytes;
+}
+
+/* Runs one step of a session whose state is sealed in @sealed_state, or
+ * starts a session of @mechanism if @sealed_state is NULL. The challenge
+ * is "ChallengeBase64" of @session_data. */
+GSignondSessionData *
+gsignond_sasl_stateless_step (GSignondSessionData *session_data,
+                              GSignondSaslMechanism mechanism,
+                              GBytes *sealed_state,
+                              GBytes **next_state,
+                              gboolean *is_final,
+                              GError **error)
+{
+    GSignondSaslDigestMd5 *digest = NULL;
+    GSignondSaslScram *scram = NULL;
+    GSignondSessionData *response;
+    GBytes *engine_state = NULL;
+    GBytes *message = NULL;
+    const gchar *challenge_base64;
+    guchar *challenge;
+    gsize challenge_len = 0;
+    gchar *challenge_text;
+    gchar *encoded;
+    gboolean final = FALSE;
+
+    g_return_val_if_fail (session_data != NULL, NULL);
+    g_return_val_if_fail (next_state != NULL && is_final != NULL, NULL);
+
+    *next_state = NULL;
+    if (sealed_state) {
+        engine_state = _unseal_state (session_data, sealed_state, &mechanism,
+                                      error);
+        if (engine_state == NULL)
+            return NULL;
+    } else if (!gsignond_sasl_stateless_is_supported (mechanism)) {
+        g_set_error (error, GSIGNOND_ERROR,
+                     GSIGNOND_ERROR_MECHANISM_NOT_AVAILABLE,
+                     "%s mechanism can't run with a sealed state",
+                     gsignond_sasl_mechanism_get_name (mechanism));
+        return NULL;
+    }
+    /* the session data comes from the application at every step, not only
+     * the first */
+    if (!gsignond_sasl_engine_check_session_data (session_data, mechanism,
+                                                  error)) {
+        if (engine_state)
+            g_bytes_unref (engine_state);
+        return NULL;
+    }
+    if (sealed_state == NULL)
+        gsignond_sasl_stats_add (mechanism, GSIGNOND_SASL_STAT_STARTED, 1);
+
+    challenge_base64 = gsignond_dictionary_get_string (session_data,
+                                                       "ChallengeBase64");
+    challenge = challenge_base64 && *challenge_base64 ?
+        g_base64_decode (challenge_base64, &challenge_len) : NULL;
+    challenge_text = g_strndup ((const gchar *) challenge, challenge_len);
+
+    switch (mechanism) {
+        case GSIGNOND_SASL_MECHANISM_PLAIN:
+            message = _plain_response (session_data, error);
+            final = TRUE;
+            break;
+        case GSIGNOND_SASL_MECHANISM_CRAM_MD5:
+            message = _cram_md5_response (session_data, challenge,
+                                          challenge_len, error);
+            final = TRUE;
+            break;
+        case GSIGNOND_SASL_MECHANISM_DIGEST_MD5:
+            digest = engine_state ?
+                gsignond_sasl_digest_md5_import (engine_state, error) :
+                gsignond_sasl_digest_md5_new ();
+            if (digest) {
+                message = _digest_md5_step (digest, session_data,
+                                            challenge_text, error);
+                final = gsignond_sasl_digest_md5_get_state (digest) ==
+                    GSIGNOND_SASL_DIGEST_MD5_STATE_DONE;
+                if (message && !final)
+                    *next_state = _seal_state (
+                        session_data, mechanism,
+                        gsignond_sasl_digest_md5_export (digest));
+            }
+            break;
+        default:
+            scram = engine_state ?
+                gsignond_sasl_scram_import (engine_state, error) :
+                gsignond_sasl_scram_new (
+                    gsignond_sasl_mechanism_get_name (mechanism),
+                    gsignond_session_data_get_username (session_data),
+                    gsignond_dictionary_get_string (session_data, "Authzid"),
+                    gsignond_dictionary_get_string (session_data,
+                                                    "CbTlsUnique"),
+                    error);
+            if (scram) {
+                message = _scram_step (scram, session_data, challenge_text,
+                                       error);
+                final = gsignond_sasl_scram_get_state (scram) ==
+                    GSIGNOND_SASL_SCRAM_STATE_DONE;
+                if (message && !final)
+                    *next_state = _seal_state (
+                        session_data, mechanism,
+                        gsignond_sasl_scram_export (scram));
+            }
+            break;
+    }
+    gsignond_sasl_digest_md5_free (digest);
+    gsignond_sasl_scram_free (scram);
+    if (engine_state)
+        g_bytes_unref (engine_state);
+    g_free (challenge_text);
+    g_free (challenge);
+
+    if (message == NULL) {
+        gsignond_sasl_stats_add (mechanism, GSIGNOND_SASL_STAT_FAILED, 1);
+        return NULL;
+    }
+    gsignond_sasl_stats_add (mechanism, GSIGNOND_SASL_STAT_STEPS, 1);
+    if (final)
+        gsignond_sasl_stats_add (mechanism, GSIGNOND_SASL_STAT_SUCCEEDED, 1);
+
+    encoded = g_base64_encode (g_bytes_get_data (message, NULL),
+                               g_bytes_get_size (message));
+    g_bytes_unref (message);
+    response = gsignond_dictionary_new ();
+    gsignond_dictionary_set_string (response, "ResponseBase64", encoded);
+    memset (encoded, 0, strlen (encoded));
+    g_free (encoded);
+    *is_final = final;
+    return response;
+}
@@ -0,0 +1,403 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Per-mechanism runtime counters.
+ *
+ * Every thread that records anything gets its own block of counters, which
+ * only that thread ever writes to, so recording needs neither locks nor
+ * atomic read-modify-write operations. Readers sum up the blocks of all
+ * live threads, plus the totals left behind by threads that have exited;
+ * the registry lock is taken only when a thread records for the first time,
+ * when it exits, and on reads. Since readers run in other threads, counters
+ * are still loaded and stored atomically (relaxed), which also keeps 64-bit
+ * values from tearing on 32-bit platforms.
+ *
+ * Latency histograms live in the same blocks. They are log-scaled: every
+ * power of two of microseconds is split into GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS
+ * equal buckets, so that any recorded value is known within 25%, from 1 us to
+ * more than two hours, in a fixed number of preallocated buckets.
+ */
+
+#include <string.h>
+
+#include "gsignond-sasl-stats.h"
+
+typedef struct {
+    guint64 counters[GSIGNOND_SASL_N_MECHANISMS][GSIGNOND_SASL_N_STATS];
+    guint32 histograms[GSIGNOND_SASL_N_MECHANISMS][GSIGNOND_SASL_N_PHASES]
+                      [GSIGNOND_SASL_HISTOGRAM_BUCKETS];
+} GSignondSaslStatsBlock;
+
+static const gchar *stat_names[GSIGNOND_SASL_N_STATS] = {
+    [GSIGNOND_SASL_STAT_STARTED] = "Started",
+    [GSIGNOND_SASL_STAT_SUCCEEDED] = "Succeeded",
+    [GSIGNOND_SASL_STAT_FAILED] = "Failed",
+    [GSIGNOND_SASL_STAT_CANCELLED] = "Cancelled",
+    [GSIGNOND_SASL_STAT_STEPS] = "Steps",
+    [GSIGNOND_SASL_STAT_BYTES_IN] = "BytesIn",
+    [GSIGNOND_SASL_STAT_BYTES_OUT] = "BytesOut",
+    [GSIGNOND_SASL_STAT_STEP_TIME_US] = "StepTimeUs",
+    [GSIGNOND_SASL_STAT_MAX_STEP_TIME_US] = "MaxStepTimeUs",
+};
+
+static const gchar *phase_names[GSIGNOND_SASL_N_PHASES] = {
+    [GSIGNOND_SASL_PHASE_START] = "Start",
+    [GSIGNOND_SASL_PHASE_STEP_1] = "Step1",
+    [GSIGNOND_SASL_PHASE_STEP_2] = "Step2",
+    [GSIGNOND_SASL_PHASE_STEP_3] = "Step3",
+    [GSIGNOND_SASL_PHASE_STEP_4] = "Step4",
+    [GSIGNOND_SASL_PHASE_HANDSHAKE] = "Handshake",
+};
+
+/* Only the owning thread calls this, so a plain load and store suffice */
+static inline void
+_counter_add (guint64 *counter, guint64 value)
+{
+    __atomic_store_n (counter,
+                      __atomic_load_n (counter, __ATOMIC_RELAXED) + value,
+                      __ATOMIC_RELAXED);
+}
+
+static inline void
+_bucket_increment (guint32 *bucket)
+{
+    __atomic_store_n (bucket, __atomic_load_n (bucket, __ATOMIC_RELAXED) + 1,
+                      __ATOMIC_RELAXED);
+}
+
+static GMutex registry_lock;
+static GSList *live_blocks = NULL;
+static GSignondSaslStatsBlock retired;
+
+static void
+_merge_block (GSignondSaslStatsBlock *total,
+              const GSignondSaslStatsBlock *block)
+{
+    guint m, s, p, b;
+
+    for (m = 0; m < GSIGNOND_SASL_N_MECHANISMS; m++) {
+        for (s = 0; s < GSIGNOND_SASL_N_STATS; s++) {
+            guint64 value = __atomic_load_n (&block->counters[m][s],
+                                             __ATOMIC_RELAXED);
+            if (s == GSIGNOND_SASL_STAT_MAX_STEP_TIME_US)
+                total->counters[m][s] = MAX (total->counters[m][s], value);
+            else
+                total->counters[m][s] += value;
+        }
+        for (p = 0; p < GSIGNOND_SASL_N_PHASES; p++)
+            for (b = 0; b < GSIGNOND_SASL_HISTOGRAM_BUCKETS; b++)
+                total->histograms[m][p][b] +=
+                    __atomic_load_n (&block->histograms[m][p][b],
+                                     __ATOMIC_RELAXED);
+    }
+}
+
+static inline guint
+_bucket_index (guint64 value)
+{
+    guint msb;
+
+    if (value < 2 * GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS)
+        return value;
+    msb = g_bit_storage (value) - 1;
+    if (msb > 32)
+        return GSIGNOND_SASL_HISTOGRAM_BUCKETS - 1;
+    /* octave, plus the two bits following the most significant one */
+    return (msb - 1) * GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS +
+           ((value >> (msb - 2)) & (GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Exclusive upper bound of the values that fall in @index */
+static guint64
+_bucket_upper_bound (guint index)
+{
+    guint octave = index / GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS;
+    guint sub = index % GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS;
+
+    if (octave < 2)
+        return index + 1;
+    return (guint64) (GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS + sub + 1)
+           << (octave - 1);
+}
+
+static void
+_retire_block (gpointer data)
+{
+    GSignondSaslStatsBlock *block = data;
+
+    g_mutex_lock (&registry_lock);
+    live_blocks = g_slist_remove (live_blocks, block);
+    _merge_block (&retired, block);
+    g_mutex_unlock (&registry_lock);
+    g_slice_free (GSignondSaslStatsBlock, block);
+}
+
+static GPrivate thread_block = G_PRIVATE_INIT (_retire_block);
+
+static inline GSignondSaslStatsBlock *
+_get_block (void)
+{
+    GSignondSaslStatsBlock *block = g_private_get (&thread_block);
+
+    if (G_UNLIKELY (block == NULL)) {
+        block = g_slice_new0 (GSignondSaslStatsBlock);
+        g_mutex_lock (&registry_lock);
+        live_blocks = g_slist_prepend (live_blocks, block);
+        g_mutex_unlock (&registry_lock);
+        g_private_set (&thread_block, block);
+    }
+    return block;
+}
+
+void
+gsignond_sasl_stats_add (GSignondSaslMechanism mechanism,
+                         GSignondSaslStat stat,
+                         guint64 value)
+{
+    _counter_add (&_get_block ()->counters[mechanism][stat], value);
+}
+
+void
+gsignond_sasl_stats_record_step (GSignondSaslMechanism mechanism,
+                                 gsize bytes_in,
+                                 gsize bytes_out,
+                                 guint64 step_time_us)
+{
+    guint64 *counters = _get_block ()->counters[mechanism];
+
+    _counter_add (&counters[GSIGNOND_SASL_STAT_STEPS], 1);
+    _counter_add (&counters[GSIGNOND_SASL_STAT_BYTES_IN], bytes_in);
+    _counter_add (&counters[GSIGNOND_SASL_STAT_BYTES_OUT], bytes_out);
+    _counter_add (&counters[GSIGNOND_SASL_STAT_STEP_TIME_US], step_time_us);
+    if (step_time_us > counters[GSIGNOND_SASL_STAT_MAX_STEP_TIME_US])
+        __atomic_store_n (&counters[GSIGNOND_SASL_STAT_MAX_STEP_TIME_US],
+                          step_time_us, __ATOMIC_RELAXED);
+}
+
+void
+gsignond_sasl_stats_record_latency (GSignondSaslMechanism mechanism,
+                                    GSignondSaslPhase phase,
+                                    guint64 duration_us)
+{
+    _bucket_increment (
+        &_get_block ()->histograms[mechanism][phase][_bucket_index (duration_us)]);
+}
+
+static GSignondSaslStatsBlock *
+_collect_totals (void)
+{
+    GSignondSaslStatsBlock *total = g_new (GSignondSaslStatsBlock, 1);
+    GSList *item;
+
+    g_mutex_lock (&registry_lock);
+    *total = retired;
+    for (item = live_blocks; item; item = item->next)
+        _merge_block (total, item->data);
+    g_mutex_unlock (&registry_lock);
+    return total;
+}
+
+/* Returns a floating a{sv} dictionary with an a{sv} entry for every mechanism
+ * that has been used, keyed by the mechanism name */
+GVariant *
+gsignond_sasl_stats_to_variant (void)
+{
+    GSignondSaslStatsBlock *total = _collect_totals ();
+    GVariantBuilder builder;
+    guint m, s;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    for (m = 0; m < GSIGNOND_SASL_N_MECHANISMS; m++) {
+        GVariantBuilder mechanism_builder;
+
+        if (total->counters[m][GSIGNOND_SASL_STAT_STARTED] == 0 &&
+            total->counters[m][GSIGNOND_SASL_STAT_STEPS] == 0)
+            continue;
+
+        g_variant_builder_init (&mechanism_builder, G_VARIANT_TYPE_VARDICT);
+        for (s = 0; s < GSIGNOND_SASL_N_STATS; s++)
+            g_variant_builder_add (&mechanism_builder, "{sv}", stat_names[s],
+                                   g_variant_new_uint64 (
+                                       total->counters[m][s]));
+        g_variant_builder_add (&builder, "{sv}",
+                               gsignond_sasl_mechanism_get_name (m),
+                               g_variant_builder_end (&mechanism_builder));
+    }
+    g_free (total);
+
+    return g_variant_builder_end (&builder);
+}
+
+typedef struct {
+    guint64 count;
+    guint64 p50;
+    guint64 p90;
+    guint64 p99;
+    guint64 p999;
+    guint64 max;
+} GSignondSaslHistogramSummary;
+
+/* Percentiles are reported as the upper bound of the bucket they fall in */
+static gboolean
+_summarize (const guint32 *buckets,
+            GSignondSaslHistogramSummary *summary)
+{
+    guint64 seen = 0;
+    guint b;
+
+    memset (summary, 0, sizeof (*summary));
+    for (b = 0; b < GSIGNOND_SASL_HISTOGRAM_BUCKETS; b++)
+        summary->count += buckets[b];
+    if (summary->count == 0)
+        return FALSE;
+
+    for (b = 0; b < GSIGNOND_SASL_HISTOGRAM_BUCKETS; b++) {
+        if (buckets[b] == 0)
+            continue;
+        seen += buckets[b];
+        if (summary->p50 == 0 && seen * 1000 >= summary->count * 500)
+            summary->p50 = _bucket_upper_bound (b);
+        if (summary->p90 == 0 && seen * 1000 >= summary->count * 900)
+            summary->p90 = _bucket_upper_bound (b);
+        if (summary->p99 == 0 && seen * 1000 >= summary->count * 990)
+            summary->p99 = _bucket_upper_bound (b);
+        if (summary->p999 == 0 && seen * 1000 >= summary->count * 999)
+            summary->p999 = _bucket_upper_bound (b);
+        summary->max = _bucket_upper_bound (b);
+    }
+    return TRUE;
+}
+
+/* Returns a floating a{sv} dictionary keyed by mechanism name, with an a{sv}
+ * entry keyed by phase name for every phase that has been recorded */
+GVariant *
+gsignond_sasl_stats_histograms_to_variant (void)
+{
+    GSignondSaslStatsBlock *total = _collect_totals ();
+    GVariantBuilder builder;
+    guint m, p, b;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    for (m = 0; m < GSIGNOND_SASL_N_MECHANISMS; m++) {
+        GVariantBuilder mechanism_builder;
+        gboolean recorded = FALSE;
+
+        g_variant_builder_init (&mechanism_builder, G_VARIANT_TYPE_VARDICT);
+        for (p = 0; p < GSIGNOND_SASL_N_PHASES; p++) {
+            const guint32 *buckets = total->histograms[m][p];
+            GSignondSaslHistogramSummary summary;
+            GVariantBuilder phase_builder;
+            GVariantBuilder buckets_builder;
+
+            if (!_summarize (buckets, &summary))
+                continue;
+            recorded = TRUE;
+
+            g_variant_builder_init (&buckets_builder, G_VARIANT_TYPE ("a(tu)"));
+            for (b = 0; b < GSIGNOND_SASL_HISTOGRAM_BUCKETS; b++) {
+                if (buckets[b] > 0)
+                    g_variant_builder_add (&buckets_builder, "(tu)",
+                                           _bucket_upper_bound (b),
+                                           buckets[b]);
+            }
+
+            g_variant_builder_init (&phase_builder, G_VARIANT_TYPE_VARDICT);
+            g_variant_builder_add (&phase_builder, "{sv}", "Count",
+                                   g_variant_new_uint64 (summary.count));
+            g_variant_builder_add (&phase_builder, "{sv}", "P50Us",
+                                   g_variant_new_uint64 (summary.p50));
+            g_variant_builder_add (&phase_builder, "{sv}", "P90Us",
+                                   g_variant_new_uint64 (summary.p90));
+            g_variant_builder_add (&phase_builder, "{sv}", "P99Us",
+                                   g_variant_new_uint64 (summary.p99));
+            g_variant_builder_add (&phase_builder, "{sv}", "P999Us",
+                                   g_variant_new_uint64 (summary.p999));
+            g_variant_builder_add (&phase_builder, "{sv}", "MaxUs",
+                                   g_variant_new_uint64 (summary.max));
+            g_variant_builder_add (&phase_builder, "{sv}", "Buckets",
+                                   g_variant_builder_end (&buckets_builder));
+            g_variant_builder_add (&mechanism_builder, "{sv}", phase_names[p],
+                                   g_variant_builder_end (&phase_builder));
+        }
+        if (recorded)
+            g_variant_builder_add (&builder, "{sv}",
+                                   gsignond_sasl_mechanism_get_name (m),
+                                   g_variant_builder_end (&mechanism_builder));
+        else
+            g_variant_builder_clear (&mechanism_builder);
+    }
+    g_free (total);
+
+    return g_variant_builder_end (&builder);
+}
+
+/* Writes all recorded histograms to @path as text, one line per mechanism
+ * and phase with the summary, followed by a line with the non-empty buckets
+ * as upper-bound:count pairs */
+gboolean
+gsignond_sasl_stats_dump_histograms (const gchar *path,
+                                     GError **error)
+{
+    GSignondSaslStatsBlock *total = _collect_totals ();
+    GString *dump = g_string_new (NULL);
+    gboolean result;
+    guint m, p, b;
+
+    g_string_append_printf (dump, "# timestamp %" G_GINT64_FORMAT "\n",
+                            g_get_real_time ());
+    g_string_append (dump, "# mechanism phase count p50_us p90_us p99_us "
+                           "p999_us max_us\n");
+    for (m = 0; m < GSIGNOND_SASL_N_MECHANISMS; m++) {
+        for (p = 0; p < GSIGNOND_SASL_N_PHASES; p++) {
+            const guint32 *buckets = total->histograms[m][p];
+            GSignondSaslHistogramSummary summary;
+
+            if (!_summarize (buckets, &summary))
+                continue;
+            g_string_append_printf (dump,
+                "%s %s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n",
+                gsignond_sasl_mechanism_get_name (m), phase_names[p],
+                summary.count, summary.p50, summary.p90, summary.p99,
+                summary.p999, summary.max);
+            g_string_append (dump, "#  buckets");
+            for (b = 0; b < GSIGNOND_SASL_HISTOGRAM_BUCKETS; b++) {
+                if (buckets[b] > 0)
+                    g_string_append_printf (dump,
+                                            " %" G_GUINT64_FORMAT ":%u",
+                                            _bucket_upper_bound (b),
+                                            buckets[b]);
+            }
+            g_string_append_c (dump, '\n');
+        }
+    }
+    g_free (total);
+
+    result = g_file_set_contents (path, dump->str, dump->len, error);
+    g_string_free (dump, TRUE);
+    return result;
+}
@@ -0,0 +1,92 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GSIGNOND_SASL_STATS_H__
+#define __GSIGNOND_SASL_STATS_H__
+
+#include <glib.h>
+
+#include "gsignond-sasl-mechanisms.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    GSIGNOND_SASL_STAT_STARTED = 0,
+    GSIGNOND_SASL_STAT_SUCCEEDED,
+    GSIGNOND_SASL_STAT_FAILED,
+    GSIGNOND_SASL_STAT_CANCELLED,
+    GSIGNOND_SASL_STAT_STEPS,
+    GSIGNOND_SASL_STAT_BYTES_IN,
+    GSIGNOND_SASL_STAT_BYTES_OUT,
+    GSIGNOND_SASL_STAT_STEP_TIME_US,
+    GSIGNOND_SASL_STAT_MAX_STEP_TIME_US,
+    GSIGNOND_SASL_N_STATS
+} GSignondSaslStat;
+
+/* What a latency histogram measures */
+typedef enum {
+    GSIGNOND_SASL_PHASE_START = 0,
+    GSIGNOND_SASL_PHASE_STEP_1,
+    GSIGNOND_SASL_PHASE_STEP_2,
+    GSIGNOND_SASL_PHASE_STEP_3,
+    /* the fourth and any further steps */
+    GSIGNOND_SASL_PHASE_STEP_4,
+    GSIGNOND_SASL_PHASE_HANDSHAKE,
+    GSIGNOND_SASL_N_PHASES
+} GSignondSaslPhase;
+
+/* Each power of two is split into this many buckets */
+#define GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS 4
+#define GSIGNOND_SASL_HISTOGRAM_BUCKETS (32 * GSIGNOND_SASL_HISTOGRAM_SUB_BUCKETS)
+
+void
+gsignond_sasl_stats_add (GSignondSaslMechanism mechanism,
+                         GSignondSaslStat stat,
+                         guint64 value);
+
+void
+gsignond_sasl_stats_record_step (GSignondSaslMechanism mechanism,
+                                 gsize bytes_in,
+                                 gsize bytes_out,
+                                 guint64 step_time_us);
+
+void
+gsignond_sasl_stats_record_latency (GSignondSaslMechanism mechanism,
+                                    GSignondSaslPhase phase,
+                                    guint64 duration_us);
+
+GVariant *
+gsignond_sasl_stats_to_variant (void);
+
+GVariant *
+gsignond_sasl_stats_histograms_to_variant (void);
+
+gboolean
+gsignond_sasl_stats_dump_histograms (const gchar *path,
+                                     GError **error);
+
+G_END_DECLS
+
+#endif /* __GSIGNOND_SASL_STATS_H__ */
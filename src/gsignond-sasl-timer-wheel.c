@@ -0,0 +1,165 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * A single process-wide timer wheel that tracks the inactivity of all SASL
+ * sessions. It has one slot per second of the wheel's revolution, and one
+ * GSource in the default main context that advances it every second, but
+ * only while some entry is armed. Entries whose timeout exceeds one
+ * revolution wait in their slot for the required number of rounds.
+ *
+ * Arming and disarming are O(1) and can be done from any thread; expiry
+ * callbacks are invoked from the default main context, without any wheel
+ * lock held.
+ */
+
+#include "gsignond-sasl-timer-wheel.h"
+
+#define WHEEL_SLOTS 64
+
+typedef struct {
+    GObject *owner;
+    GSignondSaslTimerWheelFunc expired;
+} GSignondSaslTimerWheelExpiry;
+
+static GMutex wheel_lock;
+static GQueue wheel[WHEEL_SLOTS];
+static guint wheel_cursor = 0;
+static guint wheel_armed = 0;
+static gboolean wheel_ticking = FALSE;
+
+static void
+_unlink_entry (GSignondSaslTimerWheelEntry *entry)
+{
+    g_queue_unlink (&wheel[entry->slot], &entry->link);
+    entry->armed = FALSE;
+    wheel_armed--;
+}
+
+static gboolean
+_wheel_tick (gpointer user_data)
+{
+    GSList *expired = NULL;
+    GSList *item;
+    GList *link;
+    gboolean keep_ticking;
+
+    g_mutex_lock (&wheel_lock);
+    wheel_cursor = (wheel_cursor + 1) % WHEEL_SLOTS;
+    link = wheel[wheel_cursor].head;
+    while (link) {
+        GSignondSaslTimerWheelEntry *entry = link->data;
+        link = link->next;
+
+        if (entry->rounds > 0) {
+            entry->rounds--;
+            continue;
+        }
+        _unlink_entry (entry);
+
+        /* the owner may be under finalization in another thread */
+        GObject *owner = g_weak_ref_get (&entry->owner);
+        if (owner) {
+            GSignondSaslTimerWheelExpiry *expiry =
+                g_slice_new (GSignondSaslTimerWheelExpiry);
+            expiry->owner = owner;
+            expiry->expired = entry->expired;
+            expired = g_slist_prepend (expired, expiry);
+        }
+    }
+    keep_ticking = wheel_armed > 0;
+    if (!keep_ticking)
+        wheel_ticking = FALSE;
+    g_mutex_unlock (&wheel_lock);
+
+    for (item = expired; item; item = item->next) {
+        GSignondSaslTimerWheelExpiry *expiry = item->data;
+        expiry->expired (expiry->owner);
+        g_object_unref (expiry->owner);
+        g_slice_free (GSignondSaslTimerWheelExpiry, expiry);
+    }
+    g_slist_free (expired);
+
+    return keep_ticking;
+}
+
+void
+gsignond_sasl_timer_wheel_entry_init (GSignondSaslTimerWheelEntry *entry,
+                                      GObject *owner,
+                                      GSignondSaslTimerWheelFunc expired)
+{
+    entry->link.data = entry;
+    entry->link.next = NULL;
+    entry->link.prev = NULL;
+    entry->slot = 0;
+    entry->rounds = 0;
+    entry->armed = FALSE;
+    entry->expired = expired;
+    g_weak_ref_init (&entry->owner, owner);
+}
+
+void
+gsignond_sasl_timer_wheel_entry_clear (GSignondSaslTimerWheelEntry *entry)
+{
+    gsignond_sasl_timer_wheel_disarm (entry);
+    g_weak_ref_clear (&entry->owner);
+}
+
+/* (Re)starts the countdown of @entry; it expires after @timeout_seconds
+ * unless it is armed again or disarmed before that. */
+void
+gsignond_sasl_timer_wheel_arm (GSignondSaslTimerWheelEntry *entry,
+                               guint timeout_seconds)
+{
+    guint ticks = MAX (timeout_seconds, 1);
+
+    g_mutex_lock (&wheel_lock);
+    if (entry->armed)
+        _unlink_entry (entry);
+
+    entry->slot = (wheel_cursor + ticks) % WHEEL_SLOTS;
+    entry->rounds = (ticks - 1) / WHEEL_SLOTS;
+    entry->armed = TRUE;
+    g_queue_push_tail_link (&wheel[entry->slot], &entry->link);
+    wheel_armed++;
+
+    if (!wheel_ticking) {
+        GSource *source = g_timeout_source_new_seconds (1);
+        g_source_set_callback (source, _wheel_tick, NULL, NULL);
+        g_source_attach (source, g_main_context_default ());
+        g_source_unref (source);
+        wheel_ticking = TRUE;
+    }
+    g_mutex_unlock (&wheel_lock);
+}
+
+void
+gsignond_sasl_timer_wheel_disarm (GSignondSaslTimerWheelEntry *entry)
+{
+    g_mutex_lock (&wheel_lock);
+    if (entry->armed)
+        _unlink_entry (entry);
+    g_mutex_unlock (&wheel_lock);
+}
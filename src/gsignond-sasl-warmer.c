@@ -0,0 +1,444 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Background warming of the key cache.
+ *
+ * Keys of accounts whose SCRAM parameters are known are derived ahead of the
+ * first authorization, one at a time: a low priority idle source in the
+ * default main context picks the next job when the process has nothing else
+ * to do, and hands it to a worker thread that runs with the lowest
+ * scheduling priority. The worker may use at most budget_ms of CPU time per
+ * window_seconds (1000 ms per 60 s by default, or SSO_SASL_WARMER_BUDGET_MS
+ * per SSO_SASL_WARMER_WINDOW); the budget is checked during the derivation,
+ * which pauses until the next window once it is spent, and the remaining
+ * jobs wait for that window too. A derivation also waits for its turn in
+ * admission control like any other, and gives its place up while paused.
+ * Nothing is started while the system is in power saving mode, and if that
+ * lasts longer than POWER_SAVER_DROP seconds the queued jobs, passwords
+ * included, are dropped.
+ */
+
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include <gio/gio.h>
+
+#include "gsignond-sasl-warmer.h"
+#include "gsignond-sasl-admission.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-key-cache.h"
+
+#define MAX_JOBS 32
+#define WORKER_NICE 19
+/* how long to wait before checking the power saving mode again */
+#define POWER_SAVER_RECHECK 60
+/* how long the queued jobs are kept while power saving lasts */
+#define POWER_SAVER_DROP 600
+/* how long to wait before trying again when admission control is full */
+#define ADMISSION_RETRY 5
+
+typedef struct {
+    GChecksumType checksum_type;
+    gchar *username;
+    gchar *password;
+    guchar *salt;
+    gsize salt_len;
+    guint iterations;
+} GSignondSaslWarmerJob;
+
+static GMutex warmer_lock;
+/* signaled when the running job is canceled */
+static GCond warmer_cond;
+static gboolean warmer_initialized = FALSE;
+static GQueue jobs = G_QUEUE_INIT;
+static gboolean scheduled = FALSE;
+static gboolean working = FALSE;
+static volatile gint cancel_flag = 0;
+static guint budget_us;
+static guint window_seconds;
+static gint64 window_start = 0;
+static guint64 window_cpu_us = 0;
+static gint64 power_saver_since = 0;
+
+static guint64 n_warmed = 0;
+static guint64 n_deferred = 0;
+
+static guint
+_limit_from_env (const gchar *name, guint default_value)
+{
+    const gchar *value = g_getenv (name);
+    guint64 limit;
+
+    if (value == NULL)
+        return default_value;
+    limit = g_ascii_strtoull (value, NULL, 10);
+    return limit > G_MAXUINT ? G_MAXUINT : (guint) limit;
+}
+
+static void
+_init_locked (void)
+{
+    if (warmer_initialized)
+        return;
+    budget_us = MIN (_limit_from_env ("SSO_SASL_WARMER_BUDGET_MS", 1000),
+                     G_MAXUINT / 1000) * 1000;
+    window_seconds = MAX (_limit_from_env ("SSO_SASL_WARMER_WINDOW", 60), 1);
+    warmer_initialized = TRUE;
+}
+
+void
+gsignond_sasl_warmer_set_budget (guint budget_ms,
+                                 guint window)
+{
+    g_mutex_lock (&warmer_lock);
+    budget_us = MIN (budget_ms, G_MAXUINT / 1000) * 1000;
+    window_seconds = MAX (window, 1);
+    window_start = 0;
+    window_cpu_us = 0;
+    warmer_initialized = TRUE;
+    g_mutex_unlock (&warmer_lock);
+}
+
+static void
+_job_free (GSignondSaslWarmerJob *job)
+{
+    memset (job->password, 0, strlen (job->password));
+    g_free (job->username);
+    g_free (job->password);
+    g_free (job->salt);
+    g_slice_free (GSignondSaslWarmerJob, job);
+}
+
+static gint64
+_thread_cpu_time (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gboolean
+_power_saver_enabled (void)
+{
+#if GLIB_CHECK_VERSION (2, 70, 0)
+    static GPowerProfileMonitor *monitor = NULL;
+
+    /* only called from the default main context */
+    if (monitor == NULL)
+        monitor = g_power_profile_monitor_dup_default ();
+    return monitor &&
+           g_power_profile_monitor_get_power_saver_enabled (monitor);
+#else
+    return FALSE;
+#endif
+}
+
+static gboolean _dispatch (gpointer user_data);
+
+static void
+_schedule_locked (guint delay_seconds)
+{
+    GSource *source;
+
+    if (scheduled || working || g_queue_is_empty (&jobs))
+        return;
+    source = delay_seconds ? g_timeout_source_new_seconds (delay_seconds)
+                           : g_idle_source_new ();
+    g_source_set_priority (source, G_PRIORITY_LOW);
+    g_source_set_callback (source, _dispatch, NULL, NULL);
+    g_source_attach (source, g_main_context_default ());
+    g_source_unref (source);
+    scheduled = TRUE;
+}
+
+typedef struct {
+    gint64 cpu_mark;
+    gboolean admitted;
+} GSignondSaslWarmerProgress;
+
+/* Accounts the CPU time used since the last check, and pauses the
+ * derivation until the next window once the budget is spent; returns FALSE
+ * if the job was canceled or can't get its place back in admission */
+static gboolean
+_check_budget (gpointer user_data)
+{
+    GSignondSaslWarmerProgress *progress = user_data;
+    gint64 cpu_now = _thread_cpu_time ();
+    gint64 window_end;
+    gboolean paused = FALSE;
+
+    g_mutex_lock (&warmer_lock);
+    window_cpu_us += cpu_now - progress->cpu_mark;
+    while (!g_atomic_int_get (&cancel_flag) && window_cpu_us >= budget_us) {
+        window_end = window_start + (gint64) window_seconds * G_USEC_PER_SEC;
+        if (g_get_monotonic_time () >= window_end) {
+            window_start = g_get_monotonic_time ();
+            window_cpu_us = 0;
+            break;
+        }
+        if (!paused) {
+            n_deferred++;
+            paused = TRUE;
+            if (progress->admitted) {
+                gsignond_sasl_admission_release ();
+                progress->admitted = FALSE;
+            }
+        }
+        g_cond_wait_until (&warmer_cond, &warmer_lock, window_end);
+    }
+    g_mutex_unlock (&warmer_lock);
+
+    if (paused && !g_atomic_int_get (&cancel_flag))
+        progress->admitted = gsignond_sasl_admission_acquire (&cancel_flag,
+                                                              NULL);
+    progress->cpu_mark = _thread_cpu_time ();
+    return progress->admitted && !g_atomic_int_get (&cancel_flag);
+}
+
+static gpointer
+_warm_thread (gpointer data)
+{
+    GSignondSaslWarmerJob *job = data;
+    GSignondSaslWarmerProgress progress = { 0, FALSE };
+    guint8 key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    gsize key_len = g_checksum_type_get_length (job->checksum_type);
+    gboolean derived = FALSE;
+    gboolean cached;
+
+#ifdef __linux__
+    /* the nice value of a Linux thread is its own, unlike elsewhere where
+     * this would lower the priority of the whole daemon */
+    setpriority (PRIO_PROCESS, (id_t) syscall (SYS_gettid), WORKER_NICE);
+#endif
+    progress.cpu_mark = _thread_cpu_time ();
+    cached = gsignond_sasl_key_cache_lookup (job->checksum_type,
+                                             job->username, job->password,
+                                             job->salt, job->salt_len,
+                                             job->iterations, key, key_len);
+    if (!cached) {
+        progress.admitted = gsignond_sasl_admission_acquire (&cancel_flag,
+                                                             NULL);
+        if (progress.admitted)
+            derived = gsignond_sasl_pbkdf2_checked (
+                job->checksum_type, (const guchar *) job->password,
+                strlen (job->password), job->salt, job->salt_len,
+                job->iterations, key, _check_budget, &progress);
+        if (progress.admitted)
+            gsignond_sasl_admission_release ();
+        if (derived)
+            gsignond_sasl_key_cache_insert (job->checksum_type,
+                                            job->username, job->password,
+                                            job->salt, job->salt_len,
+                                            job->iterations, key, key_len);
+    }
+    memset (key, 0, sizeof (key));
+
+    g_mutex_lock (&warmer_lock);
+    window_cpu_us += _thread_cpu_time () - progress.cpu_mark;
+    working = FALSE;
+    if (derived)
+        n_warmed++;
+    if (!cached && !derived && !g_atomic_int_get (&cancel_flag)) {
+        /* admission control was full: the job is tried again later */
+        g_queue_push_head (&jobs, job);
+        job = NULL;
+        _schedule_locked (ADMISSION_RETRY);
+    } else {
+        _schedule_locked (0);
+    }
+    g_mutex_unlock (&warmer_lock);
+    if (job)
+        _job_free (job);
+    return NULL;
+}
+
+static gboolean
+_dispatch (gpointer user_data)
+{
+    GSignondSaslWarmerJob *job;
+    GThread *thread;
+    gint64 now = g_get_monotonic_time ();
+    gint64 window_end;
+
+    g_mutex_lock (&warmer_lock);
+    scheduled = FALSE;
+    if (g_queue_is_empty (&jobs)) {
+        g_mutex_unlock (&warmer_lock);
+        return G_SOURCE_REMOVE;
+    }
+    if (_power_saver_enabled ()) {
+        if (power_saver_since == 0) {
+            power_saver_since = now;
+        } else if (now - power_saver_since >=
+                   (gint64) POWER_SAVER_DROP * G_USEC_PER_SEC) {
+            /* the passwords are not kept around for a warming that may
+             * never come */
+            while ((job = g_queue_pop_head (&jobs)) != NULL)
+                _job_free (job);
+            g_mutex_unlock (&warmer_lock);
+            return G_SOURCE_REMOVE;
+        }
+        n_deferred++;
+        _schedule_locked (POWER_SAVER_RECHECK);
+        g_mutex_unlock (&warmer_lock);
+        return G_SOURCE_REMOVE;
+    }
+    power_saver_since = 0;
+    window_end = window_start + (gint64) window_seconds * G_USEC_PER_SEC;
+    if (now >= window_end) {
+        window_start = now;
+        window_cpu_us = 0;
+    } else if (window_cpu_us >= budget_us) {
+        n_deferred++;
+        _schedule_locked ((guint) ((window_end - now) / G_USEC_PER_SEC) + 1);
+        g_mutex_unlock (&warmer_lock);
+        return G_SOURCE_REMOVE;
+    }
+
+    job = g_queue_pop_head (&jobs);
+    working = TRUE;
+    g_atomic_int_set (&cancel_flag, 0);
+    g_mutex_unlock (&warmer_lock);
+
+    thread = g_thread_try_new ("sasl-warmer", _warm_thread, job, NULL);
+    if (thread) {
+        g_thread_unref (thread);
+    } else {
+        _job_free (job);
+        g_mutex_lock (&warmer_lock);
+        working = FALSE;
+        g_mutex_unlock (&warmer_lock);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_same_job (GSignondSaslWarmerJob *job,
+           GChecksumType checksum_type,
+           const gchar *username,
+           const guchar *salt,
+           gsize salt_len,
+           guint iterations)
+{
+    return job->checksum_type == checksum_type &&
+           job->iterations == iterations &&
+           job->salt_len == salt_len &&
+           memcmp (job->salt, salt, salt_len) == 0 &&
+           g_strcmp0 (job->username, username) == 0;
+}
+
+/*
+ * Queues the derivation of a key for the cache. @password must already be
+ * prepared with SASLprep. Returns %FALSE if the key is cached already or the
+ * queue is full.
+ */
+gboolean
+gsignond_sasl_warmer_add (GChecksumType checksum_type,
+                          const gchar *username,
+                          const gchar *password,
+                          const guchar *salt,
+                          gsize salt_len,
+                          guint iterations)
+{
+    guint8 key[GSIGNOND_SASL_KEY_CACHE_MAX_KEY_SIZE];
+    GSignondSaslWarmerJob *job;
+    GList *link;
+
+    g_return_val_if_fail (password != NULL, FALSE);
+    g_return_val_if_fail (iterations > 0, FALSE);
+
+    if (username == NULL)
+        username = "";
+    if (gsignond_sasl_key_cache_lookup (checksum_type, username, password,
+                                        salt, salt_len, iterations, key,
+                                        g_checksum_type_get_length (
+                                            checksum_type))) {
+        memset (key, 0, sizeof (key));
+        return FALSE;
+    }
+
+    g_mutex_lock (&warmer_lock);
+    _init_locked ();
+    for (link = jobs.head; link; link = link->next) {
+        if (_same_job (link->data, checksum_type, username, salt, salt_len,
+                       iterations)) {
+            g_mutex_unlock (&warmer_lock);
+            return TRUE;
+        }
+    }
+    if (jobs.length >= MAX_JOBS) {
+        g_mutex_unlock (&warmer_lock);
+        return FALSE;
+    }
+    job = g_slice_new0 (GSignondSaslWarmerJob);
+    job->checksum_type = checksum_type;
+    job->username = g_strdup (username);
+    job->password = g_strdup (password);
+    job->salt = g_malloc (salt_len);
+    memcpy (job->salt, salt, salt_len);
+    job->salt_len = salt_len;
+    job->iterations = iterations;
+    g_queue_push_tail (&jobs, job);
+    _schedule_locked (0);
+    g_mutex_unlock (&warmer_lock);
+    return TRUE;
+}
+
+/* Drops the queued jobs and interrupts the running one */
+void
+gsignond_sasl_warmer_clear (void)
+{
+    GSignondSaslWarmerJob *job;
+
+    g_mutex_lock (&warmer_lock);
+    while ((job = g_queue_pop_head (&jobs)) != NULL)
+        _job_free (job);
+    if (working) {
+        g_atomic_int_set (&cancel_flag, 1);
+        g_cond_broadcast (&warmer_cond);
+    }
+    g_mutex_unlock (&warmer_lock);
+}
+
+void
+gsignond_sasl_warmer_add_statistics (GVariantBuilder *builder)
+{
+    g_mutex_lock (&warmer_lock);
+    g_variant_builder_add (builder, "{sv}", "WarmerQueued",
+                           g_variant_new_uint32 (jobs.length));
+    g_variant_builder_add (builder, "{sv}", "WarmerDerived",
+                           g_variant_new_uint64 (n_warmed));
+    g_variant_builder_add (builder, "{sv}", "WarmerDeferred",
+                           g_variant_new_uint64 (n_deferred));
+    g_mutex_unlock (&warmer_lock);
+}
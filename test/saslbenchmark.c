@@ -0,0 +1,462 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gsignond
+ *
+ * Copyright (C) 2012 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*
+ * Micro-benchmarks for the plugin internals. Not run by "make check";
+ * build it with "make check" and run ./saslbenchmark [iterations].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gsasl.h>
+#include <gsignond/gsignond-plugin-interface.h>
+#include "gsignond-sasl-engine.h"
+#include "gsignond-sasl-kdf.h"
+#include "gsignond-sasl-log.h"
+#include "gsignond-sasl-plugin.h"
+#include "gsignond-sasl-security-layer.h"
+
+/* size of the messages passed through the security layer */
+#define LAYER_MESSAGE_SIZE 4096
+/* messages per call of the batch functions */
+#define LAYER_BATCH 64
+/* PBKDF2 iterations per derivation, the SCRAM default */
+#define KDF_ITERATIONS 4096
+
+typedef void (*BenchmarkFunc) (guint64 iterations);
+
+static volatile guint64 sink = 0;
+
+static void
+run_benchmark (const gchar *name, BenchmarkFunc func, guint64 iterations)
+{
+    gint64 start = g_get_monotonic_time ();
+    gint64 elapsed;
+
+    func (iterations);
+    elapsed = g_get_monotonic_time () - start;
+    printf ("%-40s %12" G_GUINT64_FORMAT " ops %10.1f ns/op\n", name,
+            iterations, elapsed * 1000.0 / iterations);
+}
+
+/* like run_benchmark(), for functions that process @bytes_per_op bytes
+ * per iteration */
+static void
+run_throughput (const gchar *name, BenchmarkFunc func, guint64 iterations,
+                gsize bytes_per_op)
+{
+    gint64 start = g_get_monotonic_time ();
+    gint64 elapsed;
+
+    func (iterations);
+    elapsed = MAX (g_get_monotonic_time () - start, 1);
+    printf ("%-40s %12" G_GUINT64_FORMAT " ops %10.1f MB/s\n", name,
+            iterations, (gdouble) iterations * bytes_per_op / elapsed);
+}
+
+/* like run_benchmark(), for functions that process @messages_per_op
+ * messages per iteration */
+static void
+run_message_rate (const gchar *name, BenchmarkFunc func, guint64 iterations,
+                  gsize messages_per_op)
+{
+    gint64 start = g_get_monotonic_time ();
+    gint64 elapsed;
+
+    func (iterations);
+    elapsed = MAX (g_get_monotonic_time () - start, 1);
+    printf ("%-40s %12" G_GUINT64_FORMAT " ops %10.0f msg/s\n", name,
+            iterations, iterations * messages_per_op * 1e6 / elapsed);
+}
+
+static void
+discard_log_callback (const gchar *log_domain,
+                      GLogLevelFlags log_level,
+                      const gchar *message,
+                      gpointer user_data)
+{
+    sink++;
+}
+
+static void
+bench_log_baseline (guint64 iterations)
+{
+    guint64 i;
+
+    for (i = 0; i < iterations; i++)
+        sink += i;
+}
+
+static void
+bench_log_compiled_out (guint64 iterations)
+{
+    guint64 i;
+
+    gsignond_sasl_log_set_level (GSIGNOND_SASL_LOG_TRACE);
+    for (i = 0; i < iterations; i++) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_TRACE, "property %d", (gint) i);
+        sink += i;
+    }
+}
+
+static void
+bench_log_disabled (guint64 iterations)
+{
+    guint64 i;
+
+    gsignond_sasl_log_set_level (GSIGNOND_SASL_LOG_WARNING);
+    for (i = 0; i < iterations; i++) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG, "property %d", (gint) i);
+        sink += i;
+    }
+}
+
+static void
+bench_log_rate_limited (guint64 iterations)
+{
+    guint64 i;
+
+    gsignond_sasl_log_set_level (GSIGNOND_SASL_LOG_DEBUG);
+    for (i = 0; i < iterations; i++) {
+        GSIGNOND_SASL_LOG (GSIGNOND_SASL_LOG_DEBUG, "property %d", (gint) i);
+        sink += i;
+    }
+    gsignond_sasl_log_flush ();
+}
+
+static void
+bench_pbkdf2 (guint64 iterations)
+{
+    guint8 output[20];
+    guint64 i;
+
+    for (i = 0; i < iterations; i++) {
+        gsignond_sasl_pbkdf2 (G_CHECKSUM_SHA1, (const guchar *) "password", 8,
+                              (const guchar *) "salt", 4, KDF_ITERATIONS,
+                              output, NULL);
+        sink += output[0];
+    }
+}
+
+/* the same derivation with a GHmac copied for each iteration, as the
+ * plugin did before */
+static void
+bench_pbkdf2_ghmac (guint64 iterations)
+{
+    static const guint8 block_index[4] = { 0, 0, 0, 1 };
+    guint8 output[20];
+    guint8 u[20];
+    GHmac *keyed;
+    GHmac *hmac;
+    gsize len;
+    guint64 i;
+    guint j, k;
+
+    for (i = 0; i < iterations; i++) {
+        keyed = g_hmac_new (G_CHECKSUM_SHA1, (const guchar *) "password", 8);
+        hmac = g_hmac_copy (keyed);
+        g_hmac_update (hmac, (const guchar *) "salt", 4);
+        g_hmac_update (hmac, block_index, sizeof (block_index));
+        len = sizeof (u);
+        g_hmac_get_digest (hmac, u, &len);
+        g_hmac_unref (hmac);
+        memcpy (output, u, sizeof (u));
+        for (j = 1; j < KDF_ITERATIONS; j++) {
+            hmac = g_hmac_copy (keyed);
+            g_hmac_update (hmac, u, sizeof (u));
+            len = sizeof (u);
+            g_hmac_get_digest (hmac, u, &len);
+            g_hmac_unref (hmac);
+            for (k = 0; k < sizeof (u); k++)
+                output[k] ^= u[k];
+        }
+        g_hmac_unref (keyed);
+        sink += output[0];
+    }
+}
+
+#if defined (GSASL_VERSION_NUMBER) && GSASL_VERSION_NUMBER >= 0x010a00
+/* the same derivation in libgsasl, which can't be cancelled */
+static void
+bench_pbkdf2_gsasl (guint64 iterations)
+{
+    char output[20];
+    guint64 i;
+
+    for (i = 0; i < iterations; i++) {
+        gsasl_pbkdf2 (GSASL_HASH_SHA1, "password", 8, "salt", 4,
+                      KDF_ITERATIONS, output, sizeof (output));
+        sink += output[0];
+    }
+}
+#endif
+
+static GSignondSaslQop layer_qop;
+
+static void
+_new_layers (GSignondSaslSecurityLayer **client,
+             GSignondSaslSecurityLayer **server)
+{
+    guint8 session_key[16];
+
+    memset (session_key, 0x5a, sizeof (session_key));
+    *client = gsignond_sasl_security_layer_new_digest_md5 (
+        session_key, layer_qop, 16,
+        GSIGNOND_SASL_SECURITY_LAYER_MAX_RECEIVE, FALSE);
+    *server = gsignond_sasl_security_layer_new_digest_md5 (
+        session_key, layer_qop, 16,
+        GSIGNOND_SASL_SECURITY_LAYER_MAX_RECEIVE, TRUE);
+}
+
+static void
+bench_layer_wrap (guint64 iterations)
+{
+    GSignondSaslSecurityLayer *client;
+    GSignondSaslSecurityLayer *server;
+    static guint8 message[LAYER_MESSAGE_SIZE];
+    static guint8 packet[LAYER_MESSAGE_SIZE +
+                         GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD];
+    GOutputVector vector = { message, sizeof (message) };
+    guint64 i;
+
+    _new_layers (&client, &server);
+    for (i = 0; i < iterations; i++)
+        sink += gsignond_sasl_security_layer_wrapv (client, &vector, 1,
+                                                    packet, sizeof (packet),
+                                                    NULL);
+    gsignond_sasl_security_layer_free (client);
+    gsignond_sasl_security_layer_free (server);
+}
+
+static void
+bench_layer_round_trip (guint64 iterations)
+{
+    GSignondSaslSecurityLayer *client;
+    GSignondSaslSecurityLayer *server;
+    static guint8 message[LAYER_MESSAGE_SIZE];
+    static guint8 packet[LAYER_MESSAGE_SIZE +
+                         GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD];
+    GOutputVector vector = { message, sizeof (message) };
+    guint64 i;
+
+    _new_layers (&client, &server);
+    for (i = 0; i < iterations; i++) {
+        gssize len = gsignond_sasl_security_layer_wrapv (client, &vector, 1,
+                                                         packet,
+                                                         sizeof (packet),
+                                                         NULL);
+        sink += gsignond_sasl_security_layer_unwrap (server, packet, len,
+                                                     packet, sizeof (packet),
+                                                     NULL);
+    }
+    gsignond_sasl_security_layer_free (client);
+    gsignond_sasl_security_layer_free (server);
+}
+
+static gsize batch_message_size;
+
+/* LAYER_BATCH messages of batch_message_size bytes, one call at a time */
+static void
+bench_layer_messages (guint64 iterations)
+{
+    GSignondSaslSecurityLayer *client;
+    GSignondSaslSecurityLayer *server;
+    static guint8 message[LAYER_MESSAGE_SIZE];
+    static guint8 packet[LAYER_MESSAGE_SIZE +
+                         GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD];
+    GOutputVector vector = { message, batch_message_size };
+    guint64 i;
+    guint j;
+
+    _new_layers (&client, &server);
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < LAYER_BATCH; j++) {
+            gssize len = gsignond_sasl_security_layer_wrapv (
+                client, &vector, 1, packet, sizeof (packet), NULL);
+            sink += gsignond_sasl_security_layer_unwrap (
+                server, packet, len, packet, sizeof (packet), NULL);
+        }
+    }
+    gsignond_sasl_security_layer_free (client);
+    gsignond_sasl_security_layer_free (server);
+}
+
+/* the same messages, LAYER_BATCH per call */
+static void
+bench_layer_batch (guint64 iterations)
+{
+    GSignondSaslSecurityLayer *client;
+    GSignondSaslSecurityLayer *server;
+    static guint8 message[LAYER_MESSAGE_SIZE];
+    static guint8 arena[LAYER_BATCH * (LAYER_MESSAGE_SIZE +
+                                       GSIGNOND_SASL_SECURITY_LAYER_OVERHEAD)];
+    GOutputVector messages[LAYER_BATCH];
+    GOutputVector unwrapped[LAYER_BATCH];
+    guint64 i;
+    guint j;
+
+    for (j = 0; j < LAYER_BATCH; j++) {
+        messages[j].buffer = message;
+        messages[j].size = batch_message_size;
+    }
+    _new_layers (&client, &server);
+    for (i = 0; i < iterations; i++) {
+        gsize n_messages = LAYER_BATCH;
+        gssize len = gsignond_sasl_security_layer_wrap_batch (
+            client, messages, LAYER_BATCH, arena, sizeof (arena), NULL);
+
+        sink += gsignond_sasl_security_layer_unwrap_batch (
+            server, arena, len, arena, sizeof (arena), unwrapped, &n_messages,
+            NULL);
+    }
+    gsignond_sasl_security_layer_free (client);
+    gsignond_sasl_security_layer_free (server);
+}
+
+static GSignondSessionData *
+_plain_session_data (void)
+{
+    GSignondSessionData *data = gsignond_dictionary_new ();
+
+    gsignond_session_data_set_username (data, "megauser@example.com");
+    gsignond_session_data_set_secret (data, "megapassword");
+    return data;
+}
+
+static void
+_count_response (GSignondPlugin *plugin,
+                 GSignondSessionData *result,
+                 gpointer user_data)
+{
+    sink++;
+}
+
+/* a PLAIN authorization through the GSignondPlugin interface and its
+ * response-final signal */
+static void
+bench_step_signal (guint64 iterations)
+{
+    GSignondSessionData *data = _plain_session_data ();
+    gpointer plugin = g_object_new (GSIGNOND_TYPE_SASL_PLUGIN, NULL);
+    guint64 i;
+
+    g_signal_connect (plugin, "response-final",
+                      G_CALLBACK (_count_response), NULL);
+    for (i = 0; i < iterations; i++)
+        gsignond_plugin_request_initial (plugin, data, NULL, "PLAIN");
+    g_object_unref (plugin);
+    gsignond_dictionary_unref (data);
+}
+
+/* the same authorization with the engine called directly */
+static void
+bench_step_direct (guint64 iterations)
+{
+    GSignondSessionData *data = _plain_session_data ();
+    GSignondSaslEngine *engine = gsignond_sasl_engine_new ();
+    GSignondSaslEngineResult result;
+    guint64 i;
+
+    for (i = 0; i < iterations; i++) {
+        sink += gsignond_sasl_engine_step (engine, data, "PLAIN", NULL,
+                                           &result);
+        gsignond_sasl_engine_result_clear (&result);
+    }
+    gsignond_sasl_engine_free (engine);
+    gsignond_dictionary_unref (data);
+}
+
+int main (int argc, char *argv[])
+{
+    guint64 iterations = 1000000;
+    GLogFunc old_handler;
+    gsize size;
+
+    if (argc > 1)
+        iterations = g_ascii_strtoull (argv[1], NULL, 10);
+    if (iterations == 0)
+        iterations = 1;
+
+    old_handler = g_log_set_default_handler (discard_log_callback, NULL);
+    run_benchmark ("log: baseline loop", bench_log_baseline, iterations);
+    run_benchmark ("log: level compiled out", bench_log_compiled_out,
+                   iterations);
+    run_benchmark ("log: level disabled at run time", bench_log_disabled,
+                   iterations);
+    run_benchmark ("log: enabled, rate-limited call site",
+                   bench_log_rate_limited, iterations);
+    g_log_set_default_handler (old_handler, NULL);
+
+    /* a 4 KiB message takes as long as thousands of log calls */
+    iterations = MAX (iterations / 1000, 1);
+    for (size = 16; size <= LAYER_MESSAGE_SIZE; size *= 16) {
+        for (layer_qop = GSIGNOND_SASL_QOP_AUTH_INT;
+             layer_qop <= GSIGNOND_SASL_QOP_AUTH_CONF; layer_qop++) {
+            const gchar *qop = layer_qop == GSIGNOND_SASL_QOP_AUTH_INT ?
+                "qop-int" : "qop-conf";
+            gchar *name;
+
+            batch_message_size = size;
+            name = g_strdup_printf ("layer: %" G_GSIZE_FORMAT " B, %s, single",
+                                    size, qop);
+            run_message_rate (name, bench_layer_messages, iterations,
+                              LAYER_BATCH);
+            g_free (name);
+            name = g_strdup_printf ("layer: %" G_GSIZE_FORMAT " B, %s, batch",
+                                    size, qop);
+            run_message_rate (name, bench_layer_batch, iterations,
+                              LAYER_BATCH);
+            g_free (name);
+        }
+    }
+    layer_qop = GSIGNOND_SASL_QOP_AUTH_INT;
+    run_throughput ("layer: wrap, qop-int", bench_layer_wrap, iterations,
+                    LAYER_MESSAGE_SIZE);
+    run_throughput ("layer: wrap + unwrap, qop-int", bench_layer_round_trip,
+                    iterations, LAYER_MESSAGE_SIZE);
+    layer_qop = GSIGNOND_SASL_QOP_AUTH_CONF;
+    run_throughput ("layer: wrap, qop-conf", bench_layer_wrap, iterations,
+                    LAYER_MESSAGE_SIZE);
+    run_throughput ("layer: wrap + unwrap, qop-conf", bench_layer_round_trip,
+                    iterations, LAYER_MESSAGE_SIZE);
+
+    run_benchmark ("step: PLAIN, signals", bench_step_signal, iterations);
+    run_benchmark ("step: PLAIN, direct", bench_step_direct, iterations);
+
+    /* a derivation takes about a millisecond */
+    iterations = MAX (iterations / 10, 1);
+    run_benchmark ("kdf: PBKDF2-SHA1 4096, plugin", bench_pbkdf2,
+                   iterations);
+    run_benchmark ("kdf: PBKDF2-SHA1 4096, GHmac copies", bench_pbkdf2_ghmac,
+                   iterations);
+#if defined (GSASL_VERSION_NUMBER) && GSASL_VERSION_NUMBER >= 0x010a00
+    run_benchmark ("kdf: PBKDF2-SHA1 4096, libgsasl", bench_pbkdf2_gsasl,
+                   iterations);
+#endif
+
+    return EXIT_SUCCESS;
+}